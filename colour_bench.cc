@@ -0,0 +1,149 @@
+/*
+ * Colourspace kernel check and benchmark.
+ *
+ * Every SIMD kernel set available on this CPU is first compared byte for byte
+ * against the scalar reference on random lines of several widths (so the
+ * vector body and the scalar tail are both exercised), then each kernel is
+ * timed converting full frames.
+ *
+ *   ./colour-bench [width height seconds]
+ *
+ * Exits non zero if any kernel disagrees with the reference.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "colourspace.h"
+
+#define BENCH_WIDTH           1920
+#define BENCH_HEIGHT          1080
+#define BENCH_SECONDS         1.0
+
+typedef struct {
+  const char *name;
+  PixelFormat from;
+  PixelFormat to;
+} Conversion;
+
+static const Conversion conversions[] = {
+  {"rgb->uyvy", PIXEL_RGB24, PIXEL_UYVY},
+  {"rgba->uyvy", PIXEL_RGBA, PIXEL_UYVY},
+  {"rgb->yuyv", PIXEL_RGB24, PIXEL_YUYV},
+  {"rgba->yuyv", PIXEL_RGBA, PIXEL_YUYV},
+  {"uyvy->rgb", PIXEL_UYVY, PIXEL_RGB24},
+  {"uyvy->rgba", PIXEL_UYVY, PIXEL_RGBA},
+  {"yuyv->rgb", PIXEL_YUYV, PIXEL_RGB24},
+  {"yuyv->rgba", PIXEL_YUYV, PIXEL_RGBA},
+};
+
+#define CONVERSIONS (int) (sizeof(conversions) / sizeof(conversions[0]))
+
+static double Now() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void Random(std::vector < uint8_t > &buffer) {
+  for (size_t c = 0; c < buffer.size(); c++)
+    buffer[c] = rand() & 0xFF;
+}
+
+/* Compare kernels against the reference, returns the number of mismatches */
+static int Check(const ColourKernels * kernels) {
+  static const int widths[] = { 2, 6, 8, 14, 16, 18, 30, 34, 64, 86, 640, 1922 };
+  const ColourKernels *reference = ColourKernelsScalar();
+  int failed = 0;
+
+  for (int c = 0; c < CONVERSIONS; c++) {
+    const Conversion *conv = &conversions[c];
+    ColourLine test = ColourLineKernel(kernels, conv->from, conv->to);
+    ColourLine ref = ColourLineKernel(reference, conv->from, conv->to);
+
+    for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+      int width = widths[w];
+      std::vector < uint8_t > src(width * PixelBytes(conv->from));
+      std::vector < uint8_t > expect(width * PixelBytes(conv->to));
+      std::vector < uint8_t > result(width * PixelBytes(conv->to));
+
+      for (int pass = 0; pass < 16; pass++) {
+        Random(src);
+        ref(&src[0], &expect[0], width);
+        test(&src[0], &result[0], width);
+        if (memcmp(&expect[0], &result[0], expect.size())) {
+          printf("FAIL %s %s width %d\n", kernels->name, conv->name, width);
+          failed++;
+          break;
+        }
+      }
+    }
+  }
+  return failed;
+}
+
+static void Bench(const ColourKernels * kernels, int width, int height,
+                  double seconds) {
+  printf("%-8s", kernels->name);
+  for (int c = 0; c < CONVERSIONS; c++) {
+    const Conversion *conv = &conversions[c];
+    ColourLine line = ColourLineKernel(kernels, conv->from, conv->to);
+    int src_stride = width * PixelBytes(conv->from);
+    int dst_stride = width * PixelBytes(conv->to);
+    std::vector < uint8_t > src(src_stride * height);
+    std::vector < uint8_t > dst(dst_stride * height);
+    double start, elapsed;
+    long frames = 0;
+
+    Random(src);
+    start = Now();
+    do {
+      for (int y = 0; y < height; y++)
+        line(&src[y * src_stride], &dst[y * dst_stride], width);
+      frames++;
+    } while ((elapsed = Now() - start) < seconds);
+    printf(" %10.1f", (double) frames * width * height / elapsed / 1e6);
+  }
+  printf("\n");
+}
+
+int main(int argc, char **argv) {
+  const ColourKernels *sets[] = {
+    ColourKernelsScalar(), ColourKernelsSse2(), ColourKernelsAvx2(),
+    ColourKernelsNeon()
+  };
+  int width = BENCH_WIDTH;
+  int height = BENCH_HEIGHT;
+  double seconds = BENCH_SECONDS;
+  int failed = 0;
+
+  if (argc == 4) {
+    width = atoi(argv[1]) & ~1;
+    height = atoi(argv[2]);
+    seconds = atof(argv[3]);
+  }
+
+  srand(1);
+  for (size_t s = 1; s < sizeof(sets) / sizeof(sets[0]); s++) {
+    if (!sets[s])
+      continue;
+    if (Check(sets[s]))
+      failed++;
+    else
+      printf("PASS %s bit exact with scalar\n", sets[s]->name);
+  }
+  printf("Best kernels %s\n", ColourKernelsBest()->name);
+
+  printf("\nMpixel/s at %dx%d\n%-8s", width, height, "");
+  for (int c = 0; c < CONVERSIONS; c++)
+    printf(" %10s", conversions[c].name);
+  printf("\n");
+  for (size_t s = 0; s < sizeof(sets) / sizeof(sets[0]); s++) {
+    if (sets[s])
+      Bench(sets[s], width, height, seconds);
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,163 @@
+#include <stddef.h>
+#include "colourspace.h"
+
+void ColourRgbToYuvScalar(const uint8_t * src, uint8_t * dst, int start,
+                          int width, int src_bpp, bool uyvy) {
+  for (int x = start; x < width; x += 2) {
+    const uint8_t *p0 = &src[x * src_bpp];
+    const uint8_t *p1 = p0 + src_bpp;
+    uint8_t *out = &dst[x * 2];
+    int r = (p0[0] + p1[0] + 1) >> 1;
+    int g = (p0[1] + p1[1] + 1) >> 1;
+    int b = (p0[2] + p1[2] + 1) >> 1;
+    uint8_t y0 = RgbToY(p0[0], p0[1], p0[2]);
+    uint8_t y1 = RgbToY(p1[0], p1[1], p1[2]);
+
+    if (uyvy) {
+      out[0] = RgbToU(r, g, b);
+      out[1] = y0;
+      out[2] = RgbToV(r, g, b);
+      out[3] = y1;
+    } else {
+      out[0] = y0;
+      out[1] = RgbToU(r, g, b);
+      out[2] = y1;
+      out[3] = RgbToV(r, g, b);
+    }
+  }
+}
+
+void ColourYuvToRgbScalar(const uint8_t * src, uint8_t * dst, int start,
+                          int width, int dst_bpp, bool uyvy) {
+  for (int x = start; x < width; x += 2) {
+    const uint8_t *in = &src[x * 2];
+    uint8_t *p0 = &dst[x * dst_bpp];
+    uint8_t *p1 = p0 + dst_bpp;
+    int u, v, y0, y1;
+
+    if (uyvy) {
+      u = in[0];
+      y0 = in[1];
+      v = in[2];
+      y1 = in[3];
+    } else {
+      y0 = in[0];
+      u = in[1];
+      y1 = in[2];
+      v = in[3];
+    }
+    YuvToRgb(y0, u, v, p0);
+    YuvToRgb(y1, u, v, p1);
+    if (dst_bpp == 4) {
+      p0[3] = 255;
+      p1[3] = 255;
+    }
+  }
+}
+
+static void RgbToUyvy(const uint8_t * src, uint8_t * dst, int width) {
+  ColourRgbToYuvScalar(src, dst, 0, width, 3, true);
+}
+
+static void RgbaToUyvy(const uint8_t * src, uint8_t * dst, int width) {
+  ColourRgbToYuvScalar(src, dst, 0, width, 4, true);
+}
+
+static void RgbToYuyv(const uint8_t * src, uint8_t * dst, int width) {
+  ColourRgbToYuvScalar(src, dst, 0, width, 3, false);
+}
+
+static void RgbaToYuyv(const uint8_t * src, uint8_t * dst, int width) {
+  ColourRgbToYuvScalar(src, dst, 0, width, 4, false);
+}
+
+static void UyvyToRgb(const uint8_t * src, uint8_t * dst, int width) {
+  ColourYuvToRgbScalar(src, dst, 0, width, 3, true);
+}
+
+static void UyvyToRgba(const uint8_t * src, uint8_t * dst, int width) {
+  ColourYuvToRgbScalar(src, dst, 0, width, 4, true);
+}
+
+static void YuyvToRgb(const uint8_t * src, uint8_t * dst, int width) {
+  ColourYuvToRgbScalar(src, dst, 0, width, 3, false);
+}
+
+static void YuyvToRgba(const uint8_t * src, uint8_t * dst, int width) {
+  ColourYuvToRgbScalar(src, dst, 0, width, 4, false);
+}
+
+static const ColourKernels scalar_kernels = {
+  "scalar",
+  RgbToUyvy, RgbaToUyvy, RgbToYuyv, RgbaToYuyv,
+  UyvyToRgb, UyvyToRgba, YuyvToRgb, YuyvToRgba
+};
+
+const ColourKernels *ColourKernelsScalar() {
+  return &scalar_kernels;
+}
+
+//
+// Pick the widest SIMD kernels the CPU supports, decided once
+//
+const ColourKernels *ColourKernelsBest() {
+  static const ColourKernels *best = 0;
+
+  if (!best) {
+    const ColourKernels *kernels;
+
+    if ((kernels = ColourKernelsAvx2()) ||
+        (kernels = ColourKernelsSse2()) || (kernels = ColourKernelsNeon()))
+      best = kernels;
+    else
+      best = ColourKernelsScalar();
+  }
+  return best;
+}
+
+ColourLine ColourLineKernel(const ColourKernels * kernels, PixelFormat from,
+                            PixelFormat to) {
+  switch (from) {
+  case PIXEL_RGB24:
+    return to == PIXEL_UYVY ? kernels->rgb_to_uyvy :
+      to == PIXEL_YUYV ? kernels->rgb_to_yuyv : NULL;
+  case PIXEL_RGBA:
+    return to == PIXEL_UYVY ? kernels->rgba_to_uyvy :
+      to == PIXEL_YUYV ? kernels->rgba_to_yuyv : NULL;
+  case PIXEL_UYVY:
+    return to == PIXEL_RGB24 ? kernels->uyvy_to_rgb :
+      to == PIXEL_RGBA ? kernels->uyvy_to_rgba : NULL;
+  case PIXEL_YUYV:
+    return to == PIXEL_RGB24 ? kernels->yuyv_to_rgb :
+      to == PIXEL_RGBA ? kernels->yuyv_to_rgba : NULL;
+  }
+  return NULL;
+}
+
+int PixelBytes(PixelFormat format) {
+  switch (format) {
+  case PIXEL_RGB24:
+    return 3;
+  case PIXEL_RGBA:
+    return 4;
+  default:
+    return 2;
+  }
+}
+
+//
+// Convert a whole packed frame using the best kernels. Returns false if the
+// conversion is not between RGB and YUV 4:2:2 or the width is odd.
+//
+bool ColourConvert(PixelFormat from, PixelFormat to, const uint8_t * src,
+                   uint8_t * dst, int width, int height) {
+  ColourLine line = ColourLineKernel(ColourKernelsBest(), from, to);
+  int src_stride = width * PixelBytes(from);
+  int dst_stride = width * PixelBytes(to);
+
+  if (!line || (width & 1))
+    return false;
+  for (int y = 0; y < height; y++)
+    line(&src[y * src_stride], &dst[y * dst_stride], width);
+  return true;
+}
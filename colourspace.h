@@ -0,0 +1,89 @@
+/*
+ * RGB/RGBA <-> packed YCbCr 4:2:2 (UYVY and YUYV) colourspace conversion.
+ *
+ * All kernels use the same BT.601 limited range fixed point arithmetic so the
+ * SIMD versions are bit exact with the scalar reference. Chroma is the
+ * rounded average of each pixel pair on the way in and is repeated for both
+ * pixels on the way out. The fastest kernel set for the CPU is picked at run
+ * time.
+ */
+
+#ifndef __COLOURSPACE_H__
+#define __COLOURSPACE_H__
+
+#include <stdint.h>
+
+typedef enum {
+  PIXEL_RGB24,                  /* R G B */
+  PIXEL_RGBA,                   /* R G B A, alpha is 255 on output */
+  PIXEL_UYVY,                   /* Cb Y0 Cr Y1, RFC 4175 YCbCr-4:2:2 order */
+  PIXEL_YUYV                    /* Y0 Cb Y1 Cr */
+} PixelFormat;
+
+/* Convert one line of width pixels, width must be even */
+typedef void (*ColourLine) (const uint8_t * src, uint8_t * dst, int width);
+
+typedef struct {
+  const char *name;
+  ColourLine rgb_to_uyvy;
+  ColourLine rgba_to_uyvy;
+  ColourLine rgb_to_yuyv;
+  ColourLine rgba_to_yuyv;
+  ColourLine uyvy_to_rgb;
+  ColourLine uyvy_to_rgba;
+  ColourLine yuyv_to_rgb;
+  ColourLine yuyv_to_rgba;
+} ColourKernels;
+
+/* Kernel sets, the SIMD ones return 0 if not built for or supported by this CPU */
+const ColourKernels *ColourKernelsScalar();
+const ColourKernels *ColourKernelsSse2();
+const ColourKernels *ColourKernelsAvx2();
+const ColourKernels *ColourKernelsNeon();
+const ColourKernels *ColourKernelsBest();
+
+ColourLine ColourLineKernel(const ColourKernels * kernels, PixelFormat from,
+                            PixelFormat to);
+int PixelBytes(PixelFormat format);
+bool ColourConvert(PixelFormat from, PixelFormat to, const uint8_t * src,
+                   uint8_t * dst, int width, int height);
+
+//
+// Scalar reference arithmetic, shared by the kernels for their line tails
+//
+static inline uint8_t ColourClip(int x) {
+  return x < 0 ? 0 : (x > 255 ? 255 : x);
+}
+
+static inline uint8_t RgbToY(int r, int g, int b) {
+  return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+}
+
+static inline uint8_t RgbToU(int r, int g, int b) {
+  return ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+}
+
+static inline uint8_t RgbToV(int r, int g, int b) {
+  return ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+static inline void YuvToRgb(int y, int u, int v, uint8_t * rgb) {
+  int c = y - 16;
+  int d = u - 128;
+  int e = v - 128;
+
+  rgb[0] = ColourClip((298 * c + 409 * e + 128) >> 8);
+  rgb[1] = ColourClip((298 * c - 100 * d - 208 * e + 128) >> 8);
+  rgb[2] = ColourClip((298 * c + 516 * d + 128) >> 8);
+}
+
+//
+// Reference conversion of pixels [start, width) of a line. src_bpp/dst_bpp
+// are the RGB bytes per pixel (3 or 4), uyvy selects the 4:2:2 byte order.
+//
+void ColourRgbToYuvScalar(const uint8_t * src, uint8_t * dst, int start,
+                          int width, int src_bpp, bool uyvy);
+void ColourYuvToRgbScalar(const uint8_t * src, uint8_t * dst, int start,
+                          int width, int dst_bpp, bool uyvy);
+
+#endif
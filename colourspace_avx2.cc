@@ -0,0 +1,208 @@
+//
+// AVX2 colourspace kernels, 16 pixels per iteration. The arithmetic is the
+// SSE2 kernels' run in both 128 bit lanes, lane 0 holding pixels 0-7 and lane
+// 1 pixels 8-15. Built with a target attribute so the rest of the library
+// does not need -mavx2, and only selected if the CPU reports AVX2.
+//
+#include "colourspace.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define AVX2 __attribute__ ((target("avx2")))
+
+static inline AVX2 __m256i Pair16(short lo, short hi) {
+  return _mm256_set_epi16(hi, lo, hi, lo, hi, lo, hi, lo,
+                          hi, lo, hi, lo, hi, lo, hi, lo);
+}
+
+static inline AVX2 __m256i Load2x128(const uint8_t * lo, const uint8_t * hi) {
+  return _mm256_inserti128_si256(_mm256_castsi128_si256
+                                 (_mm_loadu_si128((const __m128i *) lo)),
+                                 _mm_loadu_si128((const __m128i *) hi), 1);
+}
+
+//
+// 16 RGB(A) pixels to three vectors of 16 bit components. Each lane is
+// arranged as 4 pixels from a then 4 from b, so the packs leave 8 pixels in
+// order per lane. RGB24 reads 4 bytes past pixel 15.
+//
+template < int BPP > static inline AVX2 void LoadRgb(const uint8_t * src,
+                                                     __m256i * r, __m256i * g,
+                                                     __m256i * b) {
+  const __m256i mask = _mm256_set1_epi32(0xFF);
+  __m256i a, c;
+
+  if (BPP == 4) {
+    __m256i p0 = _mm256_loadu_si256((const __m256i *) src);
+    __m256i p1 = _mm256_loadu_si256((const __m256i *) (src + 32));
+
+    a = _mm256_permute2x128_si256(p0, p1, 0x20);
+    c = _mm256_permute2x128_si256(p0, p1, 0x31);
+  } else {
+    const __m256i expand = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+                                            6, 7, 8, -1, 9, 10, 11, -1,
+                                            0, 1, 2, -1, 3, 4, 5, -1,
+                                            6, 7, 8, -1, 9, 10, 11, -1);
+
+    a = _mm256_shuffle_epi8(Load2x128(src, src + 24), expand);
+    c = _mm256_shuffle_epi8(Load2x128(src + 12, src + 36), expand);
+  }
+  *r = _mm256_packs_epi32(_mm256_and_si256(a, mask),
+                          _mm256_and_si256(c, mask));
+  *g = _mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(a, 8), mask),
+                          _mm256_and_si256(_mm256_srli_epi32(c, 8), mask));
+  *b = _mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(a, 16), mask),
+                          _mm256_and_si256(_mm256_srli_epi32(c, 16), mask));
+}
+
+static inline AVX2 __m256i PairAverage(__m256i x) {
+  __m256i even = _mm256_and_si256(x, _mm256_set1_epi32(0xFFFF));
+  __m256i odd = _mm256_srli_epi32(x, 16);
+  __m256i avg = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(even, odd),
+                                                   _mm256_set1_epi32(1)), 1);
+
+  return _mm256_packs_epi32(avg, avg);
+}
+
+static inline AVX2 __m256i Chroma(__m256i r, __m256i g, __m256i b, short cr,
+                                  short cg, short cb) {
+  __m256i x = _mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(cr)),
+                               _mm256_mullo_epi16(g, _mm256_set1_epi16(cg)));
+
+  x = _mm256_add_epi16(x, _mm256_mullo_epi16(b, _mm256_set1_epi16(cb)));
+  x = _mm256_srai_epi16(_mm256_add_epi16(x, _mm256_set1_epi16(128)), 8);
+  return _mm256_add_epi16(x, _mm256_set1_epi16(128));
+}
+
+template < int BPP, bool UYVY > static AVX2 void RgbToYuv(const uint8_t * src,
+                                                          uint8_t * dst,
+                                                          int width) {
+  int x = 0;
+
+  for (; x + (BPP == 4 ? 16 : 18) <= width; x += 16) {
+    __m256i r, g, b, y, ra, ga, ba, uv, out;
+
+    LoadRgb < BPP > (&src[x * BPP], &r, &g, &b);
+
+    y = _mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(66)),
+                         _mm256_mullo_epi16(g, _mm256_set1_epi16(129)));
+    y = _mm256_add_epi16(y, _mm256_mullo_epi16(b, _mm256_set1_epi16(25)));
+    y = _mm256_srli_epi16(_mm256_add_epi16(y, _mm256_set1_epi16(128)), 8);
+    y = _mm256_add_epi16(y, _mm256_set1_epi16(16));
+
+    ra = PairAverage(r);
+    ga = PairAverage(g);
+    ba = PairAverage(b);
+    uv = _mm256_unpacklo_epi16(Chroma(ra, ga, ba, -38, -74, 112),
+                               Chroma(ra, ga, ba, 112, -94, -18));
+
+    if (UYVY)
+      out = _mm256_or_si256(uv, _mm256_slli_epi16(y, 8));
+    else
+      out = _mm256_or_si256(y, _mm256_slli_epi16(uv, 8));
+    _mm256_storeu_si256((__m256i *) & dst[x * 2], out);
+  }
+  ColourRgbToYuvScalar(src, dst, x, width, BPP, UYVY);
+}
+
+static inline AVX2 __m256i Channel(__m256i c, __m256i d, __m256i e, short cd,
+                                   short ce) {
+  const __m256i one = _mm256_set1_epi16(1);
+  __m256i lo, hi;
+
+  lo = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(c, d),
+                                          Pair16(298, cd)),
+                        _mm256_madd_epi16(_mm256_unpacklo_epi16(e, one),
+                                          Pair16(ce, 128)));
+  hi = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(c, d),
+                                          Pair16(298, cd)),
+                        _mm256_madd_epi16(_mm256_unpackhi_epi16(e, one),
+                                          Pair16(ce, 128)));
+  return _mm256_packs_epi32(_mm256_srai_epi32(lo, 8),
+                            _mm256_srai_epi32(hi, 8));
+}
+
+template < int BPP, bool UYVY > static AVX2 void YuvToRgb(const uint8_t * src,
+                                                          uint8_t * dst,
+                                                          int width) {
+  const __m256i low = _mm256_set1_epi16(0xFF);
+  int x = 0;
+
+  for (; x + (BPP == 4 ? 16 : 18) <= width; x += 16) {
+    __m256i in = _mm256_loadu_si256((const __m256i *) & src[x * 2]);
+    __m256i y, uv, u, v, c, d, e, r, g, b, rg, ba, lo, hi, p0, p1;
+
+    if (UYVY) {
+      y = _mm256_srli_epi16(in, 8);
+      uv = _mm256_and_si256(in, low);
+    } else {
+      y = _mm256_and_si256(in, low);
+      uv = _mm256_srli_epi16(in, 8);
+    }
+
+    u = _mm256_and_si256(uv, _mm256_set1_epi32(0xFFFF));
+    u = _mm256_or_si256(u, _mm256_slli_epi32(u, 16));
+    v = _mm256_srli_epi32(uv, 16);
+    v = _mm256_or_si256(v, _mm256_slli_epi32(v, 16));
+
+    c = _mm256_sub_epi16(y, _mm256_set1_epi16(16));
+    d = _mm256_sub_epi16(u, _mm256_set1_epi16(128));
+    e = _mm256_sub_epi16(v, _mm256_set1_epi16(128));
+
+    r = Channel(c, d, e, 0, 409);
+    g = Channel(c, d, e, -100, -208);
+    b = Channel(c, d, e, 516, 0);
+    r = _mm256_packus_epi16(r, r);
+    g = _mm256_packus_epi16(g, g);
+    b = _mm256_packus_epi16(b, b);
+
+    rg = _mm256_unpacklo_epi8(r, g);
+    ba = _mm256_unpacklo_epi8(b, _mm256_set1_epi8(-1));
+    lo = _mm256_unpacklo_epi16(rg, ba);
+    hi = _mm256_unpackhi_epi16(rg, ba);
+    p0 = _mm256_permute2x128_si256(lo, hi, 0x20);       /* pixels 0-7 */
+    p1 = _mm256_permute2x128_si256(lo, hi, 0x31);       /* pixels 8-15 */
+    if (BPP == 4) {
+      _mm256_storeu_si256((__m256i *) & dst[x * 4], p0);
+      _mm256_storeu_si256((__m256i *) & dst[x * 4 + 32], p1);
+    } else {
+      const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9,
+                                            10, 12, 13, 14, -1, -1, -1, -1,
+                                            0, 1, 2, 4, 5, 6, 8, 9,
+                                            10, 12, 13, 14, -1, -1, -1, -1);
+      uint8_t *out = &dst[x * 3];
+
+      /* 12 useful bytes per store, each overwrites the last one's padding */
+      p0 = _mm256_shuffle_epi8(p0, pack);
+      p1 = _mm256_shuffle_epi8(p1, pack);
+      _mm_storeu_si128((__m128i *) out, _mm256_castsi256_si128(p0));
+      _mm_storeu_si128((__m128i *) (out + 12),
+                       _mm256_extracti128_si256(p0, 1));
+      _mm_storeu_si128((__m128i *) (out + 24), _mm256_castsi256_si128(p1));
+      _mm_storeu_si128((__m128i *) (out + 36),
+                       _mm256_extracti128_si256(p1, 1));
+    }
+  }
+  ColourYuvToRgbScalar(src, dst, x, width, BPP, UYVY);
+}
+
+static const ColourKernels avx2_kernels = {
+  "avx2",
+  RgbToYuv < 3, true >, RgbToYuv < 4, true >,
+  RgbToYuv < 3, false >, RgbToYuv < 4, false >,
+  YuvToRgb < 3, true >, YuvToRgb < 4, true >,
+  YuvToRgb < 3, false >, YuvToRgb < 4, false >
+};
+
+const ColourKernels *ColourKernelsAvx2() {
+  return __builtin_cpu_supports("avx2") ? &avx2_kernels : 0;
+}
+
+#else
+
+const ColourKernels *ColourKernelsAvx2() {
+  return 0;
+}
+
+#endif
@@ -0,0 +1,171 @@
+//
+// NEON colourspace kernels for the ARM targets (Jetson TX1/TX2), 16 pixels
+// per iteration using the structure loads/stores to (de)interleave.
+//
+#include "colourspace.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+
+static inline uint16x8_t Luma(uint8x8_t r, uint8x8_t g, uint8x8_t b) {
+  uint16x8_t y = vmull_u8(r, vdup_n_u8(66));
+
+  y = vmlal_u8(y, g, vdup_n_u8(129));
+  y = vmlal_u8(y, b, vdup_n_u8(25));
+  y = vshrq_n_u16(vaddq_u16(y, vdupq_n_u16(128)), 8);
+  return vaddq_u16(y, vdupq_n_u16(16));
+}
+
+static inline uint8x8_t Chroma(uint16x8_t r, uint16x8_t g, uint16x8_t b,
+                               int16_t cr, int16_t cg, int16_t cb) {
+  int16x8_t x = vmulq_n_s16(vreinterpretq_s16_u16(r), cr);
+
+  x = vmlaq_n_s16(x, vreinterpretq_s16_u16(g), cg);
+  x = vmlaq_n_s16(x, vreinterpretq_s16_u16(b), cb);
+  x = vshrq_n_s16(vaddq_s16(x, vdupq_n_s16(128)), 8);
+  x = vaddq_s16(x, vdupq_n_s16(128));
+  return vmovn_u16(vreinterpretq_u16_s16(x));
+}
+
+template < int BPP, bool UYVY > static void RgbToYuv(const uint8_t * src,
+                                                     uint8_t * dst,
+                                                     int width) {
+  int x = 0;
+
+  for (; x + 16 <= width; x += 16) {
+    uint8x16_t r, g, b;
+    uint16x8_t ra, ga, ba;
+    uint8x8x2_t y;
+    uint8x8x4_t out;
+    uint8x8_t u, v;
+
+    if (BPP == 4) {
+      uint8x16x4_t p = vld4q_u8(&src[x * 4]);
+
+      r = p.val[0];
+      g = p.val[1];
+      b = p.val[2];
+    } else {
+      uint8x16x3_t p = vld3q_u8(&src[x * 3]);
+
+      r = p.val[0];
+      g = p.val[1];
+      b = p.val[2];
+    }
+
+    /* Split luma into even and odd pixels */
+    y = vuzp_u8(vmovn_u16(Luma(vget_low_u8(r), vget_low_u8(g),
+                               vget_low_u8(b))),
+                vmovn_u16(Luma(vget_high_u8(r), vget_high_u8(g),
+                               vget_high_u8(b))));
+
+    ra = vrshrq_n_u16(vpaddlq_u8(r), 1);
+    ga = vrshrq_n_u16(vpaddlq_u8(g), 1);
+    ba = vrshrq_n_u16(vpaddlq_u8(b), 1);
+    u = Chroma(ra, ga, ba, -38, -74, 112);
+    v = Chroma(ra, ga, ba, 112, -94, -18);
+
+    if (UYVY) {
+      out.val[0] = u;
+      out.val[1] = y.val[0];
+      out.val[2] = v;
+      out.val[3] = y.val[1];
+    } else {
+      out.val[0] = y.val[0];
+      out.val[1] = u;
+      out.val[2] = y.val[1];
+      out.val[3] = v;
+    }
+    vst4_u8(&dst[x * 2], out);
+  }
+  ColourRgbToYuvScalar(src, dst, x, width, BPP, UYVY);
+}
+
+/* One channel for 8 pixels, clip((c * 298 + d * cd + e * ce + 128) >> 8) */
+static inline uint8x8_t Channel(int16x8_t c, int16x8_t d, int16x8_t e,
+                                int16_t cd, int16_t ce) {
+  int32x4_t lo = vmull_n_s16(vget_low_s16(c), 298);
+  int32x4_t hi = vmull_n_s16(vget_high_s16(c), 298);
+
+  lo = vmlal_n_s16(lo, vget_low_s16(d), cd);
+  hi = vmlal_n_s16(hi, vget_high_s16(d), cd);
+  lo = vmlal_n_s16(lo, vget_low_s16(e), ce);
+  hi = vmlal_n_s16(hi, vget_high_s16(e), ce);
+  lo = vaddq_s32(lo, vdupq_n_s32(128));
+  hi = vaddq_s32(hi, vdupq_n_s32(128));
+  return vqmovun_s16(vcombine_s16(vshrn_n_s32(lo, 8), vshrn_n_s32(hi, 8)));
+}
+
+template < int BPP, bool UYVY > static void YuvToRgb(const uint8_t * src,
+                                                     uint8_t * dst,
+                                                     int width) {
+  int x = 0;
+
+  for (; x + 16 <= width; x += 16) {
+    uint8x8x4_t in = vld4_u8(&src[x * 2]);
+    uint8x8_t u8, v8, y0, y1;
+    int16x8_t c0, c1, d, e;
+    uint8x8x2_t r, g, b;
+
+    if (UYVY) {
+      u8 = in.val[0];
+      y0 = in.val[1];
+      v8 = in.val[2];
+      y1 = in.val[3];
+    } else {
+      y0 = in.val[0];
+      u8 = in.val[1];
+      y1 = in.val[2];
+      v8 = in.val[3];
+    }
+
+    /* Widening subtract wraps, reinterpreted as signed it is exact */
+    c0 = vreinterpretq_s16_u16(vsubl_u8(y0, vdup_n_u8(16)));
+    c1 = vreinterpretq_s16_u16(vsubl_u8(y1, vdup_n_u8(16)));
+    d = vreinterpretq_s16_u16(vsubl_u8(u8, vdup_n_u8(128)));
+    e = vreinterpretq_s16_u16(vsubl_u8(v8, vdup_n_u8(128)));
+
+    /* Even and odd pixels share chroma, zip them back into order */
+    r = vzip_u8(Channel(c0, d, e, 0, 409), Channel(c1, d, e, 0, 409));
+    g = vzip_u8(Channel(c0, d, e, -100, -208), Channel(c1, d, e, -100, -208));
+    b = vzip_u8(Channel(c0, d, e, 516, 0), Channel(c1, d, e, 516, 0));
+
+    if (BPP == 4) {
+      uint8x16x4_t out;
+
+      out.val[0] = vcombine_u8(r.val[0], r.val[1]);
+      out.val[1] = vcombine_u8(g.val[0], g.val[1]);
+      out.val[2] = vcombine_u8(b.val[0], b.val[1]);
+      out.val[3] = vdupq_n_u8(255);
+      vst4q_u8(&dst[x * 4], out);
+    } else {
+      uint8x16x3_t out;
+
+      out.val[0] = vcombine_u8(r.val[0], r.val[1]);
+      out.val[1] = vcombine_u8(g.val[0], g.val[1]);
+      out.val[2] = vcombine_u8(b.val[0], b.val[1]);
+      vst3q_u8(&dst[x * 3], out);
+    }
+  }
+  ColourYuvToRgbScalar(src, dst, x, width, BPP, UYVY);
+}
+
+static const ColourKernels neon_kernels = {
+  "neon",
+  RgbToYuv < 3, true >, RgbToYuv < 4, true >,
+  RgbToYuv < 3, false >, RgbToYuv < 4, false >,
+  YuvToRgb < 3, true >, YuvToRgb < 4, true >,
+  YuvToRgb < 3, false >, YuvToRgb < 4, false >
+};
+
+const ColourKernels *ColourKernelsNeon() {
+  return &neon_kernels;
+}
+
+#else
+
+const ColourKernels *ColourKernelsNeon() {
+  return 0;
+}
+
+#endif
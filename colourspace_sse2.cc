@@ -0,0 +1,189 @@
+//
+// SSE2 colourspace kernels, 8 pixels per iteration. RGB24 has no cheap
+// deinterleave without SSSE3 so it is gathered/scattered a pixel at a time
+// through RGBA.
+//
+#include <string.h>
+#include "colourspace.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+
+static inline __m128i Pair16(short lo, short hi) {
+  return _mm_set_epi16(hi, lo, hi, lo, hi, lo, hi, lo);
+}
+
+/* 8 RGB(A) pixels to three vectors of 8 x 16 bit components, RGB24 reads 1 byte past */
+template < int BPP > static inline void LoadRgb(const uint8_t * src,
+                                                __m128i * r, __m128i * g,
+                                                __m128i * b) {
+  const __m128i mask = _mm_set1_epi32(0xFF);
+  __m128i a, c;
+
+  if (BPP == 4) {
+    a = _mm_loadu_si128((const __m128i *) src);
+    c = _mm_loadu_si128((const __m128i *) (src + 16));
+  } else {
+    uint32_t p[8];
+
+    /* Unaligned 4 byte loads, the top byte is masked off below */
+    memcpy(p, src, 4);
+    memcpy(&p[1], src + 3, 4);
+    memcpy(&p[2], src + 6, 4);
+    memcpy(&p[3], src + 9, 4);
+    memcpy(&p[4], src + 12, 4);
+    memcpy(&p[5], src + 15, 4);
+    memcpy(&p[6], src + 18, 4);
+    memcpy(&p[7], src + 21, 4);
+    a = _mm_setr_epi32(p[0], p[1], p[2], p[3]);
+    c = _mm_setr_epi32(p[4], p[5], p[6], p[7]);
+  }
+  *r = _mm_packs_epi32(_mm_and_si128(a, mask), _mm_and_si128(c, mask));
+  *g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 8), mask),
+                       _mm_and_si128(_mm_srli_epi32(c, 8), mask));
+  *b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 16), mask),
+                       _mm_and_si128(_mm_srli_epi32(c, 16), mask));
+}
+
+/* Rounded average of each pixel pair, 4 results in each half */
+static inline __m128i PairAverage(__m128i x) {
+  __m128i even = _mm_and_si128(x, _mm_set1_epi32(0xFFFF));
+  __m128i odd = _mm_srli_epi32(x, 16);
+  __m128i avg = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(even, odd),
+                                             _mm_set1_epi32(1)), 1);
+
+  return _mm_packs_epi32(avg, avg);
+}
+
+static inline __m128i Chroma(__m128i r, __m128i g, __m128i b, short cr,
+                             short cg, short cb) {
+  __m128i x = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(cr)),
+                            _mm_mullo_epi16(g, _mm_set1_epi16(cg)));
+
+  x = _mm_add_epi16(x, _mm_mullo_epi16(b, _mm_set1_epi16(cb)));
+  x = _mm_srai_epi16(_mm_add_epi16(x, _mm_set1_epi16(128)), 8);
+  return _mm_add_epi16(x, _mm_set1_epi16(128));
+}
+
+template < int BPP, bool UYVY > static void RgbToYuv(const uint8_t * src,
+                                                     uint8_t * dst,
+                                                     int width) {
+  int x = 0;
+
+  for (; x + (BPP == 4 ? 8 : 10) <= width; x += 8) {
+    __m128i r, g, b, y, ra, ga, ba, uv, out;
+
+    LoadRgb < BPP > (&src[x * BPP], &r, &g, &b);
+
+    /* Unsigned 16 bit arithmetic, the sum never exceeds 56228 */
+    y = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)),
+                      _mm_mullo_epi16(g, _mm_set1_epi16(129)));
+    y = _mm_add_epi16(y, _mm_mullo_epi16(b, _mm_set1_epi16(25)));
+    y = _mm_srli_epi16(_mm_add_epi16(y, _mm_set1_epi16(128)), 8);
+    y = _mm_add_epi16(y, _mm_set1_epi16(16));
+
+    ra = PairAverage(r);
+    ga = PairAverage(g);
+    ba = PairAverage(b);
+    uv = _mm_unpacklo_epi16(Chroma(ra, ga, ba, -38, -74, 112),
+                            Chroma(ra, ga, ba, 112, -94, -18));
+
+    if (UYVY)
+      out = _mm_or_si128(uv, _mm_slli_epi16(y, 8));
+    else
+      out = _mm_or_si128(y, _mm_slli_epi16(uv, 8));
+    _mm_storeu_si128((__m128i *) & dst[x * 2], out);
+  }
+  ColourRgbToYuvScalar(src, dst, x, width, BPP, UYVY);
+}
+
+/* One colour channel for 8 pixels, (c * 298 + d * cd + e * ce + 128) >> 8 */
+static inline __m128i Channel(__m128i c, __m128i d, __m128i e, short cd,
+                              short ce) {
+  const __m128i one = _mm_set1_epi16(1);
+  __m128i lo, hi;
+
+  lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(c, d), Pair16(298, cd)),
+                     _mm_madd_epi16(_mm_unpacklo_epi16(e, one), Pair16(ce, 128)));
+  hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(c, d), Pair16(298, cd)),
+                     _mm_madd_epi16(_mm_unpackhi_epi16(e, one), Pair16(ce, 128)));
+  return _mm_packs_epi32(_mm_srai_epi32(lo, 8), _mm_srai_epi32(hi, 8));
+}
+
+template < int BPP, bool UYVY > static void YuvToRgb(const uint8_t * src,
+                                                     uint8_t * dst,
+                                                     int width) {
+  const __m128i low = _mm_set1_epi16(0xFF);
+  int x = 0;
+
+  for (; x + 8 <= width; x += 8) {
+    __m128i in = _mm_loadu_si128((const __m128i *) & src[x * 2]);
+    __m128i y, uv, u, v, c, d, e, r, g, b, rg, ba, lo, hi;
+
+    if (UYVY) {
+      y = _mm_srli_epi16(in, 8);
+      uv = _mm_and_si128(in, low);
+    } else {
+      y = _mm_and_si128(in, low);
+      uv = _mm_srli_epi16(in, 8);
+    }
+
+    /* Repeat each chroma sample for both pixels of the pair */
+    u = _mm_and_si128(uv, _mm_set1_epi32(0xFFFF));
+    u = _mm_or_si128(u, _mm_slli_epi32(u, 16));
+    v = _mm_srli_epi32(uv, 16);
+    v = _mm_or_si128(v, _mm_slli_epi32(v, 16));
+
+    c = _mm_sub_epi16(y, _mm_set1_epi16(16));
+    d = _mm_sub_epi16(u, _mm_set1_epi16(128));
+    e = _mm_sub_epi16(v, _mm_set1_epi16(128));
+
+    r = Channel(c, d, e, 0, 409);
+    g = Channel(c, d, e, -100, -208);
+    b = Channel(c, d, e, 516, 0);
+    r = _mm_packus_epi16(r, r);
+    g = _mm_packus_epi16(g, g);
+    b = _mm_packus_epi16(b, b);
+
+    rg = _mm_unpacklo_epi8(r, g);
+    ba = _mm_unpacklo_epi8(b, _mm_set1_epi8(-1));
+    lo = _mm_unpacklo_epi16(rg, ba);
+    hi = _mm_unpackhi_epi16(rg, ba);
+    if (BPP == 4) {
+      _mm_storeu_si128((__m128i *) & dst[x * 4], lo);
+      _mm_storeu_si128((__m128i *) & dst[x * 4 + 16], hi);
+    } else {
+      uint8_t rgba[32] __attribute__ ((aligned(16)));
+      uint8_t *out = &dst[x * 3];
+
+      _mm_store_si128((__m128i *) & rgba[0], lo);
+      _mm_store_si128((__m128i *) & rgba[16], hi);
+      for (int i = 0; i < 8; i++) {
+        out[i * 3] = rgba[i * 4];
+        out[i * 3 + 1] = rgba[i * 4 + 1];
+        out[i * 3 + 2] = rgba[i * 4 + 2];
+      }
+    }
+  }
+  ColourYuvToRgbScalar(src, dst, x, width, BPP, UYVY);
+}
+
+static const ColourKernels sse2_kernels = {
+  "sse2",
+  RgbToYuv < 3, true >, RgbToYuv < 4, true >,
+  RgbToYuv < 3, false >, RgbToYuv < 4, false >,
+  YuvToRgb < 3, true >, YuvToRgb < 4, true >,
+  YuvToRgb < 3, false >, YuvToRgb < 4, false >
+};
+
+const ColourKernels *ColourKernelsSse2() {
+  return __builtin_cpu_supports("sse2") ? &sse2_kernels : 0;
+}
+
+#else
+
+const ColourKernels *ColourKernelsSse2() {
+  return 0;
+}
+
+#endif
@@ -0,0 +1,242 @@
+#include <string.h>
+#include "dirty_lines.h"
+
+#define HASH_KEY0             0x9E3779B97F4A7C15ULL
+#define HASH_KEY1             0xC2B2AE3D27D4EB4FULL
+#define HASH_STEP             0x165667B19E3779F9ULL     /* key increment per block */
+
+//
+// Scalar reference. Block n of the line, as two 64 bit lanes v0 and v1, adds
+// lo32 * hi32 of (v ^ key) and the other lane's data to each lane, where key
+// is the lane's base key plus n * HASH_STEP.
+//
+static inline void HashBlock(uint64_t acc[2], const uint8_t * block,
+                             uint64_t n) {
+  uint64_t v[2];
+
+  memcpy(v, block, sizeof(v));
+  for (int j = 0; j < 2; j++) {
+    uint64_t dk = v[j] ^ ((j ? HASH_KEY1 : HASH_KEY0) + n * HASH_STEP);
+
+    acc[j] += (dk & 0xFFFFFFFF) * (dk >> 32);
+    acc[j] += v[j ^ 1];
+  }
+}
+
+//
+// Hash the tail after the first done bytes (zero padded to a block), then
+// fold the lanes and the length together and avalanche (murmur3 finaliser)
+//
+static inline uint64_t HashFinish(uint64_t acc[2], const uint8_t * line,
+                                  size_t length, size_t done) {
+  uint64_t h;
+
+  if (done < length) {
+    uint8_t block[16] = { 0 };
+
+    memcpy(block, &line[done], length - done);
+    HashBlock(acc, block, done / 16);
+  }
+  h = acc[0] + ((acc[1] << 31) | (acc[1] >> 33)) + length * HASH_KEY1;
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static uint64_t HashScalar(const uint8_t * line, size_t length) {
+  uint64_t acc[2] = { 0, 0 };
+  size_t x;
+
+  for (x = 0; x + 16 <= length; x += 16)
+    HashBlock(acc, &line[x], x / 16);
+  return HashFinish(acc, line, length, x);
+}
+
+static const LineHashKernel scalar_kernel = { "scalar", HashScalar };
+
+const LineHashKernel *LineHashScalar() {
+  return &scalar_kernel;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define AVX2 __attribute__ ((target("avx2")))
+
+/* One block, acc and key are the two 64 bit lanes */
+static inline __m128i Sse2Block(__m128i acc, __m128i v, __m128i key) {
+  __m128i dk = _mm_xor_si128(v, key);
+
+  acc = _mm_add_epi64(acc, _mm_mul_epu32(dk, _mm_srli_epi64(dk, 32)));
+  return _mm_add_epi64(acc, _mm_shuffle_epi32(v, 0x4E));
+}
+
+static uint64_t HashSse2(const uint8_t * line, size_t length) {
+  const __m128i step = _mm_set1_epi64x(HASH_STEP);
+  __m128i key = _mm_set_epi64x(HASH_KEY1, HASH_KEY0);
+  __m128i acc = _mm_setzero_si128();
+  uint64_t lanes[2];
+  size_t x;
+
+  for (x = 0; x + 16 <= length; x += 16) {
+    acc = Sse2Block(acc, _mm_loadu_si128((const __m128i *) &line[x]), key);
+    key = _mm_add_epi64(key, step);
+  }
+  _mm_storeu_si128((__m128i *) lanes, acc);
+  return HashFinish(lanes, line, length, x);
+}
+
+/* Two blocks per iteration, the even block in the low 128 bit lane */
+static AVX2 uint64_t HashAvx2(const uint8_t * line, size_t length) {
+  const __m256i step = _mm256_set1_epi64x(HASH_STEP * 2);
+  __m256i key = _mm256_set_epi64x(HASH_KEY1 + HASH_STEP,
+                                  HASH_KEY0 + HASH_STEP, HASH_KEY1, HASH_KEY0);
+  __m256i acc = _mm256_setzero_si256();
+  __m128i sum;
+  uint64_t lanes[2];
+  size_t x;
+
+  for (x = 0; x + 32 <= length; x += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) &line[x]);
+    __m256i dk = _mm256_xor_si256(v, key);
+
+    acc = _mm256_add_epi64(acc, _mm256_mul_epu32(dk,
+                                                 _mm256_srli_epi64(dk, 32)));
+    acc = _mm256_add_epi64(acc, _mm256_shuffle_epi32(v, 0x4E));
+    key = _mm256_add_epi64(key, step);
+  }
+  sum = _mm_add_epi64(_mm256_castsi256_si128(acc),
+                      _mm256_extracti128_si256(acc, 1));
+  if (x + 16 <= length) {
+    sum = Sse2Block(sum, _mm_loadu_si128((const __m128i *) &line[x]),
+                    _mm256_castsi256_si128(key));
+    x += 16;
+  }
+  _mm_storeu_si128((__m128i *) lanes, sum);
+  return HashFinish(lanes, line, length, x);
+}
+
+static const LineHashKernel sse2_kernel = { "sse2", HashSse2 };
+static const LineHashKernel avx2_kernel = { "avx2", HashAvx2 };
+
+const LineHashKernel *LineHashSse2() {
+  return __builtin_cpu_supports("sse2") ? &sse2_kernel : 0;
+}
+
+const LineHashKernel *LineHashAvx2() {
+  return __builtin_cpu_supports("avx2") ? &avx2_kernel : 0;
+}
+
+#else
+
+const LineHashKernel *LineHashSse2() {
+  return 0;
+}
+
+const LineHashKernel *LineHashAvx2() {
+  return 0;
+}
+
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+
+static uint64_t HashNeon(const uint8_t * line, size_t length) {
+  const uint64x2_t step = vdupq_n_u64(HASH_STEP);
+  const uint64_t base[2] = { HASH_KEY0, HASH_KEY1 };
+  uint64x2_t key = vld1q_u64(base);
+  uint64x2_t acc = vdupq_n_u64(0);
+  uint64_t lanes[2];
+  size_t x;
+
+  for (x = 0; x + 16 <= length; x += 16) {
+    uint64x2_t v = vreinterpretq_u64_u8(vld1q_u8(&line[x]));
+    uint64x2_t dk = veorq_u64(v, key);
+
+    acc = vaddq_u64(acc, vmull_u32(vmovn_u64(dk), vshrn_n_u64(dk, 32)));
+    acc = vaddq_u64(acc, vextq_u64(v, v, 1));
+    key = vaddq_u64(key, step);
+  }
+  vst1q_u64(lanes, acc);
+  return HashFinish(lanes, line, length, x);
+}
+
+static const LineHashKernel neon_kernel = { "neon", HashNeon };
+
+const LineHashKernel *LineHashNeon() {
+  return &neon_kernel;
+}
+
+#else
+
+const LineHashKernel *LineHashNeon() {
+  return 0;
+}
+
+#endif
+
+/* Widest kernel the CPU supports, decided once */
+const LineHashKernel *LineHashBest() {
+  static const LineHashKernel *best = 0;
+
+  if (!best) {
+    const LineHashKernel *kernel;
+
+    if ((kernel = LineHashAvx2()) || (kernel = LineHashSse2()) ||
+        (kernel = LineHashNeon()))
+      best = kernel;
+    else
+      best = LineHashScalar();
+  }
+  return best;
+}
+
+DirtyLines::DirtyLines() {
+  hash_ = LineHashBest()->hash;
+  refresh_ = 0;
+  countdown_ = 0;
+  refresh_now_ = false;
+  changed_ = 0;
+}
+
+/* Full frame every refresh frames, 0 sends every line of every frame */
+void DirtyLines::Configure(int refresh) {
+  refresh_ = refresh < 0 ? 0 : refresh;
+}
+
+/* Forget the previous frame, the next one is sent in full */
+void DirtyLines::Reset(int lines) {
+  hashes_.assign(lines, 0);
+  lines_.assign(lines, 1);
+  countdown_ = 0;
+  changed_ = lines;
+}
+
+//
+// Hash every line of a frame of stride byte lines against the previous one.
+// Returns one byte per line, 1 if the line has to be sent.
+//
+const uint8_t *DirtyLines::Update(const uint8_t * frame, int stride) {
+  int lines = hashes_.size();
+  bool full = false;
+
+  if ((countdown_ <= 0) || refresh_now_.exchange(false)) {
+    full = true;
+    countdown_ = refresh_;
+  }
+  countdown_--;
+
+  changed_ = 0;
+  for (int c = 0; c < lines; c++) {
+    uint64_t hash = hash_(&frame[(size_t) c * stride], stride);
+
+    lines_[c] = full || (hash != hashes_[c]);
+    hashes_[c] = hash;
+    changed_ += lines_[c];
+  }
+  return &lines_[0];
+}
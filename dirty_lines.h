@@ -0,0 +1,59 @@
+/*
+ * Changed line detection for mostly static video. Every scanline of a frame
+ * is hashed and compared with the hash of the same line in the previous
+ * frame, only lines that differ need to be sent. A full frame is still sent
+ * every so often (and on request) so a receiver that joins late, or lost a
+ * packet, catches up.
+ *
+ * The hash is a 64 bit multiply/accumulate over 16 byte blocks, each block
+ * keyed by its position in the line so moving content changes the hash. The
+ * lanes only ever add, so the SSE2, AVX2 and NEON kernels give exactly the
+ * scalar result and the fastest one is picked at run time.
+ */
+
+#ifndef __DIRTY_LINES_H__
+#define __DIRTY_LINES_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#define RTP_DIRTY_REFRESH     25        /* frames between full refreshes */
+
+/* Hash one line of length bytes */
+typedef uint64_t (*LineHash) (const uint8_t * line, size_t length);
+
+typedef struct {
+  const char *name;
+  LineHash hash;
+} LineHashKernel;
+
+/* Kernels, the SIMD ones return 0 if not built for or supported by this CPU */
+const LineHashKernel *LineHashScalar();
+const LineHashKernel *LineHashSse2();
+const LineHashKernel *LineHashAvx2();
+const LineHashKernel *LineHashNeon();
+const LineHashKernel *LineHashBest();
+
+class DirtyLines {
+public:
+  DirtyLines();
+  void Configure(int refresh);
+  bool Enabled() { return refresh_ > 0; }
+  void Reset(int lines);
+  void Refresh() { refresh_now_ = true; }
+  const uint8_t *Update(const uint8_t * frame, int stride);
+  int Changed() { return changed_; }
+  bool Full() { return changed_ == (int) hashes_.size(); }
+private:
+  LineHash hash_;
+  int refresh_;                 /* full frame every refresh_ frames, 0 is off */
+  int countdown_;               /* frames until the next full frame */
+  std::atomic < bool > refresh_now_;
+  std::vector < uint64_t > hashes_;     /* of the last frame sent */
+  std::vector < uint8_t > lines_;       /* 1 for lines to send */
+  int changed_;
+};
+
+#endif
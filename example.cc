@@ -30,77 +30,53 @@ Use his program to stream data to the udpsc example above on the tegra X1
 #define RTP_OUTPUT_PORT       5004
 #define STREAM_HEIGHT         480
 #define STREAM_WIDTH          480
-#define BUFSIZE               (STREAM_WIDTH * STREAM_HEIGHT) * 3
+#define STREAM_SOURCE         "lenna-lg.png"    /* or a directory of frames, or a raw UYVY file */
 
-#include <byteswap.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <netdb.h>
-#include "pngget.h"
+#include "frame_source.h"
 #include "rtp_stream.h"
 
 int main(int argc, char **argv) {
-  int sockfd, portno, n, c, frame = 0;
-  int move = 0;
-  char *yuv;
-  png_byte *row;
-  char packet[BUFSIZE];
+  const char *path = argc > 1 ? argv[1] : STREAM_SOURCE;
+  FrameSource source;
   RtpStream *rtp;
-  png_bytep *row_pointers;
-
-  yuv = (char *) malloc((STREAM_WIDTH * STREAM_HEIGHT) * 2);
+  char *yuv;
+  int frame = 0;
 
   printf("Example RTP streaming\n");
 
-  read_png_file((char *) "lenna-lg.png");
-  row_pointers = get_row_pointwes();
+  /* Converted to UYVY ahead of the sender into hugepages where there are any */
+  if (!source.Open(path, STREAM_WIDTH, STREAM_HEIGHT, true)) {
+    printf("Could not open %s\n", path);
+    return 1;
+  }
 
   /* setup RTP streaming class */
-  rtp = new RtpStream(STREAM_WIDTH, STREAM_WIDTH);
+  rtp = new RtpStream(STREAM_HEIGHT, STREAM_WIDTH);
   rtp->RtpStreamOut((char *) RTP_OUTPUT_IP, RTP_OUTPUT_PORT);
+  rtp->SetPacing(RTP_FRAMERATE);
   rtp->Open();
 
-  /* get a message from the user */
-  bzero(packet, BUFSIZE);
-
-  /* Loop frames forever */
-  while (1) {
-    struct timeval NTP_value;
-    int32_t time = 10000;
-
-
-    /* Convert all the scan lines */
-    for (c = 0; c < (STREAM_HEIGHT); c++) {
-      int x, last = 0;
-
-      png_byte *row = row_pointers[c];
-
-//        rgbtoyuv(STREAM_HEIGHT, STREAM_WIDTH, &packet[c], (char*)&row[move]);
-
-    }
-
-    if (rtp->Transmit(packet) < 0)
+  /* Loop frames forever, the source loops its content */
+  while ((yuv = source.Next()) != 0) {
+    //
+    // Sent straight from the source's buffer, which is only reused once done
+    // hands it back. A frame that could not be queued goes back here.
+    //
+    if (rtp->TransmitZeroCopy(yuv, FrameSource::Done, &source) < 0) {
+      FrameSource::Done(yuv, &source);
       break;
+    }
 
-#if 0
-    /* move the image (png must have extra byte as the second image is green)  */
-    move += 3;
-    if (move == STREAM_WIDTH * 3)
-      move = 0;
-#endif
-    /* approximatly 24 frames a second */
-    usleep(1000000 / RTP_FRAMERATE);
-    time += (Hz90 / RTP_FRAMERATE);
+    /* Pacing holds the sender to RTP_FRAMERATE, Transmit blocks when the queue is full */
     printf("Sent frame %d\n", frame++);
   }
 
-  free(yuv);
-  free(rtp);
+  /* Frames may still be in flight until the stream is closed */
+  rtp->Close();
+  delete rtp;
+  source.Close();
   printf("Example terminated...\n");
 
   return 0;
@@ -0,0 +1,144 @@
+/*
+ * RFC 4175 pack/unpack kernel check and benchmark.
+ *
+ * For every sampling and depth the pgroup is printed, the kernels in use are
+ * compared with the scalar ones on random runs of several lengths (SIMD body
+ * and tail) and a pack then unpack must give back the samples. Then each
+ * depth is timed packing and unpacking a 1080p YCbCr-4:2:2 frame.
+ *
+ *   ./format-bench [width height seconds]
+ *
+ * Exits non zero if any kernel disagrees with the reference.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "video_format.h"
+
+#define BENCH_WIDTH           1920
+#define BENCH_HEIGHT          1080
+#define BENCH_SECONDS         1.0
+
+static const Sampling samplings[] = {
+  SAMPLING_YCBCR_422, SAMPLING_YCBCR_444, SAMPLING_YCBCR_420,
+  SAMPLING_RGB, SAMPLING_RGBA, SAMPLING_BGR, SAMPLING_BGRA
+};
+
+static const int depths[] = { 8, 10, 12, 16 };
+
+static double Now() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Random samples of depth bits in memory layout */
+static void Random(std::vector < uint8_t > &host, int depth) {
+  if (depth == 8) {
+    for (size_t c = 0; c < host.size(); c++)
+      host[c] = rand() & 0xFF;
+    return;
+  }
+  for (size_t c = 0; c < host.size() / 2; c++) {
+    uint16_t s = rand() & ((1 << depth) - 1);
+
+    memcpy(&host[c * 2], &s, sizeof(s));
+  }
+}
+
+/* Compare format's kernels with the scalar ones, returns the mismatches */
+static int Check(const VideoFormat * format) {
+  static const int groups[] = { 1, 2, 3, 5, 8, 13, 64, 97, 480 };
+  VideoFormat reference;
+  int failed = 0;
+
+  VideoFormatInit(&reference, format->sampling, format->depth, false);
+  for (size_t g = 0; g < sizeof(groups) / sizeof(groups[0]); g++) {
+    int samples = groups[g] * format->samples;
+    std::vector < uint8_t > host(groups[g] * format->host);
+    std::vector < uint8_t > wire(groups[g] * format->pgroup);
+    std::vector < uint8_t > expect(wire.size());
+    std::vector < uint8_t > back(host.size());
+
+    Random(host, format->depth);
+    reference.pack(&host[0], &expect[0], samples);
+    format->pack(&host[0], &wire[0], samples);
+    format->unpack(&wire[0], &back[0], samples);
+    if ((wire != expect) || (back != host)) {
+      printf("FAIL %s %d bit %s, %d pgroups\n", format->name, format->depth,
+             format->kernel, groups[g]);
+      failed++;
+    }
+  }
+  return failed;
+}
+
+static void Time(const VideoFormat * format, int width, int height) {
+  int rows = VideoRows(format, height);
+  int samples = width / format->xinc * format->samples;
+  std::vector < uint8_t > host(VideoFrameBytes(format, height, width));
+  std::vector < uint8_t > wire(rows * VideoRowBytes(format, width));
+  double pack, unpack;
+  double start;
+  int frames = 0;
+
+  Random(host, format->depth);
+  start = Now();
+  do {
+    for (int y = 0; y < rows; y++)
+      format->pack(&host[(size_t) y * VideoHostRowBytes(format, width)],
+                   &wire[(size_t) y * VideoRowBytes(format, width)], samples);
+    frames++;
+  } while ((pack = Now() - start) < BENCH_SECONDS);
+  pack = pack * 1e3 / frames;
+
+  frames = 0;
+  start = Now();
+  do {
+    for (int y = 0; y < rows; y++)
+      format->unpack(&wire[(size_t) y * VideoRowBytes(format, width)],
+                     &host[(size_t) y * VideoHostRowBytes(format, width)],
+                     samples);
+    frames++;
+  } while ((unpack = Now() - start) < BENCH_SECONDS);
+  unpack = unpack * 1e3 / frames;
+
+  printf("  %2d bit %-7s pack %7.3f ms  unpack %7.3f ms per frame\n",
+         format->depth, format->kernel, pack, unpack);
+}
+
+int main(int argc, char **argv) {
+  int width = argc > 3 ? atoi(argv[1]) : BENCH_WIDTH;
+  int height = argc > 3 ? atoi(argv[2]) : BENCH_HEIGHT;
+  int failed = 0;
+
+  printf("%-12s depth pgroup pixels lines kernel\n", "sampling");
+  for (size_t s = 0; s < sizeof(samplings) / sizeof(samplings[0]); s++) {
+    for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+      VideoFormat format;
+
+      VideoFormatInit(&format, samplings[s], depths[d]);
+      printf("%-12s %5d %6d %6d %5d %s\n", format.name, format.depth,
+             format.pgroup, format.xinc, format.yinc, format.kernel);
+      failed += Check(&format);
+    }
+  }
+  printf("%s\n", failed ? "FAILED" : "All kernels match the reference");
+
+  printf("%dx%d YCbCr-4:2:2\n", width, height);
+  for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+    VideoFormat format;
+
+    VideoFormatInit(&format, SAMPLING_YCBCR_422, depths[d]);
+    Time(&format, width, height);
+    if (depths[d] == 10) {
+      VideoFormatInit(&format, SAMPLING_YCBCR_422, depths[d], false);
+      Time(&format, width, height);
+    }
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,260 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <map>
+#ifdef __linux__
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#include "frame_memory.h"
+#include "frame_pool.h"
+
+#define MEMORY_MPOL_PREFERRED 1         /* <numaif.h> without needing libnuma */
+#define MEMORY_MAX_NODES      64
+
+typedef struct {
+  char *base;                   /* mapping, data rounded down to it */
+  size_t length;
+  MemoryKind kind;
+} MemoryBlock;
+
+//
+// Every live buffer, so Free() knows how it was allocated. Touched only at
+// Allocate() and Free(), never per frame.
+//
+static pthread_mutex_t blocks_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::map < char *, MemoryBlock > *blocks;
+
+static void Remember(char *data, const MemoryBlock & block) {
+  pthread_mutex_lock(&blocks_mutex);
+  /* Never freed, buffers may be released from static destructors */
+  if (!blocks)
+    blocks = new std::map < char *, MemoryBlock >;
+  (*blocks)[data] = block;
+  pthread_mutex_unlock(&blocks_mutex);
+}
+
+static bool Forget(char *data, MemoryBlock * block) {
+  std::map < char *, MemoryBlock >::iterator found;
+  bool known = false;
+
+  pthread_mutex_lock(&blocks_mutex);
+  if (blocks && ((found = blocks->find(data)) != blocks->end())) {
+    *block = found->second;
+    blocks->erase(found);
+    known = true;
+  }
+  pthread_mutex_unlock(&blocks_mutex);
+  return known;
+}
+
+#ifdef __linux__
+/* First integer in a sysfs file, or fallback */
+static int ReadNumber(const char *path, int fallback) {
+  FILE *file = fopen(path, "r");
+  int value;
+
+  if (!file)
+    return fallback;
+  if (fscanf(file, "%d", &value) != 1)
+    value = fallback;
+  fclose(file);
+  return value;
+}
+
+//
+// Map length bytes of huge pages, from the reserved pool if there are any
+// free, otherwise normal pages aligned for the kernel to back with
+// transparent huge pages.
+//
+static char *MapHuge(size_t length, MemoryBlock * block) {
+  char *base;
+  uintptr_t aligned;
+
+  base = (char *) mmap(0, length, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (base != MAP_FAILED) {
+    block->base = base;
+    block->length = length;
+    block->kind = MEMORY_HUGETLB;
+    return base;
+  }
+
+  /* A huge page of slack to align to, trimmed off both ends */
+  base = (char *) mmap(0, length + RTP_HUGE_PAGE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED)
+    return 0;
+  aligned = ((uintptr_t) base + RTP_HUGE_PAGE - 1) &
+    ~(uintptr_t) (RTP_HUGE_PAGE - 1);
+  if (aligned > (uintptr_t) base)
+    munmap(base, aligned - (uintptr_t) base);
+  munmap((char *) aligned + length,
+         (uintptr_t) base + RTP_HUGE_PAGE - aligned);
+#ifdef MADV_HUGEPAGE
+  madvise((char *) aligned, length, MADV_HUGEPAGE);
+#endif
+  block->base = (char *) aligned;
+  block->length = length;
+  block->kind = MEMORY_THP;
+  return block->base;
+}
+#endif
+
+//
+// A zeroed, pre-faulted buffer of size bytes aligned to RTP_CACHE_LINE, on
+// huge pages if asked for and size is at least one, on node if it is not
+// RTP_NODE_ANY and the machine has more than one. Returns 0 if out of memory.
+//
+char *FrameMemory::Allocate(size_t size, bool hugepages, int node) {
+  MemoryBlock block;
+  char *data;
+
+  if (size == 0)
+    size = 1;
+  if (size < RTP_HUGE_PAGE)
+    hugepages = false;
+  if ((Nodes() < 2) || (node >= MEMORY_MAX_NODES))
+    node = RTP_NODE_ANY;
+
+#ifdef __linux__
+  if (hugepages || (node >= 0)) {
+    size_t small = sysconf(_SC_PAGESIZE);
+    size_t page = hugepages ? RTP_HUGE_PAGE : small;
+    size_t length = (size + page - 1) / page * page;
+
+    if (hugepages)
+      data = MapHuge(length, &block);
+    else {
+      data = (char *) mmap(0, length, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (data == MAP_FAILED)
+        data = 0;
+      block.base = data;
+      block.length = length;
+      block.kind = MEMORY_PAGES;
+    }
+    if (!data)
+      return 0;
+
+    /* Preferred rather than bound, a full node spills over instead of failing */
+    if (node >= 0) {
+      unsigned long mask = 1UL << node;
+
+      syscall(SYS_mbind, data, length, MEMORY_MPOL_PREFERRED, &mask,
+              MEMORY_MAX_NODES, 0);
+    }
+
+    /* Fault every page in now, on the node chosen, rather than on first use */
+    for (size_t offset = 0; offset < length; offset += small)
+      ((volatile char *) data)[offset] = 0;
+    Remember(data, block);
+    return data;
+  }
+#endif
+
+  if (posix_memalign((void **) &data, RTP_CACHE_LINE, size) != 0)
+    return 0;
+  memset(data, 0, size);
+  block.base = data;
+  block.length = size;
+  block.kind = MEMORY_HEAP;
+  Remember(data, block);
+  return data;
+}
+
+void FrameMemory::Free(char *data) {
+  MemoryBlock block;
+
+  if (!data)
+    return;
+  if (!Forget(data, &block)) {
+    free(data);
+    return;
+  }
+#ifdef __linux__
+  if (block.kind != MEMORY_HEAP) {
+    munmap(block.base, block.length);
+    return;
+  }
+#endif
+  free(block.base);
+}
+
+/* How a buffer from Allocate() is backed */
+MemoryKind FrameMemory::Kind(char *data) {
+  MemoryKind kind = MEMORY_HEAP;
+
+  pthread_mutex_lock(&blocks_mutex);
+  if (blocks && (blocks->find(data) != blocks->end()))
+    kind = (*blocks)[data].kind;
+  pthread_mutex_unlock(&blocks_mutex);
+  return kind;
+}
+
+/* NUMA nodes online, 1 if the machine does not say */
+int FrameMemory::Nodes() {
+#ifdef __linux__
+  static int nodes = 0;
+
+  if (!nodes) {
+    char path[64];
+    int count = 0;
+
+    for (int c = 0; c < MEMORY_MAX_NODES; c++) {
+      snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", c);
+      if (access(path, F_OK) == 0)
+        count = c + 1;
+    }
+    nodes = count ? count : 1;
+  }
+  return nodes;
+#else
+  return 1;
+#endif
+}
+
+/* Node the network interface is attached to, RTP_NODE_ANY if unknown */
+int FrameMemory::InterfaceNode(const char *interface) {
+#ifdef __linux__
+  char path[128];
+  int node;
+
+  if (!interface || !interface[0] || strchr(interface, '/'))
+    return RTP_NODE_ANY;
+  snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", interface);
+  node = ReadNumber(path, RTP_NODE_ANY);
+  return node < 0 ? RTP_NODE_ANY : node;
+#else
+  return RTP_NODE_ANY;
+#endif
+}
+
+/* Node of a CPU, RTP_NODE_ANY if unknown */
+int FrameMemory::CpuNode(int cpu) {
+#ifdef __linux__
+  char path[64];
+  struct dirent *entry;
+  DIR *dir;
+  int node = RTP_NODE_ANY;
+
+  if (cpu < 0)
+    return RTP_NODE_ANY;
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+  if (!(dir = opendir(path)))
+    return RTP_NODE_ANY;
+  while ((entry = readdir(dir)) != NULL) {
+    if (sscanf(entry->d_name, "node%d", &node) == 1)
+      break;
+    node = RTP_NODE_ANY;
+  }
+  closedir(dir);
+  return node;
+#else
+  return RTP_NODE_ANY;
+#endif
+}
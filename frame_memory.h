@@ -0,0 +1,38 @@
+/*
+ * Memory for frame and packet buffers. Every buffer is cache line aligned
+ * for SIMD loads and stores, zeroed and pre-faulted so the first frames
+ * never stall on page faults. Buffers of a huge page or more can be backed
+ * by 2MB pages to cut TLB misses on 4K frames: MAP_HUGETLB from the reserved
+ * pool, else transparent huge pages. On machines with more than one NUMA
+ * node a buffer can be placed on the node of the NIC or of the thread that
+ * fills it. Allocate at Open(), never per frame.
+ */
+
+#ifndef __FRAME_MEMORY_H__
+#define __FRAME_MEMORY_H__
+
+#include <stddef.h>
+
+#define RTP_HUGE_PAGE         (2 * 1024 * 1024)
+#define RTP_NODE_ANY          -1        /* first touch, the node of the allocating thread */
+#define RTP_NODE_AUTO         -2        /* the NIC's node, else the pinned thread's, see RtpStream::SetMemory() */
+
+typedef enum {
+  MEMORY_HEAP,                  /* posix_memalign() */
+  MEMORY_PAGES,                 /* mmap() of normal pages */
+  MEMORY_HUGETLB,               /* reserved 2MB pages */
+  MEMORY_THP                    /* transparent huge pages, if the kernel finds them */
+} MemoryKind;
+
+class FrameMemory {
+public:
+  static char *Allocate(size_t size, bool hugepages = false,
+                        int node = RTP_NODE_ANY);
+  static void Free(char *data);
+  static MemoryKind Kind(char *data);
+  static int Nodes();
+  static int InterfaceNode(const char *interface);
+  static int CpuNode(int cpu);
+};
+
+#endif
@@ -0,0 +1,253 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include "frame_pool.h"
+
+FrameLease::FrameLease() {
+  pool_ = 0;
+  held_ = 0;
+  data_ = 0;
+  frame_ = 0;
+  coverage_ = 0;
+}
+
+FrameLease::~FrameLease() {
+  Release();
+}
+
+FrameLease::FrameLease(FrameLease && other) {
+  pool_ = other.pool_;
+  held_ = other.held_;
+  data_ = other.data_;
+  frame_ = other.frame_;
+  coverage_ = other.coverage_;
+  other.pool_ = 0;
+  other.held_ = 0;
+  other.data_ = 0;
+}
+
+FrameLease & FrameLease::operator=(FrameLease && other) {
+  if (this != &other) {
+    Release();
+    pool_ = other.pool_;
+    held_ = other.held_;
+    data_ = other.data_;
+    frame_ = other.frame_;
+    coverage_ = other.coverage_;
+    other.pool_ = 0;
+    other.held_ = 0;
+    other.data_ = 0;
+  }
+  return *this;
+}
+
+/* Hand the buffer back to the pool, the lease is empty afterwards */
+void FrameLease::Release() {
+  if (pool_)
+    pool_->Release(held_);
+  pool_ = 0;
+  held_ = 0;
+  data_ = 0;
+}
+
+FramePool::FramePool() {
+  pthread_condattr_t attr;
+
+  ready_ = -1;
+  published_ = 0;
+  acquired_ = 0;
+  overruns_ = 0;
+  shutdown_ = false;
+  pthread_mutex_init(&mutex_, NULL);
+
+  /* Acquire() timeouts are measured on the monotonic clock */
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&cond_, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+FramePool::~FramePool() {
+  Free();
+  for (size_t c = 0; c < retired_.size(); c++)
+    Destroy(retired_[c]);
+  pthread_cond_destroy(&cond_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+//
+// Allocate count cache line aligned buffers of size bytes holding frames of
+// lines scanlines, pre-faulted and on huge pages and NUMA node if asked, see
+// FrameMemory. Needs one buffer per frame in flight plus the ready frame
+// plus one per lease the consumer holds for the network never to wait.
+//
+bool FramePool::Allocate(int count, size_t size, int lines, bool hugepages,
+                         int node) {
+  Free();
+  if (count < 2)
+    count = 2;
+  for (int c = 0; c < count; c++) {
+    char *data = FrameMemory::Allocate(size, hugepages, node);
+    PoolFrame *frame;
+
+    if (!data) {
+      Free();
+      return false;
+    }
+    frame = new PoolFrame;
+    frame->data = data;
+    frame->state = FRAME_FREE;
+    frame->holds = 0;
+    frame->frame = 0;
+    frame->line_map.assign(lines, 0);
+    frame->retired = false;
+    memset(&frame->coverage, 0, sizeof(FrameCoverage));
+    frames_.push_back(frame);
+  }
+  pthread_mutex_lock(&mutex_);
+  shutdown_ = false;
+  pthread_mutex_unlock(&mutex_);
+  return true;
+}
+
+void FramePool::Destroy(PoolFrame *frame) {
+  FrameMemory::Free(frame->data);
+  delete frame;
+}
+
+//
+// Free the buffers and wake anyone waiting in Acquire(). A buffer that is
+// still leased is retired instead, the last Release() frees it.
+//
+void FramePool::Free() {
+  pthread_mutex_lock(&mutex_);
+  for (size_t c = 0; c < frames_.size(); c++) {
+    if (frames_[c]->holds > 0) {
+      frames_[c]->retired = true;
+      retired_.push_back(frames_[c]);
+    } else
+      Destroy(frames_[c]);
+  }
+  frames_.clear();
+  ready_ = -1;
+  shutdown_ = true;
+  pthread_cond_broadcast(&cond_);
+  pthread_mutex_unlock(&mutex_);
+}
+
+//
+// Take a buffer to fill. Returns -1 if the consumer is holding every buffer
+// that is not already being filled.
+//
+int FramePool::Take() {
+  int index = -1;
+
+  pthread_mutex_lock(&mutex_);
+  for (size_t c = 0; c < frames_.size(); c++) {
+    if ((frames_[c]->state == FRAME_FREE) && (frames_[c]->holds == 0)) {
+      index = c;
+      frames_[c]->state = FRAME_FILLING;
+      break;
+    }
+  }
+  if (index < 0)
+    overruns_++;
+  pthread_mutex_unlock(&mutex_);
+
+  return index;
+}
+
+/* Keep a published frame from being refilled until Release(), like a lease */
+PoolFrame *FramePool::Hold(int index) {
+  PoolFrame *frame;
+
+  pthread_mutex_lock(&mutex_);
+  frame = frames_[index];
+  frame->holds++;
+  pthread_mutex_unlock(&mutex_);
+  return frame;
+}
+
+//
+// A filled buffer holds a finished frame. Make it the ready frame and retire
+// the previous one. Returns the coverage as stored with the frame.
+//
+const FrameCoverage *FramePool::Publish(int index, const FrameCoverage * coverage) {
+  PoolFrame *frame = frames_[index];
+
+  pthread_mutex_lock(&mutex_);
+  if (ready_ >= 0)
+    frames_[ready_]->state = FRAME_FREE;
+  frame->state = FRAME_READY;
+  frame->frame = ++published_;
+  frame->coverage = *coverage;
+  frame->coverage.line_map = &frame->line_map[0];
+  ready_ = index;
+  pthread_cond_broadcast(&cond_);
+  pthread_mutex_unlock(&mutex_);
+
+  return &frame->coverage;
+}
+
+/* Give back a buffer that is not going to be published */
+void FramePool::Discard(int index) {
+  pthread_mutex_lock(&mutex_);
+  frames_[index]->state = FRAME_FREE;
+  pthread_mutex_unlock(&mutex_);
+}
+
+//
+// Lease the newest frame not yet acquired. timeout is in milliseconds,
+// ULONG_MAX waits forever. Returns false if no frame arrived in time or the
+// pool was freed while waiting.
+//
+bool FramePool::Acquire(FrameLease * lease, unsigned long timeout) {
+  struct timespec deadline;
+  bool ready = true;
+
+  if (timeout != ULONG_MAX) {
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (timeout % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+  }
+
+  lease->Release();
+  pthread_mutex_lock(&mutex_);
+  while (ready && ((ready_ < 0) || (frames_[ready_]->frame == acquired_))) {
+    if (shutdown_)
+      ready = false;
+    else if (timeout == ULONG_MAX)
+      pthread_cond_wait(&cond_, &mutex_);
+    else if (pthread_cond_timedwait(&cond_, &mutex_, &deadline) == ETIMEDOUT)
+      ready = false;
+  }
+  if (ready) {
+    PoolFrame *frame = frames_[ready_];
+
+    frame->holds++;
+    acquired_ = frame->frame;
+    lease->pool_ = this;
+    lease->held_ = frame;
+    lease->data_ = frame->data;
+    lease->frame_ = acquired_;
+    lease->coverage_ = &frame->coverage;
+  }
+  pthread_mutex_unlock(&mutex_);
+
+  return ready;
+}
+
+void FramePool::Release(PoolFrame *frame) {
+  pthread_mutex_lock(&mutex_);
+  if ((--frame->holds == 0) && frame->retired) {
+    retired_.erase(std::find(retired_.begin(), retired_.end(), frame));
+    Destroy(frame);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
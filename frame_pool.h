@@ -0,0 +1,116 @@
+/*
+ * Pool of preallocated receive frame buffers. The network takes buffers to
+ * fill (one per frame in flight), a completed frame becomes "ready" and the
+ * consumer takes a FrameLease on it. A leased buffer is never written until
+ * the lease is released, so the consumer never sees a half written frame and
+ * the network never waits for the consumer. Free() keeps any buffer still
+ * leased until its last lease is released, but no lease may outlive the pool.
+ */
+
+#ifndef __FRAME_POOL_H__
+#define __FRAME_POOL_H__
+
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "frame_memory.h"
+
+#define RTP_FRAME_POOL        4         /* in flight, ready and held by the consumer */
+#define RTP_CACHE_LINE        64
+
+typedef enum {
+  FRAME_FREE,
+  FRAME_FILLING,
+  FRAME_READY
+} FrameState;
+
+//
+// How much of a published frame actually arrived, so the application can
+// display, conceal or drop a partial frame.
+//
+typedef struct {
+  uint32_t timestamp;           /* RTP timestamp of the frame */
+  int lines;                    /* lines in the frame */
+  int complete;                 /* lines received in full */
+  bool marker;                  /* marker packet was received */
+  const uint8_t *line_map;      /* one byte per line, 1 if complete */
+} FrameCoverage;
+
+//
+// Called on a receive thread when a frame is published, in order and without
+// the jitter buffer's lock held. The frame is not refilled until it returns.
+//
+typedef void (*FrameReadyCallback) (char *frame,
+                                    const FrameCoverage * coverage,
+                                    void *user);
+
+typedef struct {
+  char *data;
+  FrameState state;
+  int holds;                    /* outstanding leases */
+  unsigned int frame;           /* frame count when published */
+  FrameCoverage coverage;
+  std::vector < uint8_t > line_map;
+  bool retired;                 /* freed by the pool, kept until the last lease goes */
+} PoolFrame;
+
+class FramePool;
+
+//
+// Consumer's hold on a completed frame, released on destruction or Release()
+//
+class FrameLease {
+public:
+  FrameLease();
+  ~FrameLease();
+  FrameLease(FrameLease && other);
+  FrameLease & operator=(FrameLease && other);
+  char *Data() { return data_; }
+  unsigned int Frame() { return frame_; }
+  const FrameCoverage *Coverage() { return coverage_; }
+  bool Valid() { return pool_ != 0; }
+  void Release();
+private:
+  friend class FramePool;
+  FrameLease(const FrameLease &);
+  FrameLease & operator=(const FrameLease &);
+  FramePool *pool_;
+  PoolFrame *held_;
+  char *data_;
+  unsigned int frame_;
+  const FrameCoverage *coverage_;
+};
+
+class FramePool {
+public:
+  FramePool();
+  ~FramePool();
+  bool Allocate(int count, size_t size, int lines, bool hugepages = false,
+                int node = RTP_NODE_ANY);
+  void Free();
+  int Take();
+  char *Data(int index) { return frames_[index]->data; }
+  uint8_t *LineMap(int index) { return &frames_[index]->line_map[0]; }
+  int Ready() { return ready_; }  /* newest published buffer, -1 if none */
+  const FrameCoverage *Publish(int index, const FrameCoverage * coverage);
+  void Discard(int index);
+  bool Acquire(FrameLease * lease, unsigned long timeout = ULONG_MAX);
+  PoolFrame *Hold(int index);
+  void Release(PoolFrame * frame);
+  uint64_t Overruns() { return overruns_; }
+private:
+  static void Destroy(PoolFrame * frame);
+  std::vector < PoolFrame * >frames_;
+  std::vector < PoolFrame * >retired_;  /* freed while leased */
+  pthread_mutex_t mutex_;
+  pthread_cond_t cond_;
+  bool shutdown_;               /* Free() called, Acquire() gives up */
+  int ready_;
+  unsigned int published_;
+  unsigned int acquired_;
+  uint64_t overruns_;           /* frames with no buffer free to fill */
+};
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * Bounded single producer / single consumer ring of frame descriptors feeding
+ * the transmit thread. Push and Pop never take a lock, semaphores are only
+ * used to sleep when the ring is empty (consumer) or full (producer in
+ * QUEUE_BLOCK mode).
+ */
+
+#ifndef __FRAME_QUEUE_H__
+#define __FRAME_QUEUE_H__
+
+#include <errno.h>
+#include <stdint.h>
+#include <semaphore.h>
+#include <atomic>
+#include <vector>
+
+#define RTP_QUEUE_DEPTH       4         /* frames queued for transmit */
+
+typedef enum {
+  QUEUE_BLOCK,                  /* producer waits for space */
+  QUEUE_DROP_OLDEST,            /* oldest queued frame is discarded */
+  QUEUE_DROP_NEWEST             /* frame being queued is discarded */
+} QueuePolicy;
+
+/* What Push() did with a frame */
+typedef enum {
+  QUEUE_PUSHED,                 /* queued, nothing discarded */
+  QUEUE_DROPPED,                /* a frame was discarded to honour the policy */
+  QUEUE_CLOSED                  /* shut down, the frame was not queued */
+} QueueResult;
+
+template < typename T > class FrameQueue {
+public:
+  FrameQueue(int size = RTP_QUEUE_DEPTH, QueuePolicy policy = QUEUE_BLOCK) {
+    head_ = 0;
+    tail_ = 0;
+    dropped_ = 0;
+    shutdown_ = false;
+    sem_init(&items_, 0, 0);
+    sem_init(&space_, 0, 0);
+    Configure(size, policy);
+  }
+  ~FrameQueue() {
+    sem_destroy(&items_);
+    sem_destroy(&space_);
+  }
+
+  /* Resize the ring, only valid while the queue is empty and idle */
+  void Configure(int size, QueuePolicy policy) {
+    if (size < 1)
+      size = 1;
+    ring_.resize(size);
+    size_ = size;
+    policy_ = policy;
+    Reset();
+  }
+
+  /* Empty the ring and undo Shutdown(), only valid while nobody uses it */
+  void Reset() {
+    head_ = 0;
+    tail_ = 0;
+    shutdown_ = false;
+    while (sem_trywait(&items_) == 0);
+    while (sem_trywait(&space_) == 0);
+  }
+
+  //
+  // Producer side. Returns QUEUE_DROPPED if a frame had to be discarded to
+  // honour the policy, the discarded descriptor is copied to dropped so the
+  // caller can release its buffer. Once shut down nothing is queued and the
+  // caller keeps the frame.
+  //
+  QueueResult Push(const T & item, T * dropped) {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    QueueResult result = QUEUE_PUSHED;
+
+    for (;;) {
+      if (shutdown_)
+        return QUEUE_CLOSED;
+      uint32_t head = head_.load(std::memory_order_acquire);
+
+      if (tail - head < size_)
+        break;
+      if (policy_ == QUEUE_DROP_NEWEST) {
+        *dropped = item;
+        dropped_++;
+        return QUEUE_DROPPED;
+      } else if (policy_ == QUEUE_DROP_OLDEST) {
+        T oldest = ring_[head % size_];
+
+        /* Consumer may have taken it first, then there is room anyway */
+        if (head_.compare_exchange_strong(head, head + 1,
+                                          std::memory_order_acq_rel)) {
+          *dropped = oldest;
+          dropped_++;
+          result = QUEUE_DROPPED;
+        }
+      } else
+        Wait(&space_);
+    }
+    ring_[tail % size_] = item;
+    tail_.store(tail + 1, std::memory_order_release);
+    sem_post(&items_);
+    return result;
+  }
+
+  //
+  // Consumer side, blocks until a frame is available. Returns false once the
+  // queue has been shut down and drained.
+  //
+  bool Pop(T * item) {
+    for (;;) {
+      if (TryPop(item))
+        return true;
+      if (shutdown_)
+        return false;
+      Wait(&items_);
+    }
+  }
+
+  /* Consumer side without blocking, returns false if the queue is empty */
+  bool TryPop(T * item) {
+    for (;;) {
+      uint32_t head = head_.load(std::memory_order_acquire);
+      uint32_t tail = tail_.load(std::memory_order_acquire);
+
+      if (head == tail)
+        return false;
+      *item = ring_[head % size_];
+      if (head_.compare_exchange_strong(head, head + 1,
+                                        std::memory_order_acq_rel)) {
+        /* Only wake the producer if it could be waiting for space */
+        if ((policy_ == QUEUE_BLOCK) && (tail - head == size_))
+          sem_post(&space_);
+        return true;
+      }
+      /* Producer dropped it, try the next one */
+    }
+  }
+
+  void Shutdown() {
+    shutdown_ = true;
+    sem_post(&items_);
+    sem_post(&space_);
+  }
+
+  int Depth() {
+    return tail_.load(std::memory_order_acquire) -
+      head_.load(std::memory_order_acquire);
+  }
+  uint64_t Dropped() {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+private:
+  void Wait(sem_t * sem) {
+    while ((sem_wait(sem) < 0) && (errno == EINTR));
+  }
+
+  std::vector < T > ring_;
+  uint32_t size_;
+  QueuePolicy policy_;
+  std::atomic < uint32_t > head_;
+  std::atomic < uint32_t > tail_;
+  std::atomic < uint64_t > dropped_;
+  std::atomic < bool > shutdown_;
+  sem_t items_;
+  sem_t space_;
+};
+
+#endif
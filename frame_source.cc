@@ -0,0 +1,337 @@
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iostream>
+#include <png.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#if !(__MINGW64__ || __MINGW32__)
+#include <sys/mman.h>
+#endif
+#include "frame_memory.h"
+#include "frame_source.h"
+using namespace std;
+
+#define SOURCE_PAGE           4096      /* stride to fault a mapping in with */
+
+void *SourceThread(void *data);
+
+static bool EndsWith(const std::string & name, const char *suffix) {
+  size_t len = strlen(suffix);
+
+  return (name.size() > len) &&
+    (strcasecmp(name.c_str() + name.size() - len, suffix) == 0);
+}
+
+static bool Png(const std::string & name) {
+  return EndsWith(name, ".png");
+}
+
+static bool Raw(const std::string & name) {
+  return EndsWith(name, ".yuv") || EndsWith(name, ".uyvy") ||
+    EndsWith(name, ".raw");
+}
+
+/* Black in limited range UYVY */
+static void Black(uint8_t *dst, size_t pixels) {
+  for (size_t c = 0; c < pixels / 2; c++) {
+    dst[c * 4] = 128;
+    dst[c * 4 + 1] = 16;
+    dst[c * 4 + 2] = 128;
+    dst[c * 4 + 3] = 16;
+  }
+}
+
+FrameSource::FrameSource() {
+  width_ = 0;
+  height_ = 0;
+  frame_bytes_ = 0;
+  frames_ = 0;
+  map_ = 0;
+  map_size_ = 0;
+  cache_ = 0;
+  ring_ = 0;
+  convert_ = ColourLineKernel(ColourKernelsBest(), PIXEL_RGB24, PIXEL_UYVY);
+  running_ = false;
+  decoded_ = 0;
+  started_ = false;
+}
+
+FrameSource::~FrameSource() {
+  Close();
+}
+
+//
+// Open path, a PNG, a directory of .png or .yuv/.uyvy/.raw frames (one per
+// file, sent in name order) or a raw file of frames back to back, and start
+// decoding. Content of up to cache bytes is converted once and kept. width
+// must be even.
+//
+bool FrameSource::Open(const char *path, int width, int height,
+                       bool hugepages, size_t cache) {
+  struct stat st;
+
+  Close();
+  width_ = width;
+  height_ = height;
+  frame_bytes_ = (size_t) width * height * 2;
+  if ((width < 2) || (width & 1) || (height < 1)) {
+    cout << "ERROR frame source " << width << "x" << height <<
+      " is not whole pixel pairs\n";
+    return false;
+  }
+  if (stat(path, &st) < 0) {
+    cout << "ERROR frame source " << path << " not found\n";
+    return false;
+  }
+
+  if (S_ISDIR(st.st_mode)) {
+    DIR *dir = opendir(path);
+    struct dirent *entry;
+
+    while (dir && ((entry = readdir(dir)) != NULL)) {
+      std::string name = entry->d_name;
+
+      if (Png(name) || Raw(name))
+        files_.push_back(std::string(path) + "/" + name);
+    }
+    if (dir)
+      closedir(dir);
+    std::sort(files_.begin(), files_.end());
+    frames_ = files_.size();
+  } else if (Png(path)) {
+    files_.push_back(path);
+    frames_ = 1;
+  } else {
+#if !(__MINGW64__ || __MINGW32__)
+    int fd = open(path, O_RDONLY);
+    void *map;
+
+    frames_ = st.st_size / frame_bytes_;
+    if ((fd < 0) || (frames_ < 1)) {
+      cout << "ERROR " << path << " holds no " << width << "x" << height <<
+        " UYVY frames\n";
+      if (fd >= 0)
+        close(fd);
+      frames_ = 0;
+      return false;
+    }
+    map_size_ = frames_ * frame_bytes_;
+    map = mmap(0, map_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+      cout << "ERROR mapping " << path << "\n";
+      frames_ = 0;
+      return false;
+    }
+    map_ = (char *) map;
+    madvise(map_, map_size_, MADV_SEQUENTIAL);
+#else
+    cout << "[RTP] Raw frame files need mmap()\n";
+    return false;
+#endif
+  }
+  if (frames_ < 1) {
+    cout << "ERROR no frames in " << path << "\n";
+    return false;
+  }
+
+  ready_.Configure(RTP_SOURCE_FRAMES, QUEUE_BLOCK);
+  free_.Configure(RTP_SOURCE_FRAMES, QUEUE_BLOCK);
+  if (!map_ && ((size_t) frames_ * frame_bytes_ <= cache)) {
+    cache_ = FrameMemory::Allocate(frames_ * frame_bytes_, hugepages);
+    loaded_.assign(frames_, false);
+  } else if (!map_) {
+    char *dropped;
+
+    ring_ = FrameMemory::Allocate(RTP_SOURCE_FRAMES * frame_bytes_, hugepages);
+    for (int c = 0; ring_ && (c < RTP_SOURCE_FRAMES); c++)
+      free_.Push(&ring_[c * frame_bytes_], &dropped);
+  }
+  if (!map_ && !cache_ && !ring_) {
+    cout << "ERROR allocating frame source buffers\n";
+    Close();
+    return false;
+  }
+
+  running_ = true;
+  if (pthread_create(&thread_, NULL, SourceThread, this) != 0) {
+    cout << "ERROR starting frame source thread\n";
+    running_ = false;
+    Close();
+    return false;
+  }
+  started_ = true;
+  cout << "[RTP] Frame source " << path << ", " << frames_ << " frames " <<
+    (map_ ? "mapped" : (cache_ ? "cached" : "streamed")) << "\n";
+  return true;
+}
+
+void FrameSource::Close() {
+  if (started_) {
+    running_ = false;
+    ready_.Shutdown();
+    free_.Shutdown();
+    pthread_join(thread_, 0);
+    started_ = false;
+  }
+#if !(__MINGW64__ || __MINGW32__)
+  if (map_)
+    munmap(map_, map_size_);
+#endif
+  map_ = 0;
+  map_size_ = 0;
+  FrameMemory::Free(cache_);
+  FrameMemory::Free(ring_);
+  cache_ = 0;
+  ring_ = 0;
+  loaded_.clear();
+  files_.clear();
+  frames_ = 0;
+  decoded_ = 0;
+}
+
+//
+// The next frame, waiting for it to be decoded if the thread has fallen
+// behind. Returns 0 once closed or if no frame could be decoded. Pass the
+// frame back through Done() when the stream has sent it.
+//
+char *FrameSource::Next() {
+  char *frame;
+
+  if (!ready_.Pop(&frame))
+    return 0;
+  return frame;
+}
+
+/* FrameDoneCallback for TransmitZeroCopy(), user is the FrameSource */
+void FrameSource::Done(char *frame, void *user) {
+  FrameSource *source = (FrameSource *) user;
+  char *dropped;
+
+  /* Cached and mapped frames never change, only ring buffers go back */
+  if (source->ring_ && (frame >= source->ring_) &&
+      (frame < source->ring_ + RTP_SOURCE_FRAMES * source->frame_bytes_))
+    source->free_.Push(frame, &dropped);
+}
+
+/* Fault a mapped frame in ahead of the sender */
+void FrameSource::Prefetch(const char *frame) {
+  volatile char touch = 0;
+
+  for (size_t offset = 0; offset < frame_bytes_; offset += SOURCE_PAGE)
+    touch += frame[offset];
+  (void) touch;
+}
+
+//
+// Decode and convert ahead of the sender, looping over the content for ever.
+// Stops when closed, or after a pass in which no frame could be decoded.
+//
+void FrameSource::Run() {
+  char *spare = 0;              /* ring buffer a frame failed to decode into */
+
+  while (running_) {
+    int good = 0;
+
+    for (int c = 0; running_ && (c < frames_); c++) {
+      char *frame;
+      char *dropped;
+
+      if (map_) {
+        frame = &map_[c * frame_bytes_];
+        Prefetch(frame);
+      } else if (cache_) {
+        frame = &cache_[c * frame_bytes_];
+        if (!loaded_[c]) {
+          if (!Load(c, frame))
+            continue;
+          loaded_[c] = true;
+        }
+      } else {
+        /* Done() is free_'s only producer, keep a buffer a frame failed in */
+        if (!spare && !free_.Pop(&spare))
+          break;
+        if (!Load(c, spare))
+          continue;
+        frame = spare;
+        spare = 0;
+      }
+      good++;
+      ready_.Push(frame, &dropped);
+    }
+    if (!good)
+      break;
+  }
+  /* Nothing more is coming, let Next() return */
+  ready_.Shutdown();
+}
+
+bool FrameSource::Load(int index, char *frame) {
+  const std::string & path = files_[index];
+  bool ok = Png(path) ? LoadPng(path.c_str(), frame) :
+    LoadRaw(path.c_str(), frame);
+
+  if (ok)
+    decoded_++;
+  else
+    cout << "[RTP] Frame source could not read " << path << "\n";
+  return ok;
+}
+
+//
+// Decode a PNG of any format to RGB in one reused buffer, then convert the
+// part that overlaps the frame a line at a time
+//
+bool FrameSource::LoadPng(const char *path, char *frame) {
+  png_image image;
+  int width, height;
+
+  memset(&image, 0, sizeof(image));
+  image.version = PNG_IMAGE_VERSION;
+  if (!png_image_begin_read_from_file(&image, path))
+    return false;
+  image.format = PNG_FORMAT_RGB;
+  if (rgb_.size() < PNG_IMAGE_SIZE(image))
+    rgb_.resize(PNG_IMAGE_SIZE(image));
+  if (!png_image_finish_read(&image, NULL, &rgb_[0], 0, NULL)) {
+    png_image_free(&image);
+    return false;
+  }
+
+  width = std::min((int) image.width & ~1, width_);
+  height = std::min((int) image.height, height_);
+  for (int y = 0; y < height; y++) {
+    uint8_t *line = (uint8_t *) & frame[(size_t) y * width_ * 2];
+
+    convert_(&rgb_[(size_t) y * PNG_IMAGE_ROW_STRIDE(image)], line, width);
+    Black(&line[width * 2], width_ - width);
+  }
+  for (int y = height; y < height_; y++)
+    Black((uint8_t *) & frame[(size_t) y * width_ * 2], width_);
+  return true;
+}
+
+/* One UYVY frame from the start of a file */
+bool FrameSource::LoadRaw(const char *path, char *frame) {
+  int fd = open(path, O_RDONLY);
+  size_t done = 0;
+
+  if (fd < 0)
+    return false;
+  while (done < frame_bytes_) {
+    ssize_t n = read(fd, &frame[done], frame_bytes_ - done);
+
+    if (n <= 0)
+      break;
+    done += n;
+  }
+  close(fd);
+  return done == frame_bytes_;
+}
+
+void *SourceThread(void *data) {
+  ((FrameSource *) data)->Run();
+  return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * Frames to send, from a PNG file, a directory of PNG or raw frames, or one
+ * large raw file of frames back to back. A background thread decodes and
+ * converts ahead into contiguous 8 bit UYVY frames so the sender never waits
+ * on libpng or the colourspace kernels:
+ *
+ *  - content that fits in the cache is converted once and then looped from
+ *    memory with no further work,
+ *  - longer content streams through a ring of RTP_SOURCE_FRAMES buffers,
+ *    each back in the ring once the stream is done with it,
+ *  - a raw file is mapped and sent straight from the mapping, the thread
+ *    only faults the next frames in ahead of the sender.
+ *
+ * Raw frames are RFC 4175 order UYVY, width * 2 bytes a line. PNGs larger
+ * than the frame are cropped to its top left, smaller ones padded with black.
+ *
+ *   FrameSource source;
+ *   source.Open("frames/", 1920, 1080);
+ *   while (char *frame = source.Next())
+ *     stream.TransmitZeroCopy(frame, FrameSource::Done, &source);
+ *
+ * Close the stream before the source, frames may still be in flight.
+ */
+
+#ifndef __FRAME_SOURCE_H__
+#define __FRAME_SOURCE_H__
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "colourspace.h"
+#include "frame_queue.h"
+
+#define RTP_SOURCE_FRAMES     4         /* frames decoded ahead of the sender */
+#define RTP_SOURCE_CACHE      (512 * 1024 * 1024)       /* content up to this many bytes is converted once */
+
+class FrameSource {
+public:
+  FrameSource();
+  ~FrameSource();
+  bool Open(const char *path, int width, int height, bool hugepages = false,
+            size_t cache = RTP_SOURCE_CACHE);
+  void Close();
+  char *Next();
+  static void Done(char *frame, void *user);
+  int Frames() { return frames_; }
+  bool Cached() { return cache_ != 0; }
+  bool Mapped() { return map_ != 0; }
+  uint64_t Decoded() { return decoded_; }
+  void Run();
+private:
+  bool Load(int index, char *frame);
+  bool LoadPng(const char *path, char *frame);
+  bool LoadRaw(const char *path, char *frame);
+  void Prefetch(const char *frame);
+  std::vector < std::string > files_;
+  int width_;
+  int height_;
+  size_t frame_bytes_;
+  int frames_;
+  char *map_;                   /* raw file of frames_ frames */
+  size_t map_size_;
+  char *cache_;                 /* every frame converted, when they fit */
+  std::vector < bool > loaded_;  /* frames of cache_ decoded without error */
+  char *ring_;                  /* RTP_SOURCE_FRAMES buffers otherwise */
+  FrameQueue < char *>ready_;   /* frames for Next(), in order */
+  FrameQueue < char *>free_;    /* ring buffers the stream has finished with */
+  std::vector < uint8_t > rgb_; /* decoded PNG, reused */
+  ColourLine convert_;          /* RGB to UYVY */
+  std::atomic < bool > running_;
+  std::atomic < uint64_t > decoded_;
+  bool started_;
+  pthread_t thread_;
+};
+
+#endif
@@ -0,0 +1,369 @@
+#include <sched.h>
+#include <string.h>
+#include "jitter_buffer.h"
+#include "rtp_trace.h"
+
+JitterBuffer::JitterBuffer() {
+  pool_ = 0;
+  stats_ = 0;
+  callback_ = 0;
+  user_ = 0;
+  lines_ = 0;
+  line_bytes_ = 0;
+  line_groups_ = 0;
+  line_words_ = 0;
+  published_any_ = false;
+  published_ = 0;
+  overrun_any_ = false;
+  overrun_ = 0;
+  delivering_ = false;
+  hold_ = false;
+  slots_ = 0;
+  frames_ = 0;
+  pthread_mutex_init(&mutex_, NULL);
+  Configure(RTP_JITTER_FRAMES, RTP_REORDER_WINDOW);
+}
+
+JitterBuffer::~JitterBuffer() {
+  FreeSlots();
+  pthread_mutex_destroy(&mutex_);
+}
+
+void JitterBuffer::FreeSlots() {
+  for (int c = 0; c < frames_; c++) {
+    delete[]slots_[c].groups;
+    delete[]slots_[c].received;
+    delete[]slots_[c].covered;
+  }
+  delete[]slots_;
+  slots_ = 0;
+  frames_ = 0;
+}
+
+/* Frames in flight and reorder window in ms, call before Open() */
+void JitterBuffer::Configure(int frames, int window_ms) {
+  if (frames < 1)
+    frames = 1;
+  FreeSlots();
+  slots_ = new JitterSlot[frames];
+  frames_ = frames;
+  for (int c = 0; c < frames_; c++) {
+    slots_[c].tag = 0;
+    slots_[c].writers = 0;
+    slots_[c].groups = 0;
+    slots_[c].received = 0;
+    slots_[c].covered = 0;
+  }
+  window_ns_ = (uint64_t) window_ms * 1000000;
+}
+
+//
+// line_bytes is a line in the frame buffer, line_groups the pixel groups
+// the sender splits it into
+//
+void JitterBuffer::Open(FramePool * pool, RtpStatsCounters * stats, int lines,
+                        int line_bytes, int line_groups,
+                        FrameReadyCallback callback, void *user) {
+  pool_ = pool;
+  stats_ = stats;
+  lines_ = lines;
+  line_bytes_ = line_bytes;
+  line_groups_ = line_groups;
+  line_words_ = (line_groups + 63) / 64;
+  callback_ = callback;
+  user_ = user;
+  published_any_ = false;
+  overrun_any_ = false;
+  for (int c = 0; c < frames_; c++) {
+    JitterSlot *s = &slots_[c];
+
+    s->tag = 0;
+    s->writers = 0;
+    delete[]s->groups;
+    delete[]s->received;
+    delete[]s->covered;
+    s->groups = new std::atomic < uint64_t >[(size_t) lines * line_words_];
+    s->received = new std::atomic < uint32_t >[lines];
+    s->covered = new std::atomic < uint64_t >[(lines + 63) / 64];
+  }
+}
+
+//
+// Join the frame in slot if it is still filling for tag. Counting ourselves
+// in before checking the tag again means Publish() either sees us or we see
+// the slot closed.
+//
+bool JitterBuffer::Enter(int slot, uint64_t tag) {
+  JitterSlot *s = &slots_[slot];
+
+  if (s->tag.load() != tag)
+    return false;
+  s->writers.fetch_add(1);
+  if (s->tag.load() == tag)
+    return true;
+  s->writers.fetch_sub(1);
+  return false;
+}
+
+//
+// Find (or start) the frame for timestamp and hold it until Received().
+// Returns the slot or -1 if the packet is late, its frame has already been
+// published, or the consumer is holding every spare buffer.
+//
+int JitterBuffer::Frame(uint32_t timestamp, uint64_t now) {
+  uint64_t tag = JITTER_FILLING | timestamp;
+  int slot;
+
+  for (int c = 0; c < frames_; c++) {
+    if (Enter(c, tag))
+      return c;
+  }
+
+  pthread_mutex_lock(&mutex_);
+  slot = Start(timestamp, now);
+  Unlock();
+  return slot;
+}
+
+/* Frame() for a timestamp not in flight, with the lock held */
+int JitterBuffer::Start(uint32_t timestamp, uint64_t now) {
+  uint64_t tag = JITTER_FILLING | timestamp;
+  int slot = -1;
+  int index;
+
+  if (published_any_ && ((int32_t) (timestamp - published_) <= 0)) {
+    RtpStatsCounters::Add(stats_->late_, 1);
+    return -1;
+  }
+
+  /* Another thread may have started it while we waited for the lock */
+  for (int c = 0; c < frames_; c++) {
+    if (Enter(c, tag))
+      return c;
+    if (slots_[c].tag.load() == 0)
+      slot = c;
+  }
+
+  /* New frame and nowhere to put it, push out the oldest */
+  if (slot < 0) {
+    slot = Oldest();
+    PublishUpTo(slots_[slot].timestamp);
+  }
+
+  /* Every packet of a frame with no buffer would try again, count it once */
+  if (overrun_any_ && (timestamp == overrun_))
+    return -1;
+  index = pool_->Take();
+  if (index < 0) {
+    overrun_any_ = true;
+    overrun_ = timestamp;
+    return -1;
+  }
+
+  JitterSlot *s = &slots_[slot];
+
+  s->timestamp = timestamp;
+  s->index = index;
+  s->data = pool_->Data(index);
+  s->marker.store(false, std::memory_order_relaxed);
+  s->complete.store(0, std::memory_order_relaxed);
+  s->idle.store(now + (uint64_t) RTP_FRAME_IDLE * 1000000,
+                std::memory_order_relaxed);
+  s->window.store(UINT64_MAX, std::memory_order_relaxed);
+  s->started = RTP_TRACE_NOW();
+  for (size_t c = 0; c < (size_t) lines_ * line_words_; c++)
+    s->groups[c].store(0, std::memory_order_relaxed);
+  for (int c = 0; c < lines_; c++)
+    s->received[c].store(0, std::memory_order_relaxed);
+  for (int c = 0; c < (lines_ + 63) / 64; c++)
+    s->covered[c].store(0, std::memory_order_relaxed);
+
+  /* Threads that raced to start it may still be counted in, add to them */
+  s->writers.fetch_add(1);
+  s->tag.store(tag);
+  return slot;
+}
+
+/* The marker packet arrived, allow the reorder window for stragglers */
+void JitterBuffer::Marker(int slot, uint64_t now) {
+  slots_[slot].marker.store(true, std::memory_order_relaxed);
+  slots_[slot].window.store(now + window_ns_, std::memory_order_relaxed);
+}
+
+//
+// A packet has been copied into slot, let go of it and publish straight away
+// if the frame is complete.
+//
+void JitterBuffer::Received(int slot, uint64_t now) {
+  JitterSlot *s = &slots_[slot];
+  uint32_t timestamp = s->timestamp;
+  uint64_t idle = now + (uint64_t) RTP_FRAME_IDLE * 1000000;
+  bool complete = s->complete.load(std::memory_order_relaxed) >= lines_;
+
+  /* Every thread writes the same line, only do it once a millisecond */
+  if (!complete &&
+      (s->idle.load(std::memory_order_relaxed) + RTP_IDLE_STEP < idle))
+    s->idle.store(idle, std::memory_order_relaxed);
+  s->writers.fetch_sub(1);
+
+  if (complete) {
+    pthread_mutex_lock(&mutex_);
+    PublishUpTo(timestamp);
+    Unlock();
+  }
+}
+
+uint64_t JitterBuffer::Deadline(JitterSlot * s) {
+  uint64_t idle = s->idle.load(std::memory_order_relaxed);
+  uint64_t window = s->window.load(std::memory_order_relaxed);
+
+  return idle < window ? idle : window;
+}
+
+/* Publish every frame whose deadline has passed */
+void JitterBuffer::Expire(uint64_t now) {
+  bool due = false;
+
+  /* Every receive thread calls this after every batch, look before locking */
+  for (int c = 0; c < frames_; c++) {
+    if (slots_[c].tag.load() && (Deadline(&slots_[c]) <= now))
+      due = true;
+  }
+  if (!due)
+    return;
+
+  pthread_mutex_lock(&mutex_);
+  for (int c = 0; c < frames_; c++) {
+    if (slots_[c].tag.load() && (Deadline(&slots_[c]) <= now))
+      PublishUpTo(slots_[c].timestamp);
+  }
+  Unlock();
+}
+
+/* Drop everything in flight without publishing, used on Close() */
+void JitterBuffer::Flush() {
+  pthread_mutex_lock(&mutex_);
+  for (int c = 0; c < frames_; c++) {
+    if (slots_[c].tag.load())
+      pool_->Discard(slots_[c].index);
+    slots_[c].tag.store(0);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+int JitterBuffer::Oldest() {
+  int oldest = -1;
+
+  for (int c = 0; c < frames_; c++) {
+    if (!slots_[c].tag.load())
+      continue;
+    if ((oldest < 0) ||
+        ((int32_t) (slots_[c].timestamp - slots_[oldest].timestamp) < 0))
+      oldest = c;
+  }
+  return oldest;
+}
+
+/* Publish every frame up to and including timestamp, oldest first */
+void JitterBuffer::PublishUpTo(uint32_t timestamp) {
+  int oldest;
+
+  while (((oldest = Oldest()) >= 0) &&
+         ((int32_t) (slots_[oldest].timestamp - timestamp) <= 0))
+    Publish(oldest);
+}
+
+//
+// Copy every line that did not arrive in full from the previous published
+// frame, which stays untouched until this one replaces it. Returns the
+// number of complete lines, held ones included.
+//
+int JitterBuffer::HoldLines(JitterSlot * s, uint8_t * map) {
+  int ready = pool_->Ready();
+  const uint8_t *held;
+  const char *last;
+  int complete = 0;
+
+  if (ready < 0)
+    return s->complete.load();
+  held = pool_->LineMap(ready);
+  last = pool_->Data(ready);
+  for (int c = 0; c < lines_; c++) {
+    if (!map[c] && held[c]) {
+      memcpy(&s->data[(size_t) c * line_bytes_],
+             &last[(size_t) c * line_bytes_], line_bytes_);
+      map[c] = 1;
+    }
+    complete += map[c];
+  }
+  return complete;
+}
+
+/* With the lock held */
+void JitterBuffer::Publish(int slot) {
+  JitterSlot *s = &slots_[slot];
+  uint8_t *map = pool_->LineMap(s->index);
+  const FrameCoverage *published;
+  FrameCoverage coverage;
+  int complete;
+  uint64_t start = RTP_TRACE_NOW();
+
+  /* Close the slot, then wait out any thread still copying a packet in */
+  s->tag.store(0);
+  while (s->writers.load() != 0)
+    sched_yield();
+
+  complete = s->complete.load();
+  for (int c = 0; c < lines_; c++)
+    map[c] = (s->covered[c >> 6].load(std::memory_order_relaxed) >>
+              (c & 63)) & 1;
+  if (hold_ && (complete < lines_))
+    complete = HoldLines(s, map);
+
+  coverage.timestamp = s->timestamp;
+  coverage.lines = lines_;
+  coverage.complete = complete;
+  coverage.marker = s->marker.load();
+  coverage.line_map = map;
+  published = pool_->Publish(s->index, &coverage);
+
+  RtpStatsCounters::Add(complete >= lines_ ? stats_->frames_ :
+                        stats_->partial_, 1);
+  published_ = s->timestamp;
+  published_any_ = true;
+  RTP_TRACE_SPAN(TRACE_RX_PUBLISH, start);
+  RTP_TRACE_SPAN(TRACE_RX_FRAME, s->started);
+
+  if (callback_) {
+    JitterReady ready;
+
+    ready.frame = pool_->Hold(s->index);
+    ready.data = s->data;
+    ready.coverage = published;
+    ready_.push_back(ready);
+  }
+}
+
+//
+// Let go of the lock, first running the callbacks of the frames published
+// while it was held. One thread runs them at a time so they stay in order,
+// the others leave theirs to it and carry on receiving.
+//
+void JitterBuffer::Unlock() {
+  if (delivering_) {
+    pthread_mutex_unlock(&mutex_);
+    return;
+  }
+  delivering_ = true;
+  while (!ready_.empty()) {
+    JitterReady ready = ready_.front();
+
+    ready_.erase(ready_.begin());
+    pthread_mutex_unlock(&mutex_);
+    callback_(ready.data, ready.coverage, user_);
+    pool_->Release(ready.frame);
+    pthread_mutex_lock(&mutex_);
+  }
+  delivering_ = false;
+  pthread_mutex_unlock(&mutex_);
+}
@@ -0,0 +1,138 @@
+/*
+ * Receive reorder/jitter buffer. Lines are placed into a frame buffer chosen
+ * by the packet's RTP timestamp so stragglers from one frame never land in
+ * the next. Up to RTP_JITTER_FRAMES frames can be in flight at once. A frame
+ * is published as soon as every line has arrived, or once the reorder window
+ * has passed after its marker, or when it is pushed out by newer frames.
+ * Frames are always published in timestamp order.
+ *
+ * With Hold() on, lines missing from a frame are copied from the frame
+ * published before it, for senders that only send the lines that changed.
+ *
+ * Lines are tracked by the pixel groups received, not a byte count, so a
+ * duplicated packet never makes a line with a segment missing look complete.
+ *
+ * Several receive threads may fill the same frame at once. Finding the frame
+ * in flight and recording its lines in atomic coverage bitmaps take no
+ * lock, only starting a frame and publishing one do. A thread holds the
+ * frame from Frame() until Received(), publishing waits for every holder to
+ * let go so no packet lands in a buffer that has been handed on.
+ */
+
+#ifndef __JITTER_BUFFER_H__
+#define __JITTER_BUFFER_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include "frame_pool.h"
+#include "rtp_stats.h"
+
+#define RTP_JITTER_FRAMES     2         /* frames in flight */
+#define RTP_REORDER_WINDOW    2         /* ms to wait for stragglers after the marker */
+#define RTP_FRAME_IDLE        100       /* ms without packets before giving up on a frame */
+#define RTP_IDLE_STEP         1000000   /* ns, the idle deadline is moved on no finer than this */
+#define JITTER_FILLING        (1ULL << 32)      /* slot tag bit, the low 32 are the timestamp */
+
+typedef struct {
+  std::atomic < uint64_t > tag;         /* JITTER_FILLING | timestamp, 0 when free */
+  std::atomic < int >writers;   /* threads between Frame() and Received() */
+  uint32_t timestamp;
+  int index;                    /* buffer in the frame pool */
+  char *data;
+  std::atomic < bool > marker;
+  std::atomic < int >complete;  /* lines received in full */
+  std::atomic < uint64_t > idle;        /* publish by if nothing more arrives, CLOCK_MONOTONIC ns */
+  std::atomic < uint64_t > window;      /* publish by once the marker is in */
+  uint64_t started;             /* RtpTrace::Now() at the first packet */
+  std::atomic < uint64_t > *groups;     /* bit per pixel group received, line_words_ a line */
+  std::atomic < uint32_t > *received;   /* pixel groups received per line */
+  std::atomic < uint64_t > *covered;    /* bit per line received in full */
+} JitterSlot;
+
+/* A published frame waiting for the frame callback, held in the pool */
+typedef struct {
+  PoolFrame *frame;
+  char *data;
+  const FrameCoverage *coverage;
+} JitterReady;
+
+class JitterBuffer {
+public:
+  JitterBuffer();
+  ~JitterBuffer();
+  void Configure(int frames, int window_ms);
+  int Frames() { return frames_; }
+  int Window() { return window_ns_ / 1000000; }
+  void Hold(bool hold) { hold_ = hold; }
+  void Open(FramePool * pool, RtpStatsCounters * stats, int lines,
+            int line_bytes, int line_groups, FrameReadyCallback callback,
+            void *user);
+  int Frame(uint32_t timestamp, uint64_t now);
+  char *Data(int slot) { return slots_[slot].data; }
+  //
+  // A packet brought count pixel groups of line from first on. Only groups
+  // not seen before count, and only the packet that completes a line marks it.
+  //
+  void Line(int slot, int line, int first, int count) {
+    JitterSlot *s = &slots_[slot];
+    std::atomic < uint64_t > *map = &s->groups[(size_t) line * line_words_];
+    int last = std::min(first + count, line_groups_);
+    uint32_t added = 0;
+
+    while (first < last) {
+      int bit = first & 63;
+      int n = std::min(64 - bit, last - first);
+      uint64_t mask = (n == 64 ? ~0ULL : (1ULL << n) - 1) << bit;
+      uint64_t before = map[first >> 6].fetch_or(mask,
+                                                 std::memory_order_relaxed);
+
+      added += __builtin_popcountll(mask & ~before);
+      first += n;
+    }
+    if (added &&
+        (s->received[line].fetch_add(added, std::memory_order_relaxed) +
+         added == (uint32_t) line_groups_)) {
+      s->covered[line >> 6].fetch_or(1ULL << (line & 63),
+                                     std::memory_order_relaxed);
+      s->complete.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  void Marker(int slot, uint64_t now);
+  void Received(int slot, uint64_t now);
+  void Expire(uint64_t now);
+  void Flush();
+private:
+  bool Enter(int slot, uint64_t tag);
+  int Start(uint32_t timestamp, uint64_t now);
+  uint64_t Deadline(JitterSlot * s);
+  void Publish(int slot);
+  int HoldLines(JitterSlot * s, uint8_t * map);
+  void PublishUpTo(uint32_t timestamp);
+  int Oldest();
+  void FreeSlots();
+  void Unlock();
+  JitterSlot *slots_;
+  int frames_;
+  pthread_mutex_t mutex_;       /* starting and publishing frames */
+  FramePool *pool_;
+  RtpStatsCounters *stats_;
+  FrameReadyCallback callback_;
+  void *user_;
+  int lines_;
+  int line_bytes_;
+  int line_groups_;             /* pixel groups a line */
+  int line_words_;              /* uint64_t of JitterSlot groups a line */
+  uint64_t window_ns_;
+  bool hold_;                   /* fill missing lines from the last frame */
+  bool published_any_;
+  uint32_t published_;          /* timestamp of the last published frame */
+  bool overrun_any_;
+  uint32_t overrun_;            /* timestamp of the last frame with no buffer */
+  std::vector < JitterReady > ready_;   /* published, callback not run yet */
+  bool delivering_;             /* a thread is running the callbacks */
+};
+
+#endif
@@ -0,0 +1,278 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+#include <vector>
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#endif
+#include "packet_ring.h"
+using namespace std;
+
+#define FILTER_DROP 0xFF        /* jump to the final drop, patched in Filter() */
+
+PacketRing::PacketRing() {
+  fd_ = -1;
+  map_ = 0;
+  map_size_ = 0;
+  block_ = 0;
+  holding_ = false;
+  packets_ = 0;
+  packet_ = 0;
+  timeout_ms_ = 1;
+}
+
+PacketRing::~PacketRing() {
+  Close();
+}
+
+#ifdef __linux__
+//
+// Map a TPACKET_V3 ring on interface (empty for every interface) taking the
+// UDP datagrams to port, and to address (host order) unless it is 0. Next()
+// waits up to timeout_ms for a block. Returns false if the ring can not be
+// set up, e.g. without CAP_NET_RAW.
+//
+bool PacketRing::Open(const char *interface, uint32_t address, int port,
+                      int timeout_ms) {
+  struct tpacket_req3 req;
+  struct sockaddr_ll sll;
+  int version = TPACKET_V3;
+
+  Close();
+  timeout_ms_ = timeout_ms < 1 ? 1 : timeout_ms;
+
+  /* No protocol until bound, nothing arrives before the filter is on */
+  if ((fd_ = socket(AF_PACKET, SOCK_DGRAM, 0)) < 0) {
+    if (errno == EPERM)
+      cout << "[RTP] Packet ring needs CAP_NET_RAW\n";
+    return false;
+  }
+  if ((setsockopt(fd_, SOL_PACKET, PACKET_VERSION, &version,
+                  sizeof(version)) < 0) || !Filter(address, port)) {
+    Close();
+    return false;
+  }
+
+  memset(&req, 0, sizeof(req));
+  req.tp_block_size = RTP_RING_BLOCK_SIZE;
+  req.tp_block_nr = RTP_RING_BLOCKS;
+  req.tp_frame_size = RTP_RING_FRAME_SIZE;
+  req.tp_frame_nr = RTP_RING_BLOCK_SIZE / RTP_RING_FRAME_SIZE * RTP_RING_BLOCKS;
+  req.tp_retire_blk_tov = RTP_RING_RETIRE_MS;
+  if (setsockopt(fd_, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+    cout << "ERROR setting up packet ring\n";
+    Close();
+    return false;
+  }
+  map_size_ = (size_t) RTP_RING_BLOCK_SIZE * RTP_RING_BLOCKS;
+  map_ = (uint8_t *) mmap(0, map_size_, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd_, 0);
+  if (map_ == MAP_FAILED) {
+    map_ = 0;
+    cout << "ERROR mapping packet ring\n";
+    Close();
+    return false;
+  }
+
+  memset(&sll, 0, sizeof(sll));
+  sll.sll_family = AF_PACKET;
+  sll.sll_protocol = htons(ETH_P_IP);
+  if (interface && interface[0] &&
+      ((sll.sll_ifindex = if_nametoindex(interface)) == 0)) {
+    cout << "ERROR, no such interface as " << interface << "\n";
+    Close();
+    return false;
+  }
+  if (bind(fd_, (struct sockaddr *) &sll, sizeof(sll)) < 0) {
+    cout << "ERROR binding packet ring\n";
+    Close();
+    return false;
+  }
+  block_ = 0;
+  holding_ = false;
+  packets_ = 0;
+  return true;
+}
+
+static void Op(std::vector < struct sock_filter > *code, uint16_t op,
+               uint8_t jt, uint8_t jf, uint32_t k) {
+  struct sock_filter insn;
+
+  insn.code = op;
+  insn.jt = jt;
+  insn.jf = jf;
+  insn.k = k;
+  code->push_back(insn);
+}
+
+//
+// Classic BPF on the network header (SOCK_DGRAM), so the kernel only copies
+// unfragmented UDP to port into the ring. Our own transmitted packets show
+// up as PACKET_OUTGOING on loopback and are left out, as are other hosts'.
+//
+bool PacketRing::Filter(uint32_t address, int port) {
+  std::vector < struct sock_filter > code;
+  struct sock_fprog program;
+
+  Op(&code, BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_PKTTYPE);
+  Op(&code, BPF_JMP | BPF_JEQ | BPF_K, FILTER_DROP, 0, PACKET_OUTGOING);
+  Op(&code, BPF_JMP | BPF_JEQ | BPF_K, FILTER_DROP, 0, PACKET_OTHERHOST);
+  Op(&code, BPF_LD | BPF_B | BPF_ABS, 0, 0, 9);
+  Op(&code, BPF_JMP | BPF_JEQ | BPF_K, 0, FILTER_DROP, IPPROTO_UDP);
+  /* More fragments or a fragment offset */
+  Op(&code, BPF_LD | BPF_H | BPF_ABS, 0, 0, 6);
+  Op(&code, BPF_JMP | BPF_JSET | BPF_K, FILTER_DROP, 0, 0x3FFF);
+  if (address) {
+    Op(&code, BPF_LD | BPF_W | BPF_ABS, 0, 0, 16);
+    Op(&code, BPF_JMP | BPF_JEQ | BPF_K, 0, FILTER_DROP, address);
+  }
+  /* X = IP header length, then the UDP destination port */
+  Op(&code, BPF_LDX | BPF_B | BPF_MSH, 0, 0, 0);
+  Op(&code, BPF_LD | BPF_H | BPF_IND, 0, 0, 2);
+  Op(&code, BPF_JMP | BPF_JEQ | BPF_K, 0, FILTER_DROP, port);
+  Op(&code, BPF_RET | BPF_K, 0, 0, 0xFFFFFFFF);
+  Op(&code, BPF_RET | BPF_K, 0, 0, 0);
+
+  for (size_t c = 0; c < code.size(); c++) {
+    if (code[c].jt == FILTER_DROP)
+      code[c].jt = code.size() - c - 2;
+    if (code[c].jf == FILTER_DROP)
+      code[c].jf = code.size() - c - 2;
+  }
+  program.len = code.size();
+  program.filter = &code[0];
+  if (setsockopt(fd_, SOL_SOCKET, SO_ATTACH_FILTER, &program,
+                 sizeof(program)) < 0) {
+    cout << "ERROR attaching packet ring filter\n";
+    return false;
+  }
+  return true;
+}
+
+/* Discard everything arriving on sockfd, the ring has its own copy */
+bool PacketRing::DropAll(int sockfd) {
+  std::vector < struct sock_filter > code;
+  struct sock_fprog program;
+
+  Op(&code, BPF_RET | BPF_K, 0, 0, 0);
+  program.len = code.size();
+  program.filter = &code[0];
+  return setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &program,
+                    sizeof(program)) == 0;
+}
+
+/* Hand the block the last batch came from back to the kernel */
+void PacketRing::Release() {
+  struct tpacket_block_desc *desc;
+
+  if (!holding_)
+    return;
+  desc = (struct tpacket_block_desc *) (map_ + (size_t) block_ *
+                                        RTP_RING_BLOCK_SIZE);
+  __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL,
+                   __ATOMIC_RELEASE);
+  block_ = (block_ + 1) % RTP_RING_BLOCKS;
+  holding_ = false;
+}
+
+//
+// Up to max datagrams from the ring, each iov pointing at an RTP packet in
+// the mapped block. They stay valid until the next call. Returns -1 with
+// errno EAGAIN if nothing arrived within the timeout.
+//
+int PacketRing::Next(struct iovec *iov, int max) {
+  int n = 0;
+
+  if (!packets_) {
+    struct tpacket_block_desc *desc;
+
+    Release();
+    desc = (struct tpacket_block_desc *) (map_ + (size_t) block_ *
+                                          RTP_RING_BLOCK_SIZE);
+    if (!(__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) &
+          TP_STATUS_USER)) {
+      struct pollfd pfd;
+
+      pfd.fd = fd_;
+      pfd.events = POLLIN | POLLERR;
+      pfd.revents = 0;
+      if (poll(&pfd, 1, timeout_ms_) < 0)
+        return -1;
+      if (!(__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) &
+            TP_STATUS_USER)) {
+        errno = EAGAIN;
+        return -1;
+      }
+    }
+    holding_ = true;
+    packets_ = desc->hdr.bh1.num_pkts;
+    packet_ = (uint8_t *) desc + desc->hdr.bh1.offset_to_first_pkt;
+  }
+
+  while ((n < max) && packets_) {
+    struct tpacket3_hdr *hdr = (struct tpacket3_hdr *) packet_;
+    const uint8_t *ip = packet_ + hdr->tp_net;
+    uint32_t len = hdr->tp_snaplen;
+    uint32_t ihl, total, udp;
+
+    packet_ += hdr->tp_next_offset;
+    packets_--;
+
+    /* The filter has checked the protocol and port, check the lengths */
+    if ((len != hdr->tp_len) || (len < 28) || ((ip[0] >> 4) != 4))
+      continue;
+    ihl = (ip[0] & 0xF) * 4;
+    total = (ip[2] << 8) | ip[3];
+    if ((ihl < 20) || (total > len) || (ihl + 8 > total))
+      continue;
+    udp = (ip[ihl + 4] << 8) | ip[ihl + 5];
+    if ((udp < 8) || (ihl + udp > total))
+      continue;
+    iov[n].iov_base = (void *) (ip + ihl + 8);
+    iov[n].iov_len = udp - 8;
+    n++;
+  }
+  return n;
+}
+
+void PacketRing::Close() {
+  if (map_)
+    munmap(map_, map_size_);
+  map_ = 0;
+  if (fd_ >= 0)
+    close(fd_);
+  fd_ = -1;
+  holding_ = false;
+  packets_ = 0;
+}
+
+#else
+
+bool PacketRing::Open(const char *interface, uint32_t address, int port,
+                      int timeout_ms) {
+  cout << "[RTP] Packet ring needs Linux\n";
+  return false;
+}
+
+bool PacketRing::DropAll(int sockfd) {
+  return false;
+}
+
+int PacketRing::Next(struct iovec *iov, int max) {
+  errno = EAGAIN;
+  return -1;
+}
+
+void PacketRing::Close() {
+}
+
+#endif
@@ -0,0 +1,49 @@
+/*
+ * AF_PACKET receive ring (PACKET_MMAP, TPACKET_V3). The kernel writes whole
+ * blocks of packets into memory shared with us, a classic BPF filter keeps
+ * only the stream's UDP datagrams, so a batch is a walk over a block with no
+ * syscall or copy per packet. Datagrams are parsed in place and handed out as
+ * pointers to their RTP headers, the block goes back to the kernel on the
+ * next call.
+ *
+ * Needs Linux and CAP_NET_RAW. The stream's UDP socket stays bound (for the
+ * port, multicast joins and to keep ICMP quiet) with a filter that drops
+ * everything, so the kernel does not queue each packet twice.
+ */
+
+#ifndef __PACKET_RING_H__
+#define __PACKET_RING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#define RTP_RING_BLOCK_SIZE   (1 << 20)
+#define RTP_RING_BLOCKS       64
+#define RTP_RING_FRAME_SIZE   2048      /* only a sanity limit for TPACKET_V3 */
+#define RTP_RING_RETIRE_MS    1         /* hand over a part filled block after */
+
+class PacketRing {
+public:
+  PacketRing();
+  ~PacketRing();
+  bool Open(const char *interface, uint32_t address, int port, int timeout_ms);
+  void Close();
+  bool Active() { return fd_ >= 0; }
+  int Next(struct iovec *iov, int max);
+  uint64_t Drops();
+  static bool DropAll(int sockfd);
+private:
+  bool Filter(uint32_t address, int port);
+  void Release();
+  int fd_;
+  uint8_t *map_;
+  size_t map_size_;
+  int block_;                   /* block being read */
+  bool holding_;                /* block_ is ours until the next call */
+  uint32_t packets_;            /* left in block_ */
+  uint8_t *packet_;             /* next packet of block_ */
+  int timeout_ms_;
+};
+
+#endif
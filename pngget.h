@@ -1,8 +0,0 @@
-#ifndef PNGGET_H
-#define PNGGET_H
-#include <png.h>
-png_bytep * get_row_pointwes();
-void read_png_file(char* file_name);
-#endif
-
-
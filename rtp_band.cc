@@ -0,0 +1,254 @@
+#include <errno.h>
+#include <sched.h>
+#include <iostream>
+#if !(__MINGW64__ || __MINGW32__)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+#include "rtp_band.h"
+using namespace std;
+
+void *BandThread(void *data);
+
+RtpBand::RtpBand(RtpStream * stream, int index) {
+  stream_ = stream;
+  index_ = index;
+  sockfd_ = -1;
+  buffer_ = 0;
+  msgs_ = 0;
+  iov_ = 0;
+  running_ = false;
+  started_ = false;
+  pending_ = false;
+  first_ = 0;
+  last_ = 0;
+  sequence_ = 0;
+  result_ = 0;
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_cond_init(&cond_, NULL);
+}
+
+RtpBand::~RtpBand() {
+  Close();
+  pthread_cond_destroy(&cond_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+#if !(__MINGW64__ || __MINGW32__)
+//
+// Socket, packet buffers and thread for the band, after the stream has
+// worked out its destinations and MTU. port is the source port to share, 0
+// for one of its own, and cpu the core to run on or -1 for any.
+//
+bool RtpBand::Open(int port, int cpu) {
+  size_t dests = stream_->tx_dest_.size();
+  int mtu = stream_->mtu_;
+
+  Close();
+  if ((sockfd_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+    cout << "ERROR opening socket\n";
+    return false;
+  }
+  stream_->MulticastOut(sockfd_);
+#ifdef SO_REUSEPORT
+  if (port) {
+    struct sockaddr_in local;
+    int on = 1;
+
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(port);
+    if ((setsockopt(sockfd_, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) ||
+        (bind(sockfd_, (struct sockaddr *) &local, sizeof(local)) < 0))
+      cout << "[RTP] Band " << index_ << " has its own source port\n";
+  }
+#endif
+
+  buffer_ = FrameMemory::Allocate(RTP_BATCH_SIZE * mtu, stream_->HugePages(),
+                                  stream_->MemoryNode(false, cpu));
+  msgs_ = (struct mmsghdr *) calloc(RTP_BATCH_SIZE * dests,
+                                    sizeof(struct mmsghdr));
+  iov_ = (struct iovec *) calloc(RTP_BATCH_SIZE * 2, sizeof(struct iovec));
+  for (int c = 0; c < RTP_BATCH_SIZE; c++) {
+    iov_[c * 2].iov_base = &buffer_[c * mtu];
+    for (size_t d = 0; d < dests; d++) {
+      struct msghdr *msg = &msgs_[c * dests + d].msg_hdr;
+
+      msg->msg_name = &stream_->tx_dest_[d];
+      msg->msg_namelen = sizeof(stream_->tx_dest_[d]);
+      msg->msg_iov = &iov_[c * 2];
+      msg->msg_iovlen = 1;
+    }
+  }
+  pacer_ = stream_->pacer_.Share(stream_->tx_bands_wanted_);
+
+  running_ = true;
+  if (pthread_create(&thread_, NULL, BandThread, this) != 0) {
+    cout << "ERROR starting band thread\n";
+    running_ = false;
+    Close();
+    return false;
+  }
+  started_ = true;
+#ifdef __linux__
+  if (cpu >= 0) {
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(thread_, sizeof(set), &set) != 0)
+      cout << "[RTP] Could not pin band " << index_ << " to CPU " << cpu <<
+        "\n";
+  }
+#endif
+  return true;
+}
+
+//
+// Packetize and send packets [first, last) of the stream's current frame,
+// numbered from sequence, on the calling thread. Returns -1 on a socket
+// error, the rest of the band is then abandoned.
+//
+int RtpBand::Send(int first, int last, uint32_t sequence, bool paced) {
+  size_t dests = stream_->tx_dest_.size();
+  int batch_size = paced ? RTP_PACING_BURST : RTP_BATCH_SIZE;
+  int packet = first;
+
+  while (packet < last) {
+    int batch = 0;
+    int bytes = 0;
+    int count, sent = 0;
+
+    {
+      RTP_TRACE_SCOPE(stream_->tx_convert_ ? TRACE_TX_CONVERT :
+                      TRACE_TX_PACKETIZE);
+
+      for (; (batch < batch_size) && (packet < last); batch++, packet++) {
+        struct msghdr *msg = &msgs_[batch * dests].msg_hdr;
+
+        msg->msg_iovlen = stream_->WritePacket(packet,
+                                               sequence + packet - first,
+                                               &iov_[batch * 2]);
+        for (size_t d = 1; d < dests; d++)
+          msgs_[batch * dests + d].msg_hdr.msg_iovlen = msg->msg_iovlen;
+        bytes += (RTP_IP_UDP_HEADER +
+                  stream_->tx_layout_->Packet(packet)->size) * dests;
+      }
+    }
+    if (paced)
+      stream_->Pace(pacer_.Schedule(bytes));
+
+    RTP_TRACE_SCOPE(TRACE_TX_SEND);
+    count = batch * dests;
+    while (sent < count) {
+      int n = sendmmsg(sockfd_, &msgs_[sent], count - sent, 0);
+
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        cout << "[RTP] Transmit socket failure fd=" << sockfd_ << "\n";
+        return -1;
+      }
+      sent += n;
+    }
+  }
+  return 0;
+}
+
+#else
+
+bool RtpBand::Open(int port, int cpu) {
+  cout << "[RTP] Bands need sendmmsg()\n";
+  return false;
+}
+
+int RtpBand::Send(int first, int last, uint32_t sequence, bool paced) {
+  return -1;
+}
+
+#endif
+
+void RtpBand::Close() {
+  if (started_) {
+    pthread_mutex_lock(&mutex_);
+    running_ = false;
+    pthread_cond_broadcast(&cond_);
+    pthread_mutex_unlock(&mutex_);
+    pthread_join(thread_, 0);
+    started_ = false;
+  }
+  if (sockfd_ >= 0) {
+    close(sockfd_);
+    sockfd_ = -1;
+  }
+  FrameMemory::Free(buffer_);
+  free(msgs_);
+  free(iov_);
+  buffer_ = 0;
+  msgs_ = 0;
+  iov_ = 0;
+}
+
+/* Hand the band thread packets [first, last) of the frame just begun */
+void RtpBand::Start(int first, int last, uint32_t sequence) {
+  pthread_mutex_lock(&mutex_);
+  first_ = first;
+  last_ = last;
+  sequence_ = sequence;
+  result_ = 0;
+  pending_ = true;
+  pthread_cond_broadcast(&cond_);
+  pthread_mutex_unlock(&mutex_);
+}
+
+/* Wait for the band to be sent, returns -1 if it failed */
+int RtpBand::Wait() {
+  int result;
+
+  pthread_mutex_lock(&mutex_);
+  while (pending_)
+    pthread_cond_wait(&cond_, &mutex_);
+  result = result_;
+  pthread_mutex_unlock(&mutex_);
+  return result;
+}
+
+void RtpBand::Run() {
+  pthread_mutex_lock(&mutex_);
+  while (running_) {
+    int result = 0;
+
+    if (!pending_) {
+      pthread_cond_wait(&cond_, &mutex_);
+      continue;
+    }
+    pthread_mutex_unlock(&mutex_);
+
+    /* The band's bytes are spread over the frame period */
+    if (first_ < last_) {
+      if (pacer_.Enabled()) {
+        int bytes = 0;
+
+        for (int c = first_; c < last_; c++)
+          bytes += RTP_IP_UDP_HEADER + stream_->tx_layout_->Packet(c)->size;
+        pacer_.StartFrame(bytes * stream_->tx_dest_.size(),
+                          RTP_PACING_BURST * stream_->mtu_ *
+                          stream_->tx_dest_.size());
+      }
+      result = Send(first_, last_, sequence_, pacer_.Enabled());
+    }
+
+    pthread_mutex_lock(&mutex_);
+    result_ = result;
+    pending_ = false;
+    pthread_cond_broadcast(&cond_);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+void *BandThread(void *data) {
+  ((RtpBand *) data)->Run();
+  return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * One horizontal band of an RtpStream's frames, packetized and sent on its
+ * own thread and socket. SetBands(n) splits every frame's packets into n
+ * runs of whole packets, top to bottom, so a frame too big for one core is
+ * packetized (and converted from RGB) on n at once. Each band is handed its
+ * first sequence number when the frame starts, so the packets on the wire
+ * still number the frame in order and a receiver reassembles it as usual.
+ * The marker packet goes last, once every band has finished.
+ *
+ * Band sockets share the stream's source port with SO_REUSEPORT where the
+ * kernel allows it, otherwise each has a port of its own.
+ */
+
+#ifndef __RTP_BAND_H__
+#define __RTP_BAND_H__
+
+#include <pthread.h>
+#include "rtp_stream.h"
+
+class RtpBand {
+public:
+  RtpBand(RtpStream * stream, int index);
+  ~RtpBand();
+  bool Open(int port, int cpu);
+  void Close();
+  void Start(int first, int last, uint32_t sequence);
+  int Wait();
+  int Send(int first, int last, uint32_t sequence, bool paced);
+  void Run();
+private:
+  RtpStream *stream_;
+  int index_;
+  int sockfd_;
+  char *buffer_;                /* RTP_BATCH_SIZE packets of the stream's MTU */
+  struct mmsghdr *msgs_;        /* a message per packet per destination */
+  struct iovec *iov_;           /* two per packet, header and payload */
+  RtpPacer pacer_;              /* the band's share of the stream's pacing */
+  bool running_;
+  bool started_;                /* thread created */
+  bool pending_;                /* a range is waiting to be sent */
+  int first_;                   /* packets [first_, last_) of the frame */
+  int last_;
+  uint32_t sequence_;           /* of packet first_ */
+  int result_;
+  pthread_t thread_;
+  pthread_mutex_t mutex_;
+  pthread_cond_t cond_;
+};
+
+#endif
@@ -0,0 +1,496 @@
+/*
+ * Loopback throughput and latency benchmark.
+ *
+ * Runs RtpStream senders and receivers in this process over 127.0.0.1, no
+ * gstreamer or display needed. Every combination of resolution, frame rate,
+ * MTU and stream count is run for a few seconds and reports frames/s,
+ * Gbit/s, packets/s, CPU time per frame (sender and receiver together) and
+ * the p50/p99/p99.9 latency from the Transmit call to the receiver
+ * publishing the complete frame. Each frame carries its sequence number in
+ * its first bytes so the receiver can match it to its send time.
+ *
+ *   ./rtp-bench [-t seconds] [-r 480p,720p,1080p,2160p] [-f 30,60]
+ *               [-m 1500,9000] [-s 1,4] [-w workers] [-o results.json]
+ *               [-T trace.json] [-P interface] [-U] [-G] [-B bands]
+ *               [-L lanes] [-H]
+ *
+ * A frame rate of 0 sends unpaced as fast as the queue allows. -w sends
+ * through an RtpSession with that many workers instead of a thread per
+ * stream. -P receives through the AF_PACKET ring on interface (lo here),
+ * which needs CAP_NET_RAW. -U sends and receives through io_uring, -G with
+ * UDP_SEGMENT and UDP_GRO. -B sends every frame as that many bands, each
+ * on a thread of its own, -L receives on that many threads. -H puts the
+ * frame and packet buffers on huge pages. Results are printed as a table
+ * and written as JSON.
+ *
+ * Built with -DRTP_TRACE=ON the per stage latencies over all the runs are
+ * printed after the table, run one combination for clean numbers. -T also
+ * writes the first BENCH_TRACE_EVENTS stage events as a Chrome trace.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "rtp_stream.h"
+#include "rtp_session.h"
+
+#define BENCH_SECONDS         2
+#define BENCH_PORT            5400
+#define BENCH_BUFFERS         8         /* frames per stream the sender cycles through */
+#define BENCH_FRAMES          4096      /* send times remembered per stream */
+#define BENCH_RCVBUF          (64 * 1024 * 1024)
+#define BENCH_TRACE_EVENTS    1000000
+#define BENCH_DRAIN_MS        200       /* wait for the last frames after sending stops */
+
+typedef struct {
+  const char *name;
+  int width;
+  int height;
+} Resolution;
+
+static const Resolution resolutions[] = {
+  {"480p", 640, 480},
+  {"720p", 1280, 720},
+  {"1080p", 1920, 1080},
+  {"2160p", 3840, 2160},
+};
+
+typedef struct {
+  int width;
+  int height;
+  int fps;
+  int mtu;
+  int streams;
+  double seconds;
+  uint64_t sent;
+  uint64_t frames;
+  uint64_t partial;
+  uint64_t dropped;
+  uint64_t packets;
+  uint64_t lost;
+  uint64_t bytes;
+  double cpu;                   /* seconds of user and system time */
+  double p50, p99, p999, max;   /* latency in us */
+} Result;
+
+//
+// One sender and receiver pair. Latencies are written by the receive thread
+// and read once both ends have stopped.
+//
+typedef struct {
+  RtpStream *tx;
+  RtpStream *rx;
+  std::vector < char *>buffers;
+  std::atomic < bool > busy[BENCH_BUFFERS];
+  std::atomic < uint64_t > sent_at[BENCH_FRAMES];      /* by frame number */
+  std::vector < double >latency;
+  int frame_bytes;
+} Pair;
+
+static std::vector < const Resolution *>Resolutions(const char *list) {
+  std::vector < const Resolution *>out;
+  std::string names = std::string(",") + list + ",";
+
+  for (size_t c = 0; c < sizeof(resolutions) / sizeof(resolutions[0]); c++) {
+    if (names.find(std::string(",") + resolutions[c].name + ",") !=
+        std::string::npos)
+      out.push_back(&resolutions[c]);
+  }
+  return out;
+}
+
+static std::vector < int >Numbers(const char *list) {
+  std::vector < int >out;
+  char *copy = strdup(list);
+
+  for (char *s = strtok(copy, ","); s; s = strtok(NULL, ","))
+    out.push_back(atoi(s));
+  free(copy);
+  return out;
+}
+
+static double CpuSeconds() {
+  struct rusage usage;
+
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+    usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/* The sender is done with a buffer */
+static void Done(char *frame, void *user) {
+  Pair *pair = (Pair *) user;
+
+  for (int c = 0; c < BENCH_BUFFERS; c++) {
+    if (pair->buffers[c] == frame)
+      pair->busy[c] = false;
+  }
+}
+
+/* A complete frame arrived, match it to its send time */
+static void Arrived(char *frame, const FrameCoverage * coverage, void *user) {
+  Pair *pair = (Pair *) user;
+  uint64_t now = RtpPacer::Now();
+  uint32_t number;
+
+  if (coverage->complete < coverage->lines)
+    return;
+  memcpy(&number, frame, sizeof(number));
+  now -= pair->sent_at[number % BENCH_FRAMES];
+  pair->latency.push_back(now / 1e3);
+}
+
+static double Percentile(std::vector < double >&sorted, double p) {
+  if (sorted.empty())
+    return 0;
+  return sorted[std::min(sorted.size() - 1, (size_t) (p * sorted.size()))];
+}
+
+static bool Run(Result * result, int workers, const char *ring, bool uring,
+                bool offload, int bands, int lanes, bool hugepages) {
+  std::vector < Pair * >pairs;
+  RtpSession *session = workers ? new RtpSession(workers) : 0;
+  uint64_t period = result->fps ? 1000000000ULL / result->fps : 0;
+  uint64_t start, next, stop;
+  uint32_t number = 0;
+  double cpu;
+  bool ok = true;
+
+  for (int s = 0; s < result->streams; s++) {
+    Pair *pair = new Pair;
+    int rcvbuf = BENCH_RCVBUF;
+
+    pair->frame_bytes = result->width * result->height * 2;
+    for (int c = 0; c < BENCH_BUFFERS; c++) {
+      pair->buffers.push_back((char *) calloc(1, pair->frame_bytes));
+      pair->busy[c] = false;
+    }
+    pair->rx = new RtpStream(result->height, result->width);
+    pair->rx->SetFrameCallback(Arrived, pair);
+    if (ring)
+      pair->rx->SetPacketRing(true, ring);
+    if (uring)
+      pair->rx->SetIoBackend(IO_URING);
+    pair->rx->SetSegmentOffload(offload);
+    pair->rx->SetLanes(lanes);
+    pair->rx->SetMemory(hugepages);
+    pair->rx->RtpStreamIn((char *) "127.0.0.1", BENCH_PORT + s);
+    pair->tx = new RtpStream(result->height, result->width);
+    pair->tx->SetMtu(result->mtu);
+    pair->tx->SetPacing(result->fps, 0, false);
+    if (uring)
+      pair->tx->SetIoBackend(IO_URING);
+    pair->tx->SetSegmentOffload(offload);
+    pair->tx->SetBands(bands);
+    pair->tx->SetMemory(hugepages);
+    pair->tx->RtpStreamOut((char *) "127.0.0.1", BENCH_PORT + s);
+    if (session)
+      session->Add(pair->tx);
+    pairs.push_back(pair);
+    if (!pair->rx->Open()) {
+      ok = false;
+      break;
+    }
+    if (ring && !pair->rx->PacketRingActive()) {
+      fprintf(stderr, "ERROR no packet ring on %s\n", ring);
+      ok = false;
+      break;
+    }
+    if (uring && !ring && !pair->rx->UringReceiving()) {
+      fprintf(stderr, "ERROR io_uring not available\n");
+      ok = false;
+      break;
+    }
+    /* Loopback is faster than the default socket buffer drains */
+    for (int l = 0; l < pair->rx->Lanes(); l++) {
+      int sockfd = pair->rx->LaneSocket(l);
+
+#ifdef SO_RCVBUFFORCE
+      if (setsockopt(sockfd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf,
+                     sizeof(rcvbuf)) < 0)
+#endif
+        setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+  }
+  if (session && ok)
+    ok = session->Start();
+  for (size_t s = 0; ok && (s < pairs.size()); s++)
+    ok = pairs[s]->tx->Open();
+
+  cpu = CpuSeconds();
+  start = RtpPacer::Now();
+  stop = start + (uint64_t) (result->seconds * 1e9);
+  next = start;
+  while (ok && (RtpPacer::Now() < stop)) {
+    if (period) {
+      RtpPacer::Wait(next);
+      next += period;
+    }
+    for (size_t s = 0; s < pairs.size(); s++) {
+      Pair *pair = pairs[s];
+      int c;
+
+      /* Frame rate faster than the stream can go, skip this frame */
+      for (c = 0; c < BENCH_BUFFERS; c++) {
+        if (!pair->busy[c])
+          break;
+      }
+      if (c == BENCH_BUFFERS) {
+        result->dropped++;
+        continue;
+      }
+      pair->busy[c] = true;
+      memcpy(pair->buffers[c], &number, sizeof(number));
+      pair->sent_at[number % BENCH_FRAMES] = RtpPacer::Now();
+      pair->tx->TransmitZeroCopy(pair->buffers[c], Done, pair);
+      result->sent++;
+    }
+    number++;
+    if (!period) {
+      /* Unpaced, go again as soon as a buffer is back */
+      bool wait = true;
+
+      while (wait && (RtpPacer::Now() < stop)) {
+        wait = false;
+        for (size_t s = 0; s < pairs.size(); s++) {
+          int free = 0;
+
+          for (int c = 0; c < BENCH_BUFFERS; c++)
+            free += !pairs[s]->busy[c];
+          wait |= free == 0;
+        }
+        if (wait)
+          usleep(50);
+      }
+    }
+  }
+  result->seconds = (RtpPacer::Now() - start) / 1e9;
+
+  /* Let the senders drain, then give the receivers time for the last frames */
+  for (size_t s = 0; s < pairs.size(); s++)
+    pairs[s]->tx->Close();
+  usleep(BENCH_DRAIN_MS * 1000);
+  result->cpu = CpuSeconds() - cpu;
+
+  std::vector < double >latency;
+
+  for (size_t s = 0; s < pairs.size(); s++) {
+    Pair *pair = pairs[s];
+    RtpStatistics stats;
+
+    pair->rx->Close();
+    pair->rx->Statistics(&stats);
+    result->frames += stats.frames;
+    result->partial += stats.partial;
+    result->packets += stats.packets;
+    result->lost += stats.lost;
+    result->bytes += stats.bytes;
+    result->dropped += pair->tx->FramesDropped();
+    latency.insert(latency.end(), pair->latency.begin(), pair->latency.end());
+    delete pair->tx;
+    delete pair->rx;
+    for (int c = 0; c < BENCH_BUFFERS; c++)
+      free(pair->buffers[c]);
+    delete pair;
+  }
+  delete session;
+
+  std::sort(latency.begin(), latency.end());
+  result->p50 = Percentile(latency, 0.5);
+  result->p99 = Percentile(latency, 0.99);
+  result->p999 = Percentile(latency, 0.999);
+  result->max = latency.empty() ? 0 : latency.back();
+  return ok;
+}
+
+static void WriteJson(FILE * out, const std::vector < Result > &results,
+                      int workers, const char *ring, bool uring,
+                      bool offload, int bands, int lanes, bool hugepages) {
+  struct utsname host;
+
+  uname(&host);
+  fprintf(out, "{\n  \"benchmark\": \"rtp-bench\",\n");
+  fprintf(out, "  \"host\": {\"system\": \"%s\", \"release\": \"%s\", "
+          "\"machine\": \"%s\", \"cpus\": %ld},\n", host.sysname,
+          host.release, host.machine, sysconf(_SC_NPROCESSORS_ONLN));
+  fprintf(out, "  \"session_workers\": %d,\n", workers);
+  fprintf(out, "  \"receive\": \"%s\",\n", ring ? "packet ring" :
+          uring ? "io_uring" : "socket");
+  fprintf(out, "  \"send\": \"%s\",\n", uring ? "io_uring" : "sendmmsg");
+  fprintf(out, "  \"segment_offload\": %s,\n", offload ? "true" : "false");
+  fprintf(out, "  \"bands\": %d,\n", bands);
+  fprintf(out, "  \"lanes\": %d,\n", lanes);
+  fprintf(out, "  \"hugepages\": %s,\n  \"results\": [\n",
+          hugepages ? "true" : "false");
+  for (size_t c = 0; c < results.size(); c++) {
+    const Result *r = &results[c];
+
+    fprintf(out, "    {\"width\": %d, \"height\": %d, \"fps\": %d, "
+            "\"mtu\": %d, \"streams\": %d, \"seconds\": %.3f,\n", r->width,
+            r->height, r->fps, r->mtu, r->streams, r->seconds);
+    fprintf(out, "     \"frames_sent\": %llu, \"frames\": %llu, "
+            "\"partial_frames\": %llu, \"dropped_frames\": %llu, "
+            "\"packets\": %llu, \"lost_packets\": %llu,\n",
+            (unsigned long long) r->sent, (unsigned long long) r->frames,
+            (unsigned long long) r->partial, (unsigned long long) r->dropped,
+            (unsigned long long) r->packets, (unsigned long long) r->lost);
+    fprintf(out, "     \"frames_per_second\": %.2f, \"gbit_per_second\": %.4f, "
+            "\"packets_per_second\": %.0f, \"cpu_ms_per_frame\": %.4f,\n",
+            r->frames / r->seconds, r->bytes * 8 / r->seconds / 1e9,
+            r->packets / r->seconds,
+            r->frames ? r->cpu * 1e3 / r->frames : 0.0);
+    fprintf(out, "     \"latency_us\": {\"p50\": %.1f, \"p99\": %.1f, "
+            "\"p999\": %.1f, \"max\": %.1f}}%s\n", r->p50, r->p99, r->p999,
+            r->max, c + 1 < results.size() ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char **argv) {
+  std::vector < const Resolution *>sizes = Resolutions("480p,720p,1080p,2160p");
+  std::vector < int >rates = Numbers("30,60");
+  std::vector < int >mtus = Numbers("1500,9000");
+  std::vector < int >counts = Numbers("1,4");
+  std::vector < Result > results;
+  const char *json = "rtp-bench.json";
+  const char *trace = 0;
+  const char *ring = 0;
+  double seconds = BENCH_SECONDS;
+  int workers = 0;
+  bool uring = false;
+  bool offload = false;
+  int bands = 1;
+  int lanes = 1;
+  bool hugepages = false;
+  int opt;
+  FILE *out;
+
+  while ((opt = getopt(argc, argv, "t:r:f:m:s:w:o:T:P:UGB:L:H")) != -1) {
+    switch (opt) {
+    case 't':
+      seconds = atof(optarg);
+      break;
+    case 'r':
+      sizes = Resolutions(optarg);
+      break;
+    case 'f':
+      rates = Numbers(optarg);
+      break;
+    case 'm':
+      mtus = Numbers(optarg);
+      break;
+    case 's':
+      counts = Numbers(optarg);
+      break;
+    case 'w':
+      workers = atoi(optarg);
+      break;
+    case 'o':
+      json = optarg;
+      break;
+    case 'T':
+      trace = optarg;
+      break;
+    case 'P':
+      ring = optarg;
+      break;
+    case 'U':
+      uring = true;
+      break;
+    case 'G':
+      offload = true;
+      break;
+    case 'B':
+      bands = atoi(optarg);
+      break;
+    case 'L':
+      lanes = atoi(optarg);
+      break;
+    case 'H':
+      hugepages = true;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-t seconds] [-r 480p,720p,1080p,2160p] "
+              "[-f 30,60] [-m 1500,9000] [-s 1,4] [-w workers] "
+              "[-o results.json] [-T trace.json] [-P interface] [-U] [-G] "
+              "[-B bands] [-L lanes] [-H]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  /* Keep the library's own logging out of the table */
+  std::cout.setstate(std::ios::failbit);
+  if (trace)
+    RtpTrace::Capture(BENCH_TRACE_EVENTS);
+
+  printf("%-6s %4s %5s %3s %9s %8s %10s %8s %9s %9s %9s %6s %6s\n",
+         "size", "fps", "mtu", "n", "frames/s", "Gbit/s", "packets/s",
+         "cpu ms", "p50 us", "p99 us", "p999 us", "lost", "drop");
+  for (size_t r = 0; r < sizes.size(); r++) {
+    for (size_t f = 0; f < rates.size(); f++) {
+      for (size_t m = 0; m < mtus.size(); m++) {
+        for (size_t n = 0; n < counts.size(); n++) {
+          Result result;
+
+          memset(&result, 0, sizeof(result));
+          result.width = sizes[r]->width;
+          result.height = sizes[r]->height;
+          result.fps = rates[f];
+          result.mtu = mtus[m];
+          result.streams = counts[n];
+          result.seconds = seconds;
+          if (!Run(&result, workers, ring, uring, offload, bands, lanes,
+                   hugepages)) {
+            fprintf(stderr, "ERROR could not open streams for %s\n",
+                    sizes[r]->name);
+            return 1;
+          }
+          results.push_back(result);
+          printf("%-6s %4d %5d %3d %9.1f %8.3f %10.0f %8.3f %9.1f %9.1f "
+                 "%9.1f %6llu %6llu\n", sizes[r]->name, result.fps,
+                 result.mtu, result.streams, result.frames / result.seconds,
+                 result.bytes * 8 / result.seconds / 1e9,
+                 result.packets / result.seconds,
+                 result.frames ? result.cpu * 1e3 / result.frames : 0.0,
+                 result.p50, result.p99, result.p999,
+                 (unsigned long long) result.lost,
+                 (unsigned long long) result.dropped);
+          fflush(stdout);
+        }
+      }
+    }
+  }
+
+  if ((out = fopen(json, "w")) == NULL) {
+    fprintf(stderr, "ERROR writing %s\n", json);
+    return 1;
+  }
+  WriteJson(out, results, workers, ring, uring, offload, bands, lanes,
+            hugepages);
+  fclose(out);
+  printf("Results written to %s\n", json);
+
+  if (RtpTrace::Enabled()) {
+    printf("\n");
+    RtpTrace::Report(stdout);
+  }
+  if (trace) {
+    if (!RtpTrace::Enabled())
+      fprintf(stderr, "No trace without -DRTP_TRACE=ON\n");
+    else if (RtpTrace::WriteChrome(trace))
+      printf("Trace written to %s\n", trace);
+    else
+      fprintf(stderr, "ERROR writing %s\n", trace);
+  }
+  return 0;
+}
@@ -0,0 +1,396 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <iostream>
+#if !(__MINGW64__ || __MINGW32__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "rtp_capture.h"
+using namespace std;
+
+#define PCAP_MAGIC_US         0xa1b2c3d4
+#define PCAP_MAGIC_NS         0xa1b23c4d
+#define PCAP_HEADER_SIZE      24
+#define PCAP_RECORD_SIZE      16
+#define PCAP_LINK_ETHERNET    1
+#define PCAP_LINK_RAW         101
+#define PCAP_LINK_SLL         113       /* tcpdump -i any */
+#define PCAP_LINK_IPV4        228
+#define CAPTURE_IP_UDP        28        /* IPv4 and UDP headers written before each datagram */
+#define CAPTURE_UDP           17        /* IP protocol number */
+
+static void Put16(uint8_t *p, uint32_t value) {
+  p[0] = value >> 8;
+  p[1] = value;
+}
+
+static uint32_t Get16(const uint8_t *p) {
+  return (p[0] << 8) | p[1];
+}
+
+/* Header checksum of a 20 byte IPv4 header */
+static uint32_t IpChecksum(const uint8_t *ip) {
+  uint32_t sum = 0;
+
+  for (int c = 0; c < 20; c += 2)
+    sum += Get16(&ip[c]);
+  while (sum >> 16)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  return ~sum & 0xFFFF;
+}
+
+RtpRecorder::RtpRecorder() {
+  fd_ = -1;
+  map_ = 0;
+  map_offset_ = 0;
+  offset_ = 0;
+  packets_ = 0;
+  realtime_ = 0;
+  address_ = 0;
+  port_ = 0;
+  pthread_mutex_init(&mutex_, NULL);
+}
+
+RtpRecorder::~RtpRecorder() {
+  Close();
+  pthread_mutex_destroy(&mutex_);
+}
+
+#if !(__MINGW64__ || __MINGW32__)
+//
+// Create path and write the file header. address and port (host order) go
+// in the IP and UDP headers written in front of each datagram, the receive
+// path only has the payload.
+//
+bool RtpRecorder::Open(const char *path, uint32_t address, int port) {
+  uint32_t header[PCAP_HEADER_SIZE / 4];
+  struct timespec real, mono;
+
+  Close();
+  fd_ = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0) {
+    cout << "ERROR creating capture " << path << "\n";
+    return false;
+  }
+  offset_ = 0;
+  packets_ = 0;
+  address_ = address;
+  port_ = port;
+  if (!Map(0)) {
+    Close();
+    return false;
+  }
+
+  /* Written in our own byte order, readers swap by the magic */
+  header[0] = PCAP_MAGIC_NS;
+  header[1] = 2 | (4 << 16);    /* version 2.4 */
+  header[2] = 0;
+  header[3] = 0;
+  header[4] = RTP_CAPTURE_SNAPLEN;
+  header[5] = PCAP_LINK_RAW;
+  memcpy(map_, header, sizeof(header));
+  offset_ = sizeof(header);
+
+  /* Arrival times are CLOCK_MONOTONIC, the file wants wall clock time */
+  clock_gettime(CLOCK_REALTIME, &real);
+  clock_gettime(CLOCK_MONOTONIC, &mono);
+  realtime_ = ((int64_t) real.tv_sec - mono.tv_sec) * 1000000000 +
+    (real.tv_nsec - mono.tv_nsec);
+  return true;
+}
+
+//
+// Map the chunk of the file holding offset, growing the file to the end of
+// it. The previous chunk is unmapped and left for the kernel to write back.
+//
+bool RtpRecorder::Map(uint64_t offset) {
+  uint64_t start = offset & ~(uint64_t) (sysconf(_SC_PAGESIZE) - 1);
+  void *map;
+
+  if (map_)
+    munmap(map_, RTP_CAPTURE_CHUNK);
+  map_ = 0;
+  if (ftruncate(fd_, start + RTP_CAPTURE_CHUNK) < 0) {
+    cout << "ERROR growing capture file\n";
+    return false;
+  }
+  map = mmap(0, RTP_CAPTURE_CHUNK, PROT_READ | PROT_WRITE, MAP_SHARED, fd_,
+             start);
+  if (map == MAP_FAILED) {
+    cout << "ERROR mapping capture file\n";
+    return false;
+  }
+  map_ = (char *) map;
+  map_offset_ = start;
+  return true;
+}
+
+/* Truncate the file to what was written */
+void RtpRecorder::Close() {
+  pthread_mutex_lock(&mutex_);
+  if (map_)
+    munmap(map_, RTP_CAPTURE_CHUNK);
+  map_ = 0;
+  if (fd_ >= 0) {
+    if (ftruncate(fd_, offset_) < 0)
+      cout << "ERROR truncating capture file\n";
+    close(fd_);
+  }
+  fd_ = -1;
+  pthread_mutex_unlock(&mutex_);
+}
+
+//
+// Append one datagram received at now (RtpPacer::Now()). Called from every
+// receive thread of the stream, a failed write stops the recording.
+//
+void RtpRecorder::Write(const char *data, int len, uint64_t now) {
+  uint32_t record[PCAP_RECORD_SIZE / 4];
+  uint64_t time = now + realtime_;
+  uint8_t *p;
+  int size;
+
+  if (len > RTP_CAPTURE_SNAPLEN - CAPTURE_IP_UDP)
+    len = RTP_CAPTURE_SNAPLEN - CAPTURE_IP_UDP;
+  size = PCAP_RECORD_SIZE + CAPTURE_IP_UDP + len;
+
+  pthread_mutex_lock(&mutex_);
+  if (fd_ < 0) {
+    pthread_mutex_unlock(&mutex_);
+    return;
+  }
+  if ((offset_ + size > map_offset_ + RTP_CAPTURE_CHUNK) && !Map(offset_)) {
+    pthread_mutex_unlock(&mutex_);
+    Close();
+    return;
+  }
+  p = (uint8_t *) & map_[offset_ - map_offset_];
+
+  record[0] = time / 1000000000;
+  record[1] = time % 1000000000;
+  record[2] = CAPTURE_IP_UDP + len;
+  record[3] = CAPTURE_IP_UDP + len;
+  memcpy(p, record, sizeof(record));
+  p += sizeof(record);
+
+  memset(p, 0, CAPTURE_IP_UDP);
+  p[0] = 0x45;                  /* version 4, 20 byte header */
+  Put16(&p[2], CAPTURE_IP_UDP + len);
+  p[6] = 0x40;                  /* don't fragment */
+  p[8] = 64;                    /* TTL */
+  p[9] = CAPTURE_UDP;
+  Put16(&p[16], address_ >> 16);
+  Put16(&p[18], address_);
+  Put16(&p[10], IpChecksum(p));
+  Put16(&p[20], port_);
+  Put16(&p[22], port_);
+  Put16(&p[24], 8 + len);       /* no UDP checksum */
+  memcpy(&p[CAPTURE_IP_UDP], data, len);
+
+  offset_ += size;
+  packets_++;
+  pthread_mutex_unlock(&mutex_);
+}
+
+#else
+
+bool RtpRecorder::Open(const char *path, uint32_t address, int port) {
+  cout << "[RTP] Recording needs mmap()\n";
+  return false;
+}
+
+bool RtpRecorder::Map(uint64_t offset) {
+  return false;
+}
+
+void RtpRecorder::Close() {
+}
+
+void RtpRecorder::Write(const char *data, int len, uint64_t now) {
+}
+
+#endif
+
+RtpCapture::RtpCapture() {
+  map_ = 0;
+  size_ = 0;
+  offset_ = 0;
+  swapped_ = false;
+  scale_ = 1;
+  link_ = 0;
+  port_ = 0;
+  packets_ = 0;
+}
+
+RtpCapture::~RtpCapture() {
+  Close();
+}
+
+uint32_t RtpCapture::Read32(const uint8_t *p) {
+  uint32_t value;
+
+  memcpy(&value, p, sizeof(value));
+  return swapped_ ? __builtin_bswap32(value) : value;
+}
+
+#if !(__MINGW64__ || __MINGW32__)
+//
+// Map path for reading. port, if not 0, skips datagrams to any other UDP
+// port, for captures of more than one stream.
+//
+bool RtpCapture::Open(const char *path, int port) {
+  struct stat st;
+  uint32_t magic;
+  void *map;
+  int fd;
+
+  Close();
+  if ((fd = open(path, O_RDONLY)) < 0) {
+    cout << "ERROR opening capture " << path << "\n";
+    return false;
+  }
+  if ((fstat(fd, &st) < 0) || (st.st_size < PCAP_HEADER_SIZE)) {
+    cout << "ERROR " << path << " is not a pcap file\n";
+    close(fd);
+    return false;
+  }
+  map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    cout << "ERROR mapping capture " << path << "\n";
+    return false;
+  }
+  map_ = (const uint8_t *) map;
+  size_ = st.st_size;
+  madvise((void *) map_, size_, MADV_SEQUENTIAL);
+  madvise((void *) map_, size_, MADV_WILLNEED);
+
+  memcpy(&magic, map_, sizeof(magic));
+  swapped_ = (magic == __builtin_bswap32(PCAP_MAGIC_US)) ||
+    (magic == __builtin_bswap32(PCAP_MAGIC_NS));
+  magic = Read32(map_);
+  link_ = Read32(&map_[20]) & 0xFFFF;
+  if ((magic != PCAP_MAGIC_US) && (magic != PCAP_MAGIC_NS)) {
+    cout << "ERROR " << path << " is not a pcap file\n";
+    Close();
+    return false;
+  }
+  if ((link_ != PCAP_LINK_ETHERNET) && (link_ != PCAP_LINK_RAW) &&
+      (link_ != PCAP_LINK_SLL) && (link_ != PCAP_LINK_IPV4)) {
+    cout << "ERROR " << path << " has link type " << link_ <<
+      ", only Ethernet and IP captures are replayed\n";
+    Close();
+    return false;
+  }
+  scale_ = (magic == PCAP_MAGIC_NS) ? 1 : 1000;
+  port_ = port;
+  Rewind();
+  return true;
+}
+
+void RtpCapture::Close() {
+  if (map_)
+    munmap((void *) map_, size_);
+  map_ = 0;
+  size_ = 0;
+}
+
+#else
+
+bool RtpCapture::Open(const char *path, int port) {
+  cout << "[RTP] Replay needs mmap()\n";
+  return false;
+}
+
+void RtpCapture::Close() {
+}
+
+#endif
+
+void RtpCapture::Rewind() {
+  offset_ = PCAP_HEADER_SIZE;
+  packets_ = 0;
+}
+
+//
+// The UDP payload of a captured frame, 0 if it is not a whole unfragmented
+// IPv4 UDP datagram to port_.
+//
+const uint8_t *RtpCapture::Payload(const uint8_t *frame, uint32_t len,
+                                   uint32_t *size) {
+  const uint8_t *ip = frame;
+  uint32_t ihl, total, udp;
+
+  if (link_ == PCAP_LINK_ETHERNET) {
+    uint32_t type;
+
+    if (len < 14)
+      return 0;
+    type = Get16(&frame[12]);
+    ip = &frame[14];
+    /* One VLAN tag */
+    if ((type == 0x8100) && (len >= 18)) {
+      type = Get16(&frame[16]);
+      ip = &frame[18];
+    }
+    if (type != 0x0800)
+      return 0;
+  } else if (link_ == PCAP_LINK_SLL) {
+    if ((len < 16) || (Get16(&frame[14]) != 0x0800))
+      return 0;
+    ip = &frame[16];
+  }
+  len -= ip - frame;
+
+  if ((len < 28) || ((ip[0] >> 4) != 4) || (ip[9] != CAPTURE_UDP))
+    return 0;
+  /* More fragments or a fragment offset */
+  if (Get16(&ip[6]) & 0x3FFF)
+    return 0;
+  ihl = (ip[0] & 0xF) * 4;
+  total = Get16(&ip[2]);
+  if ((ihl < 20) || (total > len) || (ihl + 8 > total))
+    return 0;
+  udp = Get16(&ip[ihl + 4]);
+  if ((udp < 8) || (ihl + udp > total))
+    return 0;
+  if (port_ && ((int) Get16(&ip[ihl + 2]) != port_))
+    return 0;
+  *size = udp - 8;
+  return &ip[ihl + 8];
+}
+
+//
+// The next datagram's payload, pointing into the mapped file, and its capture
+// time in ns. Returns false at the end of the file.
+//
+bool RtpCapture::Next(struct iovec *packet, uint64_t *time) {
+  while (map_ && (offset_ + PCAP_RECORD_SIZE <= size_)) {
+    const uint8_t *record = &map_[offset_];
+    uint32_t captured = Read32(&record[8]);
+    uint32_t length = Read32(&record[12]);
+    const uint8_t *payload;
+    uint32_t size;
+
+    if (offset_ + PCAP_RECORD_SIZE + captured > size_)
+      break;
+    offset_ += PCAP_RECORD_SIZE + captured;
+
+    /* Cut short by the snap length, it can not be sent as it was */
+    if (captured < length)
+      continue;
+    payload = Payload(&record[PCAP_RECORD_SIZE], captured, &size);
+    if (!payload)
+      continue;
+    packet->iov_base = (void *) payload;
+    packet->iov_len = size;
+    *time = (uint64_t) Read32(record) * 1000000000 +
+      (uint64_t) Read32(&record[4]) * scale_;
+    packets_++;
+    return true;
+  }
+  return false;
+}
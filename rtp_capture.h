@@ -0,0 +1,72 @@
+/*
+ * Packet capture files of a stream's RTP traffic, to reproduce field problems
+ * offline. RtpRecorder writes every datagram the receive path sees, with its
+ * arrival time, to a pcap file (nanosecond timestamps, raw IPv4 link type) so
+ * wireshark and tcpdump read it. The file is grown and mapped a chunk at a
+ * time and packets are copied straight into the mapping, the kernel writes
+ * the chunks back as large sequential writes.
+ *
+ * RtpCapture maps a pcap file for reading and walks the UDP payloads in
+ * place. It also reads captures taken with tcpdump on Ethernet or the Linux
+ * "any" device, microsecond or nanosecond, either byte order. pcapng is not
+ * read, tcpdump -w and editcap -F pcap write the classic format.
+ */
+
+#ifndef __RTP_CAPTURE_H__
+#define __RTP_CAPTURE_H__
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#define RTP_CAPTURE_CHUNK     (64 * 1024 * 1024)        /* file grown and mapped this much at a time */
+#define RTP_CAPTURE_SNAPLEN   65535
+
+class RtpRecorder {
+public:
+  RtpRecorder();
+  ~RtpRecorder();
+  bool Open(const char *path, uint32_t address, int port);
+  void Close();
+  bool Active() { return fd_ >= 0; }
+  void Write(const char *data, int len, uint64_t now);
+  uint64_t Packets() { return packets_; }
+  uint64_t Bytes() { return offset_; }
+private:
+  bool Map(uint64_t offset);
+  int fd_;
+  char *map_;                   /* RTP_CAPTURE_CHUNK bytes of the file from map_offset_ */
+  uint64_t map_offset_;
+  uint64_t offset_;             /* bytes written */
+  uint64_t packets_;
+  int64_t realtime_;            /* CLOCK_REALTIME less CLOCK_MONOTONIC in ns */
+  uint32_t address_;            /* destination written in the IP header, host order */
+  int port_;
+  pthread_mutex_t mutex_;       /* lanes record at the same time */
+};
+
+class RtpCapture {
+public:
+  RtpCapture();
+  ~RtpCapture();
+  bool Open(const char *path, int port = 0);
+  void Close();
+  void Rewind();
+  bool Next(struct iovec *packet, uint64_t * time);
+  uint64_t Packets() { return packets_; }
+private:
+  uint32_t Read32(const uint8_t * p);
+  const uint8_t *Payload(const uint8_t * frame, uint32_t len,
+                         uint32_t * size);
+  const uint8_t *map_;
+  size_t size_;
+  size_t offset_;               /* next record */
+  bool swapped_;                /* written on a machine of the other byte order */
+  uint32_t scale_;              /* ns per timestamp fraction, 1 or 1000 */
+  uint32_t link_;
+  int port_;                    /* only datagrams to this port, 0 for any */
+  uint64_t packets_;            /* datagrams returned since Rewind() */
+};
+
+#endif
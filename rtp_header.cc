@@ -0,0 +1,45 @@
+#include "rtp_header.h"
+
+#define RTP_VERSION_BITS      0x80000000        /* version 2, no padding, extension or CSRCs */
+
+//
+// Serialise the fixed part of every packet header in the layout. Call again
+// whenever the layout changes.
+//
+void RtpHeaderBuilder::Build(RtpPacketizer * packetizer, uint8_t payload_type,
+                             uint32_t source) {
+  int packets = packetizer->Packets();
+  uint32_t ssrc = RtpNet32(source);
+
+  images_.clear();
+  for (int n = 0; n < packets; n++) {
+    const PacketLayout *layout = packetizer->Packet(n);
+    const LineSegment *segments = packetizer->Segments(layout);
+    size_t offset = images_.size();
+    uint32_t protocol = RTP_VERSION_BITS | ((payload_type & 0x7F) << 16);
+    uint8_t *image;
+
+    if (n == packets - 1)
+      protocol |= RTP_MARKER_BIT;
+    protocol = RtpNet32(protocol);
+
+    images_.resize(offset + RtpPacketizer::HeaderSize(layout->count), 0);
+    image = &images_[offset];
+    memcpy(&image[0], &protocol, sizeof(protocol));
+    memcpy(&image[8], &ssrc, sizeof(ssrc));
+    for (int c = 0; c < layout->count; c++) {
+      uint8_t *line = &image[RtpPacketizer::HeaderSize(c)];
+      uint16_t length = RtpNet16(segments[c].length);
+      uint16_t number = RtpNet16(segments[c].line & 0x7FFF);
+      uint16_t pixel = segments[c].offset & 0x7FFF;
+
+      /* Continuation bit, another line header follows this one */
+      if (c < layout->count - 1)
+        pixel |= 0x8000;
+      pixel = RtpNet16(pixel);
+      memcpy(&line[0], &length, sizeof(length));
+      memcpy(&line[2], &number, sizeof(number));
+      memcpy(&line[4], &pixel, sizeof(pixel));
+    }
+  }
+}
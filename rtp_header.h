@@ -0,0 +1,79 @@
+/*
+ * RTP/RFC 4175 header builder. Every header field that is fixed for the
+ * stream (version, payload type, SSRC, marker and all the line headers of
+ * the packet layout) is serialised once, in network byte order, when the
+ * stream is opened. Sending a packet copies its prebuilt header and patches
+ * only the sequence number and timestamp.
+ *
+ * Byte order is decided at compile time from __BYTE_ORDER__, so big endian
+ * hosts do no swapping at all and every little endian target (x86, 32 and
+ * 64 bit ARM) swaps.
+ */
+
+#ifndef __RTP_HEADER_H__
+#define __RTP_HEADER_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "rtp_packetizer.h"
+
+#define RTP_MARKER_BIT        0x00800000        /* in the first header word */
+
+template < bool BigEndian > struct RtpByteOrder;
+
+/* Host order is network order */
+template <> struct RtpByteOrder < true > {
+  static constexpr uint32_t Swap32(uint32_t x) { return x; }
+  static constexpr uint16_t Swap16(uint16_t x) { return x; }
+};
+
+template <> struct RtpByteOrder < false > {
+  static constexpr uint32_t Swap32(uint32_t x) { return __builtin_bswap32(x); }
+  static constexpr uint16_t Swap16(uint16_t x) {
+    return (uint16_t) ((x >> 8) | (x << 8));
+  }
+};
+
+typedef RtpByteOrder < __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__ > RtpNetwork;
+
+/* Host <-> network order, the same swap both ways */
+static inline constexpr uint32_t RtpNet32(uint32_t x) {
+  return RtpNetwork::Swap32(x);
+}
+
+static inline constexpr uint16_t RtpNet16(uint16_t x) {
+  return RtpNetwork::Swap16(x);
+}
+
+class RtpHeaderBuilder {
+public:
+  void Build(RtpPacketizer * packetizer, uint8_t payload_type,
+             uint32_t source);
+
+  //
+  // Write the header for packet n of the layout, returns the header size.
+  // The payload follows straight after.
+  //
+  int Write(char *packet, int n, const PacketLayout * layout,
+            uint32_t sequence, uint32_t timestamp) {
+    int size = RtpPacketizer::HeaderSize(layout->count);
+    uint16_t seq = RtpNet16(sequence & 0xFFFF);
+    uint16_t ext = RtpNet16(sequence >> 16);
+    uint32_t time = RtpNet32(timestamp);
+
+    memcpy(packet, &images_[Offset(n, layout)], size);
+    memcpy(&packet[2], &seq, sizeof(seq));
+    memcpy(&packet[4], &time, sizeof(time));
+    memcpy(&packet[12], &ext, sizeof(ext));
+    return size;
+  }
+private:
+  /* Images are packed back to back, 14 bytes per packet plus 6 per segment */
+  static int Offset(int n, const PacketLayout * layout) {
+    return n * RTP_HEADER_SIZE + layout->first * RTP_LINE_HEADER_SIZE;
+  }
+  std::vector < uint8_t > images_;
+};
+
+#endif
@@ -0,0 +1,160 @@
+#include <errno.h>
+#include <sched.h>
+#include <iostream>
+#if !(__MINGW64__ || __MINGW32__)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+#include "rtp_lane.h"
+using namespace std;
+
+void *LaneThread(void *data);
+
+RtpLane::RtpLane(RtpStream * stream, int index) {
+  stream_ = stream;
+  index_ = index;
+  sockfd_ = -1;
+  buffer_ = 0;
+  msgs_ = 0;
+  iov_ = 0;
+  running_ = false;
+  started_ = false;
+  memset(&track_, 0, sizeof(track_));
+  track_.stats = &stats_;
+}
+
+RtpLane::~RtpLane() {
+  Close();
+}
+
+#if !(__MINGW64__ || __MINGW32__)
+//
+// Socket, receive buffers and thread for the lane, once the stream's own
+// socket is bound so this one joins its SO_REUSEPORT group. cpu is the core
+// to run on or -1 for any.
+//
+bool RtpLane::Open(int cpu) {
+  struct sockaddr_in local;
+  struct timeval tv;
+  int window = stream_->rx_jitter_buffer_.Window();
+  int reuse = 1;
+
+  Close();
+  if ((sockfd_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+    cout << "ERROR opening socket\n";
+    return false;
+  }
+  memset(&local, 0, sizeof(local));
+  local.sin_family = AF_INET;
+  local.sin_addr.s_addr = htonl(INADDR_ANY);
+  local.sin_port = htons(stream_->port_no_in_);
+  if ((setsockopt(sockfd_, SOL_SOCKET, SO_REUSEPORT, &reuse,
+                  sizeof(reuse)) < 0) ||
+      (bind(sockfd_, (struct sockaddr *) &local, sizeof(local)) < 0)) {
+    cout << "ERROR binding lane " << index_ << "\n";
+    Close();
+    return false;
+  }
+
+  /* Wake up regularly to expire frames, as the stream's own thread does */
+  if (window < 1)
+    window = 1;
+  tv.tv_sec = window / 1000;
+  tv.tv_usec = (window % 1000) * 1000;
+  setsockopt(sockfd_, SOL_SOCKET, SO_RCVTIMEO, (char *) &tv, sizeof(tv));
+
+  buffer_ = FrameMemory::Allocate((size_t) RTP_BATCH_SIZE * MAX_UDP_DATA,
+                                  stream_->HugePages(),
+                                  stream_->MemoryNode(true, cpu));
+  msgs_ = (struct mmsghdr *) calloc(RTP_BATCH_SIZE, sizeof(struct mmsghdr));
+  iov_ = (struct iovec *) calloc(RTP_BATCH_SIZE, sizeof(struct iovec));
+  for (int c = 0; c < RTP_BATCH_SIZE; c++) {
+    iov_[c].iov_base = &buffer_[(size_t) c * MAX_UDP_DATA];
+    iov_[c].iov_len = MAX_UDP_DATA;
+    msgs_[c].msg_hdr.msg_iov = &iov_[c];
+    msgs_[c].msg_hdr.msg_iovlen = 1;
+  }
+
+  running_ = true;
+  if (pthread_create(&thread_, NULL, LaneThread, this) != 0) {
+    cout << "ERROR starting lane thread\n";
+    running_ = false;
+    Close();
+    return false;
+  }
+  started_ = true;
+#ifdef __linux__
+  if (cpu >= 0) {
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(thread_, sizeof(set), &set) != 0)
+      cout << "[RTP] Could not pin lane " << index_ << " to CPU " << cpu <<
+        "\n";
+  }
+#endif
+  return true;
+}
+
+void RtpLane::Run() {
+  while (running_) {
+    int n = recvmmsg(sockfd_, msgs_, RTP_BATCH_SIZE, MSG_WAITFORONE, NULL);
+    uint64_t now = RtpPacer::Now();
+
+    if (n < 0) {
+      if ((errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        stream_->rx_jitter_buffer_.Expire(now);
+        continue;
+      }
+      cout << "[RTP] Receive socket failure fd=" << sockfd_ << "\n";
+      break;
+    }
+    {
+      RTP_TRACE_SCOPE(TRACE_RX_DEPACKETIZE);
+
+      for (int c = 0; c < n; c++)
+        stream_->Depacketize((char *) iov_[c].iov_base, msgs_[c].msg_len,
+                             &track_, now);
+    }
+    stream_->rx_jitter_buffer_.Expire(now);
+  }
+}
+
+#else
+
+bool RtpLane::Open(int cpu) {
+  cout << "[RTP] Lanes need recvmmsg()\n";
+  return false;
+}
+
+void RtpLane::Run() {
+}
+
+#endif
+
+void RtpLane::Close() {
+  if (started_) {
+    /* Wake the lane out of recvmmsg() then wait for it */
+    running_ = false;
+    shutdown(sockfd_, SHUT_RDWR);
+    pthread_join(thread_, 0);
+    started_ = false;
+  }
+  if (sockfd_ >= 0) {
+    close(sockfd_);
+    sockfd_ = -1;
+  }
+  FrameMemory::Free(buffer_);
+  free(msgs_);
+  free(iov_);
+  buffer_ = 0;
+  msgs_ = 0;
+  iov_ = 0;
+}
+
+void *LaneThread(void *data) {
+  ((RtpLane *) data)->Run();
+  return 0;
+}
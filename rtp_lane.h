@@ -0,0 +1,45 @@
+/*
+ * One extra receive thread of an RtpStream. SetLanes(n) opens n sockets on
+ * the stream's port with SO_REUSEPORT, the stream's own receive thread is
+ * lane 0. A classic BPF program on the group has the kernel hand each packet
+ * to the lane at its RTP sequence number modulo n, so even a single sender
+ * is spread over every lane; without it the kernel spreads by sender address
+ * and port. Each lane depacketizes its packets straight into the shared frame
+ * buffers, the jitter buffer's atomic coverage bitmap decides when a frame is
+ * complete and no lock is taken per packet.
+ *
+ * Every lane counts the packets it sees, RtpStream::Statistics() merges them
+ * and works the loss out from the span of sequence numbers.
+ */
+
+#ifndef __RTP_LANE_H__
+#define __RTP_LANE_H__
+
+#include <pthread.h>
+#include <atomic>
+#include "rtp_stream.h"
+
+class RtpLane {
+public:
+  RtpLane(RtpStream * stream, int index);
+  ~RtpLane();
+  bool Open(int cpu);
+  void Close();
+  void Run();
+  RtpStatsCounters *Stats() { return &stats_; }
+  int Socket() { return sockfd_; }
+private:
+  RtpStream *stream_;
+  int index_;
+  int sockfd_;
+  char *buffer_;                /* RTP_BATCH_SIZE packets of MAX_UDP_DATA bytes */
+  struct mmsghdr *msgs_;
+  struct iovec *iov_;
+  RtpStatsCounters stats_;
+  RxTrack track_;
+  std::atomic < bool > running_;
+  bool started_;                /* thread created */
+  pthread_t thread_;
+};
+
+#endif
@@ -0,0 +1,159 @@
+#include <errno.h>
+#include <time.h>
+#include <iostream>
+#if __MINGW64__ || __MINGW32__
+#include <winsock2.h>
+#else
+#include <sys/socket.h>
+#endif
+#ifdef __linux__
+#include <linux/net_tstamp.h>
+#endif
+#include "rtp_pacer.h"
+using namespace std;
+
+RtpPacer::RtpPacer() {
+  period_ns_ = 0;
+  max_bitrate_ = 0;
+  kernel_ = false;
+  next_frame_ns_ = 0;
+  frame_start_ns_ = 0;
+  ns_per_byte_ = 0;
+  tat_ = 0;
+  tau_ = 0;
+}
+
+//
+// framerate of 0 disables frame pacing, max_bitrate of 0 removes the ceiling.
+// kernel asks for SO_TXTIME/SO_MAX_PACING_RATE, see KernelPacing().
+//
+void RtpPacer::Configure(int framerate, uint64_t max_bitrate, bool kernel) {
+  period_ns_ = framerate ? 1000000000ULL / framerate : 0;
+  max_bitrate_ = max_bitrate;
+  kernel_ = kernel;
+  next_frame_ns_ = 0;
+  tat_ = 0;
+}
+
+//
+// Try to hand pacing to the kernel. Needs the fq (or etf) qdisc on the egress
+// interface to take effect, i.e. "tc qdisc replace dev eth0 root fq", with
+// any other qdisc the kernel accepts the option and ignores the launch times.
+// Returns false and falls back to user space pacing if the socket options are
+// not supported.
+//
+bool RtpPacer::KernelPacing(int sockfd) {
+  if (!kernel_)
+    return false;
+#if defined(SO_TXTIME) && defined(SO_MAX_PACING_RATE)
+  struct sock_txtime txtime;
+
+  txtime.clockid = CLOCK_MONOTONIC;
+  txtime.flags = 0;
+  if (setsockopt(sockfd, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) < 0) {
+    cout << "[RTP] SO_TXTIME not supported, pacing in user space\n";
+    kernel_ = false;
+    return false;
+  }
+  if (max_bitrate_) {
+    uint64_t rate = max_bitrate_ / 8;   /* bytes per second */
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_MAX_PACING_RATE, &rate,
+                   sizeof(rate)) < 0)
+      cout << "[RTP] SO_MAX_PACING_RATE not supported\n";
+  }
+  return true;
+#else
+  kernel_ = false;
+  return false;
+#endif
+}
+
+//
+// A pacer for one of parts senders of the same frames, e.g. the bands of a
+// stream. Each gets the frame period for its share and the bitrate ceiling
+// is split between them. Always paces in user space.
+//
+RtpPacer RtpPacer::Share(int parts) {
+  RtpPacer pacer;
+
+  pacer.period_ns_ = period_ns_;
+  pacer.max_bitrate_ = parts > 1 ? max_bitrate_ / parts : max_bitrate_;
+  return pacer;
+}
+
+uint64_t RtpPacer::Now() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//
+// Sleep until close to the deadline then spin the rest of the way, sleeping
+// alone overshoots by the timer slack which is longer than a packet time.
+//
+void RtpPacer::Wait(uint64_t when) {
+  uint64_t now = Now();
+
+  if (when > now + RTP_PACING_SPIN_NS) {
+    struct timespec ts;
+    uint64_t wake = when - RTP_PACING_SPIN_NS;
+
+    ts.tv_sec = wake / 1000000000ULL;
+    ts.tv_nsec = wake % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+  }
+  while (Now() < when);
+}
+
+//
+// Start a new frame of frame_bytes on the wire. Frames start on period
+// boundaries, a late frame starts immediately and resynchronises the
+// schedule. burst_bytes is the bucket depth.
+//
+void RtpPacer::StartFrame(int frame_bytes, int burst_bytes) {
+  uint64_t now = Now();
+  double floor = 0;
+
+  if (period_ns_) {
+    if (next_frame_ns_ < now)
+      next_frame_ns_ = now;
+    frame_start_ns_ = next_frame_ns_;
+    next_frame_ns_ += period_ns_;
+    ns_per_byte_ = (period_ns_ * RTP_PACING_FILL) / frame_bytes;
+  } else {
+    frame_start_ns_ = now;
+    ns_per_byte_ = 0;
+  }
+
+  /* Bitrate ceiling, never go faster than this even if the frame runs late */
+  if (max_bitrate_)
+    floor = 8e9 / max_bitrate_;
+  if (ns_per_byte_ < floor)
+    ns_per_byte_ = floor;
+
+  tau_ = burst_bytes * ns_per_byte_;
+  if (tat_ < frame_start_ns_)
+    tat_ = frame_start_ns_;
+}
+
+/* When the next bytes booked could be sent at the earliest, or earlier */
+uint64_t RtpPacer::Due() {
+  return tat_ > tau_ ? tat_ - tau_ : 0;
+}
+
+//
+// Book bytes into the bucket and return the time they may be sent
+//
+uint64_t RtpPacer::Schedule(int bytes) {
+  uint64_t now = Now();
+  uint64_t launch = tat_ > tau_ ? tat_ - tau_ : 0;
+
+  if (launch < now)
+    launch = now;
+  if (tat_ < launch)
+    tat_ = launch;
+  tat_ += (uint64_t) (bytes * ns_per_byte_);
+  return launch;
+}
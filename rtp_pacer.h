@@ -0,0 +1,45 @@
+/*
+ * Token bucket packet pacer. Spreads the packets of a frame evenly over the
+ * frame period (SMPTE 2110-21 style narrow sender) and optionally caps the
+ * stream bitrate. The bucket is implemented as a GCRA virtual schedule on
+ * CLOCK_MONOTONIC so the same launch times can either be waited for in user
+ * space or handed to the kernel with SO_TXTIME.
+ */
+
+#ifndef __RTP_PACER_H__
+#define __RTP_PACER_H__
+
+#include <stdint.h>
+
+#define RTP_PACING_BURST      4         /* packets per sendmmsg() when pacing */
+#define RTP_PACING_FILL       0.9       /* fraction of the frame period used for sending */
+#define RTP_PACING_SPIN_NS    50000     /* spin for the last 50us instead of sleeping */
+#define RTP_PACING_AHEAD_NS   50000     /* SO_TXTIME packets go to the kernel at most this early */
+
+class RtpPacer {
+public:
+  RtpPacer();
+  void Configure(int framerate, uint64_t max_bitrate, bool kernel);
+  bool Enabled() { return (period_ns_ != 0) || (max_bitrate_ != 0); }
+  bool Kernel() { return kernel_; }
+  bool KernelPacing(int sockfd);
+  uint64_t MaxBitrate() { return max_bitrate_; }
+  RtpPacer Share(int parts);
+  void StartFrame(int frame_bytes, int burst_bytes);
+  uint64_t Schedule(int bytes);
+  uint64_t Due();
+  uint64_t FrameStart() { return frame_start_ns_; }
+  static uint64_t Now();
+  static void Wait(uint64_t when);
+private:
+  uint64_t period_ns_;          /* 0 means no frame pacing */
+  uint64_t max_bitrate_;        /* bits per second, 0 means no ceiling */
+  bool kernel_;                 /* launch times passed to the kernel via SO_TXTIME */
+  uint64_t next_frame_ns_;
+  uint64_t frame_start_ns_;
+  double ns_per_byte_;
+  uint64_t tat_;                /* theoretical arrival time of the next byte */
+  uint64_t tau_;                /* burst tolerance in ns */
+};
+
+#endif
@@ -0,0 +1,98 @@
+#include <algorithm>
+#include "rtp_stream.h"
+#include "rtp_packetizer.h"
+
+RtpPacketizer::RtpPacketizer() {
+  frame_bytes_ = 0;
+  VideoFormatInit(&format_, SAMPLING_YCBCR_422, 8);
+}
+
+/* Sampling and depth of the frames, call before Layout() */
+void RtpPacketizer::SetFormat(const VideoFormat * format) {
+  format_ = *format;
+}
+
+//
+// Pack as many full or partial scanlines into each packet as the MTU allows.
+// Segments are always a whole number of pixel groups, a line that does not fit
+// is split and continued in the next packet. Returns the number of packets.
+// A 4:2:0 row is a pair of lines, numbered by the first.
+//
+// With a row map (one byte per row, 0 to leave the row out) only the rows
+// marked are sent. A packet never spans a row that is left out, so the
+// payload of every packet is still one run of the frame. If no row is marked
+// one pixel group of the last row is sent, so the frame still has a marker.
+//
+int RtpPacketizer::Layout(int height, int width, int mtu,
+                          const uint8_t * lines) {
+  int max = mtu - RTP_IP_UDP_HEADER - RTP_HEADER_SIZE;
+  int rows = VideoRows(&format_, height);
+  int row_bytes = VideoHostRowBytes(&format_, width);
+  int row = 0;
+  int offset = 0;
+
+  packets_.clear();
+  segments_.clear();
+  frame_bytes_ = 0;
+  if (max < RTP_LINE_HEADER_SIZE + format_.pgroup)
+    return 0;
+
+  while (row < rows) {
+    PacketLayout packet;
+    int left = max;
+
+    if (lines && !lines[row]) {
+      row++;
+      continue;
+    }
+
+    packet.first = segments_.size();
+    packet.count = 0;
+    packet.frame_offset = row * row_bytes + offset / format_.xinc * format_.host;
+
+    while ((row < rows) && (!lines || lines[row]) &&
+           (packet.count < NUM_LINES_PER_PACKET)) {
+      LineSegment segment;
+      int room = left - RTP_LINE_HEADER_SIZE;
+      int remaining = (width - offset) / format_.xinc * format_.pgroup;
+
+      room -= room % format_.pgroup;
+      if (room < format_.pgroup)
+        break;
+
+      segment.line = row * format_.yinc;
+      segment.offset = offset;
+      segment.length = std::min(room, remaining);
+      segments_.push_back(segment);
+      packet.count++;
+
+      left -= RTP_LINE_HEADER_SIZE + segment.length;
+      offset += segment.length / format_.pgroup * format_.xinc;
+      if (offset >= width) {
+        row++;
+        offset = 0;
+      }
+    }
+    packet.size = RTP_HEADER_SIZE + max - left;
+    packets_.push_back(packet);
+    frame_bytes_ += RTP_IP_UDP_HEADER + packet.size;
+  }
+
+  if (packets_.empty() && (rows > 0) && (width >= format_.xinc)) {
+    PacketLayout packet;
+    LineSegment segment;
+
+    segment.line = (rows - 1) * format_.yinc;
+    segment.offset = 0;
+    segment.length = format_.pgroup;
+    segments_.push_back(segment);
+    packet.first = 0;
+    packet.count = 1;
+    packet.size = HeaderSize(1) + format_.pgroup;
+    packet.frame_offset = (rows - 1) * row_bytes;
+    packets_.push_back(packet);
+    frame_bytes_ += RTP_IP_UDP_HEADER + packet.size;
+  }
+
+  return packets_.size();
+}
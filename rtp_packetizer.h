@@ -0,0 +1,60 @@
+/*
+ * RFC 4175 packetizer. Works out, once per stream, how a frame is split into
+ * datagrams no larger than the MTU. Each datagram carries one or more line
+ * segments (full or partial scanlines) described by a LineSegment. Partial
+ * lines continue in the next packet at the pixel offset given in the segment.
+ * The pixel group size comes from the stream's VideoFormat, YCbCr-4:2:2 8
+ * bit unless set.
+ */
+
+#ifndef __RTP_PACKETIZER_H__
+#define __RTP_PACKETIZER_H__
+
+#include <stdint.h>
+#include <vector>
+#include "video_format.h"
+
+#define RTP_DEFAULT_MTU       1500      /* Standard ethernet */
+#define RTP_MAX_MTU           9000      /* Jumbo frames */
+#define RTP_IP_UDP_HEADER     28        /* IPv4 (20) + UDP (8) header bytes */
+#define RTP_HEADER_SIZE       14        /* 12 byte RTP header + 2 byte extended sequence number */
+#define RTP_LINE_HEADER_SIZE  6         /* length, line number and offset */
+#define PGROUP_SIZE           4         /* YCbCr-4:2:2 8 bit, bytes per pixel group */
+#define PGROUP_PIXELS         2         /* pixels per pixel group */
+
+typedef struct {
+  uint16_t line;                /* scanline number */
+  uint16_t offset;              /* offset in pixels from the start of the line */
+  uint16_t length;              /* length of the segment in bytes */
+} LineSegment;
+
+typedef struct {
+  uint32_t first;               /* index of the first segment in the packet */
+  uint16_t count;               /* number of line segments in the packet */
+  uint16_t size;                /* datagram size, headers included */
+  uint32_t frame_offset;        /* byte offset of the first payload pgroup in the frame in memory */
+} PacketLayout;
+
+class RtpPacketizer {
+public:
+  RtpPacketizer();
+  void SetFormat(const VideoFormat * format);
+  const VideoFormat *Format() { return &format_; }
+  int Layout(int height, int width, int mtu, const uint8_t * lines = 0);
+  int Packets() { return packets_.size(); }
+  int FrameBytes() { return frame_bytes_; }
+  const PacketLayout *Packet(int n) { return &packets_[n]; }
+  const LineSegment *Segments(const PacketLayout *packet) {
+    return &segments_[packet->first];
+  }
+  static int HeaderSize(int count) {
+    return RTP_HEADER_SIZE + (count * RTP_LINE_HEADER_SIZE);
+  }
+private:
+  VideoFormat format_;
+  std::vector<PacketLayout> packets_;
+  std::vector<LineSegment> segments_;
+  int frame_bytes_;             /* bytes on the wire per frame, IP/UDP included */
+};
+
+#endif
@@ -0,0 +1,332 @@
+/*
+ * Record a stream to a pcap file and replay it, a repeatable load generator
+ * for reproducing field problems without cameras or gstreamer.
+ *
+ *   ./rtp-replay -w capture.pcap [-a address] [-p port] [-s 1920x1080]
+ *                [-t seconds] [-i interface] [-U]
+ *   ./rtp-replay [-d host] [-p port] [-x speed | -R] [-l loops]
+ *                [-f port] [-i interface] [-U] capture.pcap
+ *
+ * -w receives on port (a multicast group if address is one) for seconds, 0
+ * until interrupted, and records every datagram the receive path sees. The
+ * frame size only matters for the receive statistics printed at the end.
+ *
+ * Otherwise the capture is mapped and sent to host:port through the stream's
+ * transmit path at its original timing, -x times faster (or slower below 1),
+ * or -R as fast as the socket takes it. Captures from tcpdump work too, -f
+ * keeps only the datagrams to one UDP port. -l plays it that many times, 0
+ * for ever, moving the RTP sequence numbers and timestamps on each time so a
+ * receiver sees one continuous stream; that assumes one stream in the file.
+ * -U sends or receives through io_uring.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <iostream>
+#include <vector>
+#include "rtp_stream.h"
+
+#define REPLAY_PORT           5004
+#define REPLAY_GROUP_NS       20000     /* packets due this close together go in one batch */
+#define REPLAY_START_NS       10000000  /* first packet after 10ms, once everything is set up */
+#define REPLAY_HEADER         14        /* RTP header and extended sequence number */
+
+static std::atomic < bool > stopped(false);
+
+static void Stop(int) {
+  stopped = true;
+}
+
+static uint32_t Get32(const uint8_t *p) {
+  return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void Put32(uint8_t *p, uint32_t value) {
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
+
+/* RFC 4175 extended sequence number of an RTP packet */
+static uint32_t Sequence(const uint8_t *packet) {
+  return ((uint32_t) packet[12] << 24) | (packet[13] << 16) |
+    (packet[2] << 8) | packet[3];
+}
+
+static int Record(const char *path, const char *address, int port, int width,
+                  int height, double seconds, bool uring,
+                  const char *interface) {
+  RtpStream rx(height, width);
+  RtpStatistics stats;
+  uint64_t end;
+
+  rx.RtpStreamIn((char *) address, port);
+  if (interface)
+    rx.SetMulticast(interface);
+  if (uring)
+    rx.SetIoBackend(IO_URING);
+  if (!rx.Record(path) || !rx.Open())
+    return 1;
+
+  end = RtpPacer::Now() + (uint64_t) (seconds * 1e9);
+  while (!stopped && ((seconds <= 0) || (RtpPacer::Now() < end)))
+    usleep(100000);
+
+  rx.Statistics(&stats);
+  printf("recorded %llu packets, %llu frames %llu partial, %llu lost\n",
+         (unsigned long long) rx.PacketsRecorded(),
+         (unsigned long long) stats.frames,
+         (unsigned long long) stats.partial, (unsigned long long) stats.lost);
+  rx.Close();
+  return 0;
+}
+
+//
+// One pass over the capture, sending each batch when its first packet is
+// due. Packets are sent from the mapping, only the header is copied when it
+// has to be moved on for a later loop.
+//
+static bool Play(RtpStream * tx, RtpCapture * capture, double speed,
+                 uint64_t start, uint32_t sequence, uint32_t timestamp,
+                 uint64_t * packets, uint64_t * bytes, uint64_t * lag) {
+  std::vector < struct iovec >iov((RTP_BATCH_SIZE + 1) * 2);
+  std::vector < uint8_t > headers((RTP_BATCH_SIZE + 1) * REPLAY_HEADER);
+  struct iovec packet;
+  uint64_t first = 0;
+  uint64_t due = 0;
+  uint64_t batch_due = 0;
+  uint64_t time;
+  int n = 0;
+
+  capture->Rewind();
+  while (!stopped) {
+    bool more = capture->Next(&packet, &time);
+
+    if (more) {
+      if (capture->Packets() == 1)
+        first = time;
+      due = start;
+      if (speed > 0)
+        due += (uint64_t) ((time - first) / speed);
+    }
+
+    /* Send the batch when full, at the end or when the next is due later */
+    if (n && (!more || (n == RTP_BATCH_SIZE) ||
+              (due > batch_due + REPLAY_GROUP_NS))) {
+      uint64_t now;
+
+      if (speed > 0)
+        RtpPacer::Wait(batch_due);
+      now = RtpPacer::Now();
+      if ((speed > 0) && (now - batch_due > *lag) && (now > batch_due))
+        *lag = now - batch_due;
+      if (tx->SendPackets(&iov[0], n, 2) < 0)
+        return false;
+      *packets += n;
+      n = 0;
+    }
+    if (!more)
+      break;
+    if (n == 0)
+      batch_due = due;
+
+    //
+    // The first part is the header, moved on for loops after the first, the
+    // second the rest of the packet straight from the file
+    //
+    {
+      uint8_t *header = &headers[n * REPLAY_HEADER];
+      const uint8_t *data = (const uint8_t *) packet.iov_base;
+      size_t split = 0;
+
+      if ((packet.iov_len >= REPLAY_HEADER) && ((data[0] >> 6) == 2) &&
+          (sequence || timestamp)) {
+        uint32_t seq = Sequence(data) + sequence;
+
+        memcpy(header, data, REPLAY_HEADER);
+        header[2] = seq >> 8;
+        header[3] = seq;
+        header[12] = seq >> 24;
+        header[13] = seq >> 16;
+        Put32(&header[4], Get32(&data[4]) + timestamp);
+        split = REPLAY_HEADER;
+      }
+      iov[n * 2].iov_base = header;
+      iov[n * 2].iov_len = split;
+      iov[n * 2 + 1].iov_base = (char *) packet.iov_base + split;
+      iov[n * 2 + 1].iov_len = packet.iov_len - split;
+    }
+    *bytes += packet.iov_len;
+    n++;
+  }
+  return true;
+}
+
+//
+// How far one pass moves the sequence numbers and timestamps on: the span
+// of the capture plus one packet, and one frame period.
+//
+static void Span(RtpCapture * capture, uint32_t * sequence,
+                 uint32_t * timestamp) {
+  struct iovec packet;
+  uint64_t time;
+  uint32_t first_seq = 0, last_seq = 0;
+  uint32_t first_ts = 0, last_ts = 0, step = 0;
+  bool any = false;
+
+  capture->Rewind();
+  while (capture->Next(&packet, &time)) {
+    const uint8_t *data = (const uint8_t *) packet.iov_base;
+    uint32_t ts;
+
+    if ((packet.iov_len < REPLAY_HEADER) || ((data[0] >> 6) != 2))
+      continue;
+    ts = Get32(&data[4]);
+    if (!any) {
+      first_seq = Sequence(data);
+      last_seq = first_seq;
+      first_ts = ts;
+      last_ts = ts;
+      any = true;
+    }
+    if ((int32_t) (Sequence(data) - last_seq) > 0)
+      last_seq = Sequence(data);
+    if ((int32_t) (ts - last_ts) > 0) {
+      step = ts - last_ts;
+      last_ts = ts;
+    }
+  }
+  *sequence = last_seq - first_seq + 1;
+  *timestamp = last_ts - first_ts + (step ? step : Hz90 / RTP_FRAMERATE);
+}
+
+static int Replay(const char *path, const char *host, int port, int filter,
+                  double speed, int loops, bool uring,
+                  const char *interface) {
+  RtpStream tx(1080, 1920);
+  RtpCapture capture;
+  uint32_t sequence = 0, timestamp = 0;
+  uint32_t span_sequence, span_timestamp;
+  uint64_t packets = 0, bytes = 0, lag = 0;
+  uint64_t started;
+  int loop;
+
+  if (!capture.Open(path, filter))
+    return 1;
+  Span(&capture, &span_sequence, &span_timestamp);
+  tx.RtpStreamOut((char *) host, port);
+  if (interface)
+    tx.SetMulticast(interface, 1, true);
+  if (uring)
+    tx.SetIoBackend(IO_URING);
+  if (!tx.Open())
+    return 1;
+
+  started = RtpPacer::Now();
+  for (loop = 0; !stopped && ((loops <= 0) || (loop < loops)); loop++) {
+    if (!Play(&tx, &capture, speed, RtpPacer::Now() + REPLAY_START_NS,
+              sequence, timestamp, &packets, &bytes, &lag))
+      break;
+    if (!capture.Packets()) {
+      fprintf(stderr, "ERROR no UDP datagrams in %s\n", path);
+      tx.Close();
+      return 1;
+    }
+    sequence += span_sequence;
+    timestamp += span_timestamp;
+  }
+
+  {
+    double seconds = (RtpPacer::Now() - started) / 1e9;
+
+    printf("replayed %llu packets in %d loops, %.3f s, %.3f Gbit/s, "
+           "%.0f packets/s, %.1f us behind at worst\n",
+           (unsigned long long) packets, loop, seconds,
+           bytes * 8 / seconds / 1e9, packets / seconds, lag / 1e3);
+  }
+  tx.Close();
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *record = 0;
+  const char *address = "0.0.0.0";
+  const char *host = "127.0.0.1";
+  const char *interface = 0;
+  int port = REPLAY_PORT;
+  int filter = 0;
+  int width = 1920, height = 1080;
+  double seconds = 0;
+  double speed = 1;
+  int loops = 1;
+  bool uring = false;
+  bool usage = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "w:a:p:s:t:d:x:Rl:f:i:U")) != -1) {
+    switch (opt) {
+    case 'w':
+      record = optarg;
+      break;
+    case 'a':
+      address = optarg;
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 's':
+      if (sscanf(optarg, "%dx%d", &width, &height) != 2) {
+        fprintf(stderr, "ERROR size is WIDTHxHEIGHT\n");
+        return 1;
+      }
+      break;
+    case 't':
+      seconds = atof(optarg);
+      break;
+    case 'd':
+      host = optarg;
+      break;
+    case 'x':
+      speed = atof(optarg);
+      break;
+    case 'R':
+      speed = 0;
+      break;
+    case 'l':
+      loops = atoi(optarg);
+      break;
+    case 'f':
+      filter = atoi(optarg);
+      break;
+    case 'i':
+      interface = optarg;
+      break;
+    case 'U':
+      uring = true;
+      break;
+    default:
+      usage = true;
+      break;
+    }
+  }
+  if (usage || (!record && (optind != argc - 1))) {
+    fprintf(stderr, "usage: %s -w capture.pcap [-a address] [-p port] "
+            "[-s 1920x1080] [-t seconds] [-i interface] [-U]\n"
+            "       %s [-d host] [-p port] [-x speed | -R] [-l loops] "
+            "[-f port] [-i interface] [-U] capture.pcap\n", argv[0], argv[0]);
+    return 1;
+  }
+
+  signal(SIGINT, Stop);
+  signal(SIGTERM, Stop);
+  if (record)
+    return Record(record, address, port, width, height, seconds, uring,
+                  interface);
+  return Replay(argv[optind], host, port, filter, speed, loops, uring,
+                interface);
+}
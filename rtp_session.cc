@@ -0,0 +1,192 @@
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
+#include <iostream>
+#include <algorithm>
+#include "rtp_session.h"
+using namespace std;
+
+void *SessionWorker(void *data);
+
+RtpSession::RtpSession(int workers) {
+  pthread_condattr_t attr;
+
+  workers_ = workers < 1 ? 1 : workers;
+  cursor_ = 0;
+  running_ = false;
+  pthread_mutex_init(&mutex_, NULL);
+
+  /* Workers sleep until the next paced burst on the monotonic clock */
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&cond_, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_cond_init(&idle_, NULL);
+}
+
+RtpSession::~RtpSession() {
+  Stop();
+  pthread_cond_destroy(&cond_);
+  pthread_cond_destroy(&idle_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+/* Pin the workers to these CPUs, worker n to cpus[n % size]. Call before Start() */
+void RtpSession::SetAffinity(const std::vector < int >&cpus) {
+  cpus_ = cpus;
+}
+
+/* Send stream through this session, call before the stream is opened */
+void RtpSession::Add(RtpStream * stream) {
+  stream->session_ = this;
+}
+
+bool RtpSession::Start() {
+  if (running_)
+    return true;
+  running_ = true;
+  for (int c = 0; c < workers_; c++) {
+    pthread_t thread;
+
+    if (pthread_create(&thread, NULL, SessionWorker, this) != 0) {
+      cout << "ERROR starting session worker\n";
+      Stop();
+      return false;
+    }
+    threads_.push_back(thread);
+#ifdef __linux__
+    if (!cpus_.empty()) {
+      cpu_set_t set;
+
+      CPU_ZERO(&set);
+      CPU_SET(cpus_[c % cpus_.size()], &set);
+      if (pthread_setaffinity_np(thread, sizeof(set), &set) != 0)
+        cout << "[RTP] Could not pin session worker to CPU " <<
+          cpus_[c % cpus_.size()] << "\n";
+    }
+#endif
+  }
+  cout << "[RTP] Session started with " << workers_ << " workers\n";
+  return true;
+}
+
+//
+// Send everything already queued then stop the workers. Streams still open
+// stop accepting frames and must be closed before the session is destroyed.
+//
+void RtpSession::Stop() {
+  pthread_mutex_lock(&mutex_);
+  for (size_t c = 0; c < streams_.size(); c++)
+    WaitIdle(streams_[c]);
+  running_ = false;
+  pthread_cond_broadcast(&cond_);
+  pthread_cond_broadcast(&idle_);
+  pthread_mutex_unlock(&mutex_);
+
+  for (size_t c = 0; c < threads_.size(); c++)
+    pthread_join(threads_[c], 0);
+  threads_.clear();
+
+  for (size_t c = 0; c < streams_.size(); c++) {
+    streams_[c]->tx_running_ = false;
+    streams_[c]->session_ = 0;
+  }
+  streams_.clear();
+}
+
+void RtpSession::Attach(RtpStream * stream) {
+  pthread_mutex_lock(&mutex_);
+  stream->session_busy_ = false;
+  streams_.push_back(stream);
+  pthread_mutex_unlock(&mutex_);
+}
+
+/* Wait for the stream's queued frames to go out then forget it */
+void RtpSession::Detach(RtpStream * stream) {
+  pthread_mutex_lock(&mutex_);
+  if (running_)
+    WaitIdle(stream);
+  streams_.erase(std::remove(streams_.begin(), streams_.end(), stream),
+                 streams_.end());
+  pthread_mutex_unlock(&mutex_);
+}
+
+/* A frame has been queued on one of the streams, only workers wait on cond_ */
+void RtpSession::Wake() {
+  pthread_mutex_lock(&mutex_);
+  pthread_cond_signal(&cond_);
+  pthread_mutex_unlock(&mutex_);
+}
+
+/* Called with mutex_ held */
+void RtpSession::WaitIdle(RtpStream * stream) {
+  while (running_ && (stream->session_busy_ ||
+                      (stream->TxDue() != UINT64_MAX)))
+    pthread_cond_wait(&idle_, &mutex_);
+}
+
+//
+// Pick the next stream with work due, round robin from the last one served.
+// Otherwise returns 0 and sets wake to the earliest pending launch time.
+// Called with mutex_ held.
+//
+RtpStream *RtpSession::Next(uint64_t * wake) {
+  uint64_t now = RtpPacer::Now();
+  size_t count = streams_.size();
+
+  *wake = UINT64_MAX;
+  for (size_t c = 0; c < count; c++) {
+    size_t index = (cursor_ + c) % count;
+    RtpStream *stream = streams_[index];
+    uint64_t due;
+
+    if (stream->session_busy_)
+      continue;
+    due = stream->TxDue();
+    if (due <= now + RTP_PACING_SPIN_NS) {
+      cursor_ = index + 1;
+      return stream;
+    }
+    *wake = std::min(*wake, due);
+  }
+  return 0;
+}
+
+void RtpSession::Work() {
+  pthread_mutex_lock(&mutex_);
+  while (running_) {
+    uint64_t wake;
+    RtpStream *stream = Next(&wake);
+
+    if (!stream) {
+      if (wake == UINT64_MAX) {
+        pthread_cond_wait(&cond_, &mutex_);
+      } else {
+        struct timespec deadline;
+
+        wake -= RTP_PACING_SPIN_NS;
+        deadline.tv_sec = wake / 1000000000ULL;
+        deadline.tv_nsec = wake % 1000000000ULL;
+        pthread_cond_timedwait(&cond_, &mutex_, &deadline);
+      }
+      continue;
+    }
+
+    /* One burst, then give the other streams a turn */
+    stream->session_busy_ = true;
+    pthread_mutex_unlock(&mutex_);
+    stream->TxWork();
+    pthread_mutex_lock(&mutex_);
+    stream->session_busy_ = false;
+    pthread_cond_broadcast(&cond_);
+    pthread_cond_broadcast(&idle_);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+void *SessionWorker(void *data) {
+  RtpSession *session = (RtpSession *) data;
+
+  session->Work();
+  return 0;
+}
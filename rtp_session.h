@@ -0,0 +1,56 @@
+/*
+ * Multi-stream transmit session. Any number of RtpStream outputs (each with
+ * its own SSRC, sequence numbers, resolution and destination) share a small
+ * pool of worker threads instead of a transmit thread each. Workers take the
+ * streams in turn one burst at a time, so a large stream can not starve a
+ * small one, and a paced stream whose next burst is not due yet is skipped
+ * rather than waited for. CPU use follows the total pixel rate, not the
+ * number of streams.
+ *
+ *   RtpSession session(2);
+ *   session.Add(&camera1);
+ *   session.Add(&camera2);
+ *   session.Start();
+ *   camera1.Open();
+ *   camera2.Open();
+ */
+
+#ifndef __RTP_SESSION_H__
+#define __RTP_SESSION_H__
+
+#include <pthread.h>
+#include <vector>
+#include "rtp_stream.h"
+
+#define RTP_SESSION_WORKERS   2         /* default size of the worker pool */
+
+class RtpSession {
+public:
+  RtpSession(int workers = RTP_SESSION_WORKERS);
+  ~RtpSession();
+  void SetAffinity(const std::vector < int >&cpus);
+  void Add(RtpStream * stream);
+  bool Start();
+  void Stop();
+  int Streams() { return streams_.size(); }
+
+  /* Called by RtpStream::Open(), Close() and Transmit() */
+  void Attach(RtpStream * stream);
+  void Detach(RtpStream * stream);
+  void Wake();
+  void Work();
+private:
+  RtpStream *Next(uint64_t * wake);
+  void WaitIdle(RtpStream * stream);
+  int workers_;
+  std::vector < int >cpus_;     /* worker n runs on cpus_[n % size], empty for any */
+  std::vector < pthread_t > threads_;
+  std::vector < RtpStream * >streams_;
+  size_t cursor_;               /* round robin position */
+  bool running_;
+  pthread_mutex_t mutex_;
+  pthread_cond_t cond_;         /* workers wait here for frames */
+  pthread_cond_t idle_;         /* Detach() and Stop() wait here for streams to go idle */
+};
+
+#endif
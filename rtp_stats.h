@@ -0,0 +1,102 @@
+/*
+ * Per stream receive statistics. The receive thread is the only writer and
+ * updates the counters with relaxed atomic stores, any other thread can take
+ * a consistent enough snapshot with Snapshot() without locking. A stream
+ * received on several threads has a set of counters per thread, merged with
+ * Merge().
+ */
+
+#ifndef __RTP_STATS_H__
+#define __RTP_STATS_H__
+
+#include <stdint.h>
+#include <atomic>
+
+typedef struct {
+  uint64_t packets;             /* packets received */
+  uint64_t lost;                /* gaps in the extended sequence number */
+  uint64_t reordered;           /* arrived after a later sequence number */
+  uint64_t duplicates;          /* behind the newest and already received (or before the first) */
+  uint64_t late;                /* arrived after their frame was completed */
+  uint64_t bytes;               /* UDP payload bytes received */
+  uint64_t frames;              /* frames completed with no loss */
+  uint64_t partial;             /* frames completed or abandoned with loss */
+  uint32_t jitter;              /* RFC 3550 interarrival jitter, 90kHz units */
+} RtpStatistics;
+
+class RtpStatsCounters {
+public:
+  RtpStatsCounters() {
+    Reset();
+  }
+  void Reset() {
+    packets_ = 0;
+    lost_ = 0;
+    reordered_ = 0;
+    duplicates_ = 0;
+    late_ = 0;
+    bytes_ = 0;
+    frames_ = 0;
+    partial_ = 0;
+    jitter_ = 0;
+    first_ = 0;
+    next_ = 0;
+  }
+  void Snapshot(RtpStatistics * stats) {
+    stats->packets = packets_.load(std::memory_order_relaxed);
+    stats->lost = lost_.load(std::memory_order_relaxed);
+    stats->reordered = reordered_.load(std::memory_order_relaxed);
+    stats->duplicates = duplicates_.load(std::memory_order_relaxed);
+    stats->late = late_.load(std::memory_order_relaxed);
+    stats->bytes = bytes_.load(std::memory_order_relaxed);
+    stats->frames = frames_.load(std::memory_order_relaxed);
+    stats->partial = partial_.load(std::memory_order_relaxed);
+    stats->jitter = jitter_.load(std::memory_order_relaxed);
+  }
+
+  //
+  // Add another thread's packets. Each thread only sees some of the sequence
+  // numbers, so the loss is worked out again from the span of sequence
+  // numbers seen by all of them against the packets they received.
+  //
+  static void Merge(RtpStatistics * stats, int64_t * low, int64_t * high,
+                    uint32_t base, RtpStatsCounters * other) {
+    uint64_t packets = other->packets_.load(std::memory_order_relaxed);
+    int32_t first, next;
+
+    if (!packets)
+      return;
+    first = other->first_.load(std::memory_order_relaxed) - base;
+    next = other->next_.load(std::memory_order_relaxed) - base;
+    if (first < *low)
+      *low = first;
+    if (next > *high)
+      *high = next;
+    stats->packets += packets;
+    stats->bytes += other->bytes_.load(std::memory_order_relaxed);
+    stats->reordered += other->reordered_.load(std::memory_order_relaxed);
+    stats->duplicates += other->duplicates_.load(std::memory_order_relaxed);
+    if (other->jitter_.load(std::memory_order_relaxed) > stats->jitter)
+      stats->jitter = other->jitter_.load(std::memory_order_relaxed);
+  }
+
+  /* Single writer, so a load and store is enough and avoids a locked add */
+  static void Add(std::atomic < uint64_t > &counter, uint64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+  }
+
+  std::atomic < uint64_t > packets_;
+  std::atomic < uint64_t > lost_;
+  std::atomic < uint64_t > reordered_;
+  std::atomic < uint64_t > duplicates_;
+  std::atomic < uint64_t > late_;
+  std::atomic < uint64_t > bytes_;
+  std::atomic < uint64_t > frames_;
+  std::atomic < uint64_t > partial_;
+  std::atomic < uint32_t > jitter_;
+  std::atomic < uint32_t > first_;      /* first extended sequence number seen */
+  std::atomic < uint32_t > next_;       /* one past the highest seen */
+};
+
+#endif
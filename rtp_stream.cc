@@ -5,32 +5,42 @@
 
 #include <iostream>
 #include <string>
+#include <errno.h>
 #include <pthread.h>
 #include <sched.h>
+#include <random>
 #if __MINGW64__ || __MINGW32__
 #include <winsock2.h>
 #include <WS2tcpip.h>
 #else
 #include <arpa/inet.h>
+#include <net/if.h>
+#include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <netinet/udp.h>
 #include <sys/socket.h>
 #endif
-extern "C" {
-#include "libswscale/swscale.h"
-}
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
+#include "colourspace.h"
 #include "rtp_stream.h"
+#include "rtp_session.h"
+#include "uring_receiver.h"
+#include "rtp_band.h"
+#include "rtp_lane.h"
 using namespace std;
 
 #define GST_1_FUDGE       0
+#define RX_CMSG_SPACE     (CMSG_SPACE(sizeof(struct timespec)) + \
+                           CMSG_SPACE(sizeof(int)))
 #define RTP_CHECK 			  0     // 0 to disable RTP header checking
 #define RTP_THREADED 		  1     // transmit and recieve in a thread. RX thread blocks TX does not
 #define PITCH 				    4   // RGBX processing pitch
 
-#if ENDIAN_SWAP
-void EndianSwap32(uint32_t * data, int length);
-void EndianSwap16(uint16_t * data, int length);
-#endif
+void *TransmitThread(void *data);
+void *ReceiveThread(void *data);
 
 typedef struct float4 {
   float x;
@@ -47,51 +57,39 @@ void error(char *msg) {
   exit(0);
 }
 
-void yuvtorgb(int height, int width, char *yuv, char *rgba) {
-  SwsContext *ctx = sws_getContext(width, height, AV_PIX_FMT_YUYV422,
-                                   width, height, AV_PIX_FMT_RGB24, SWS_BICUBIC,
-                                   0, 0, 0);
-  uint8_t *inData[1] = { (uint8_t *) yuv };     // RGB24 have one plane
-  uint8_t *outData[1] = { (uint8_t *) rgba };   // YUYV have one plane
-  int inLinesize[1] = { width * 2 };    // YUYV stride
-  int outLinesize[1] = { width * 3 };   // RGB srtide
-  sws_scale(ctx, inData, inLinesize, 0, height, outData, outLinesize);
+//
+// Frame conversions to and from the RFC 4175 YCbCr-4:2:2 wire order (UYVY).
+// Width must be even.
+//
+void yuvtorgb(int height, int width, char *yuv, char *rgb) {
+  ColourConvert(PIXEL_UYVY, PIXEL_RGB24, (uint8_t *) yuv, (uint8_t *) rgb,
+                width, height);
 }
 
-void yuvtorgba(int height, int width, char *yuv, char *rgb) {
-  SwsContext *ctx = sws_getContext(width, height, AV_PIX_FMT_UYVY422,
-                                   width, height, AV_PIX_FMT_RGBA, SWS_BICUBIC,
-                                   0, 0, 0);
-  uint8_t *inData[1] = { (uint8_t *) yuv };     // RGB24 have one plane
-  uint8_t *outData[1] = { (uint8_t *) rgb };    // YUYV have one plane
-  int inLinesize[1] = { width * 2 };    // YUYV stride
-  int outLinesize[1] = { width * 4 };   // RGB srtide
-  sws_scale(ctx, inData, inLinesize, 0, height, outData, outLinesize);
+void yuvtorgba(int height, int width, char *yuv, char *rgba) {
+  ColourConvert(PIXEL_UYVY, PIXEL_RGBA, (uint8_t *) yuv, (uint8_t *) rgba,
+                width, height);
 }
 
 void rgbatoyuv(int height, int width, char *rgba, char *yuv) {
-  SwsContext *ctx = sws_getContext(width, height, AV_PIX_FMT_RGBA,
-                                   width, height, AV_PIX_FMT_YUYV422, 0, 0, 0,
-                                   0);
-  uint8_t *inData[1] = { (uint8_t *) rgba };    // RGB24 have one plane
-  uint8_t *outData[1] = { (uint8_t *) yuv };    // YUYV have one plane
-  int inLinesize[1] = { width * 4 };    // RGB stride
-  int outLinesize[1] = { width * 2 };   // YUYV srtide
-  sws_scale(ctx, inData, inLinesize, 0, height, outData, outLinesize);
+  ColourConvert(PIXEL_RGBA, PIXEL_UYVY, (uint8_t *) rgba, (uint8_t *) yuv,
+                width, height);
 }
 
 void rgbtoyuv(int height, int width, char *rgb, char *yuv) {
-  SwsContext *ctx = sws_getContext(width, height, AV_PIX_FMT_RGB24,
-                                   width, height, AV_PIX_FMT_YUYV422, 0, 0, 0,
-                                   0);
-  uint8_t *inData[1] = { (uint8_t *) rgb };     // RGB24 have one plane
-  uint8_t *outData[1] = { (uint8_t *) yuv };    // YUYV have one plane
-  int inLinesize[1] = { width * 3 };    // RGB stride
-  int outLinesize[1] = { width * 2 };   // YUYV srtide
-  sws_scale(ctx, inData, inLinesize, 0, height, outData, outLinesize);
+  ColourConvert(PIXEL_RGB24, PIXEL_UYVY, (uint8_t *) rgb, (uint8_t *) yuv,
+                width, height);
 }
 
-unsigned long RtpStream::sequence_number_;
+//
+// Random starting values as RFC 3550 recommends, streams from one host then
+// never share an SSRC
+//
+static uint32_t RandomValue() {
+  static std::random_device device;
+
+  return device();
+}
 
 RtpStream::RtpStream(int height, int width) {
   height_ = height;
@@ -99,17 +97,389 @@ RtpStream::RtpStream(int height, int width) {
   frame_ = 0;
   port_no_in_ = 0;
   port_no_out_ = 0;
-  sequence_number_ = 0;
+  sockfd_in_ = -1;
+  sockfd_out_ = -1;
+  source_ = RandomValue();
+  sequence_number_ = RandomValue() & 0xFFFF;
+  mtu_ = RTP_DEFAULT_MTU;
+  tx_running_ = false;
+  session_ = 0;
+  session_busy_ = false;
+  multicast_if_[0] = 0;
+  multicast_ttl_ = 1;
+  multicast_loop_ = false;
+  tx_active_ = false;
+  tx_packet_ = 0;
+  tx_batch_ = 0;
+  tx_launch_ = 0;
+  tx_buffer_ = 0;
+  tx_msgs_ = 0;
+  tx_iov_ = 0;
+  tx_cmsg_ = 0;
+  tx_layout_ = &packetizer_;
+  tx_builder_ = &tx_headers_;
+  VideoFormatInit(&format_, SAMPLING_YCBCR_422, 8);
+  rx_running_ = false;
+  rx_buffer_ = 0;
+  rx_msgs_ = 0;
+  rx_iov_ = 0;
+  rx_cmsg_ = 0;
+  rx_ring_wanted_ = false;
+  rx_ring_if_[0] = 0;
+  io_backend_ = IO_SOCKET;
+  rx_uring_ = false;
+  offload_wanted_ = false;
+  rx_gro_ = false;
+  rx_size_ = MAX_UDP_DATA;
+  tx_gso_ = false;
+  tx_gso_msgs_ = 0;
+  tx_gso_iov_ = 0;
+  tx_gso_cmsg_ = 0;
+  tx_raw_msgs_ = 0;
+  tx_raw_iov_ = 0;
+  tx_bands_wanted_ = 1;
+  rx_callback_ = 0;
+  rx_user_ = 0;
+  rx_frames_ = RTP_FRAME_POOL;
+  memset(&rx_track_, 0, sizeof(rx_track_));
+  rx_track_.stats = &rx_stats_;
+  rx_recording_ = false;
+  rx_lanes_wanted_ = 1;
+  memory_hugepages_ = false;
+  memory_node_ = RTP_NODE_AUTO;
   pthread_mutex_init(&mutex_, NULL);
-  buffer_in_ = (char *) malloc(height * width * 2);     // Holds YUV data
   cout << "[RTP] RtpStream created << " << width_ << "x" << height_ << "\n";
 }
 
 RtpStream::~RtpStream(void) {
-  free(buffer_in_);
+  Close();
+  CloseBands();
+  CloseLanes();
+  FrameMemory::Free(tx_buffer_);
+  free(tx_msgs_);
+  free(tx_iov_);
+  free(tx_cmsg_);
+  free(tx_gso_msgs_);
+  free(tx_gso_iov_);
+  free(tx_gso_cmsg_);
+  free(tx_raw_msgs_);
+  free(tx_raw_iov_);
+  FrameMemory::Free(rx_buffer_);
+  free(rx_msgs_);
+  free(rx_iov_);
+  free(rx_cmsg_);
+}
+
+/* Use a fixed SSRC instead of the random one, call before Open() */
+void RtpStream::SetSource(uint32_t source) {
+  source_ = source;
+}
+
+//
+// RFC 4175 sampling and depth of the frames sent or received, YCbCr-4:2:2 8
+// bit by default. See video_format.h for the frame layout in memory. Call
+// before Open(), returns false if the depth is not defined for the sampling.
+//
+bool RtpStream::SetFormat(Sampling sampling, int depth) {
+  return VideoFormatInit(&format_, sampling, depth);
+}
+
+/* Set the link MTU used to size outgoing packets, call before Open() */
+void RtpStream::SetMtu(int mtu) {
+  if (mtu > RTP_MAX_MTU)
+    mtu = RTP_MAX_MTU;
+  mtu_ = mtu;
+}
+
+//
+// Spread each frame's packets over the frame period and/or cap the bitrate
+// (bits per second). kernel tries SO_TXTIME/SO_MAX_PACING_RATE first, only
+// ask for it with fq or etf on the egress interface, other qdiscs ignore the
+// launch times. Call before Open(), a framerate and max_bitrate of 0 turns
+// pacing off.
+//
+void RtpStream::SetPacing(int framerate, uint64_t max_bitrate, bool kernel) {
+  pacer_.Configure(framerate, max_bitrate, kernel);
+}
+
+//
+// Only send the lines that changed since the previous frame, with every
+// line sent every refresh frames (and after RefreshFrame()) for receivers
+// that join late or lost packets. Call before Open(), 0 sends every line.
+//
+void RtpStream::SetDirtyLines(int refresh) {
+  tx_dirty_.Configure(refresh);
+}
+
+/* Send every line of the next frame, e.g. when a receiver joins */
+void RtpStream::RefreshFrame() {
+  tx_dirty_.Refresh();
+}
+
+//
+// Keep lines that are missing from a frame from the previous frame instead,
+// for receiving from a sender that only sends changed lines. Call before
+// Open().
+//
+void RtpStream::SetHoldLines(bool hold) {
+  rx_jitter_buffer_.Hold(hold);
+}
+
+//
+// Receive through an AF_PACKET TPACKET_V3 ring on interface (empty for every
+// interface) instead of recvmmsg(), needs CAP_NET_RAW. Call before Open(),
+// which falls back to the socket if the ring can not be set up.
+//
+void RtpStream::SetPacketRing(bool enable, const char *interface) {
+  rx_ring_wanted_ = enable;
+  strncpy(rx_ring_if_, interface ? interface : "", sizeof(rx_ring_if_) - 1);
+}
+
+//
+// IO_URING sends each batch as one io_uring submission and receives on the
+// shared UringReceiver thread instead of a thread per stream. Call before
+// Open(), which stays on the socket calls if io_uring is not available.
+//
+void RtpStream::SetIoBackend(IoBackend backend) {
+  io_backend_ = backend;
+}
+
+//
+// Hand the kernel runs of equal sized packets as one UDP_SEGMENT send, and
+// take in runs coalesced by UDP_GRO, a system call per run rather than per
+// packet. Call before Open(), which sends and receives packets one by one
+// if the kernel can not. Not with kernel pacing, the packets of a run would
+// share one launch time, nor with the packet ring or io_uring receive.
+//
+void RtpStream::SetSegmentOffload(bool enable) {
+  offload_wanted_ = enable;
+}
+
+//
+// Split every frame into bands horizontal bands, each packetized and sent
+// by a thread of its own, band n pinned to cpus[n % size] if cpus is not
+// empty. For frames too big for one core to send in time. Call before
+// Open(), not for streams sent by an RtpSession.
+//
+void RtpStream::SetBands(int bands, const std::vector < int >&cpus) {
+  tx_bands_wanted_ = bands < 1 ? 1 : bands;
+  tx_band_cpus_ = cpus;
+}
+
+void RtpStream::CloseBands() {
+  for (size_t c = 0; c < tx_bands_.size(); c++)
+    delete tx_bands_[c];
+  tx_bands_.clear();
+}
+
+//
+// Receive on lanes threads, each reading its own SO_REUSEPORT socket on the
+// port and lane n pinned to cpus[n % size] if cpus is not empty. For streams
+// too fast for one core to depacketize. Call before Open(), unicast only.
+//
+void RtpStream::SetLanes(int lanes, const std::vector < int >&cpus) {
+  rx_lanes_wanted_ = lanes < 1 ? 1 : lanes;
+  rx_lane_cpus_ = cpus;
+}
+
+//
+// Frame and packet buffers on 2MB pages if hugepages, and on NUMA node, or
+// with RTP_NODE_AUTO the node of the receive or multicast interface, else
+// of the first CPU the lanes or bands are pinned to. Call before Open().
+//
+void RtpStream::SetMemory(bool hugepages, int node) {
+  memory_hugepages_ = hugepages;
+  memory_node_ = node;
+}
+
+/* Node for the buffers of one direction, cpu the thread filling them or -1 */
+int RtpStream::MemoryNode(bool receive, int cpu) {
+  const std::vector < int >&cpus = receive ? rx_lane_cpus_ : tx_band_cpus_;
+  int node;
+
+  if (memory_node_ != RTP_NODE_AUTO)
+    return memory_node_;
+  if (receive && ((node = FrameMemory::InterfaceNode(rx_ring_if_)) >= 0))
+    return node;
+  if ((node = FrameMemory::InterfaceNode(multicast_if_)) >= 0)
+    return node;
+  if ((cpu < 0) && !cpus.empty())
+    cpu = cpus[0];
+  return FrameMemory::CpuNode(cpu);
+}
+
+/* Receive socket of lane, lane 0 is sockfd_in_ */
+int RtpStream::LaneSocket(int lane) {
+  if ((lane <= 0) || (lane > (int) rx_lanes_.size()))
+    return sockfd_in_;
+  return rx_lanes_[lane - 1]->Socket();
+}
+
+void RtpStream::CloseLanes() {
+  for (size_t c = 0; c < rx_lanes_.size(); c++)
+    delete rx_lanes_[c];
+  rx_lanes_.clear();
+}
+
+/* Snapshot of the receive statistics, safe to call from any thread */
+void RtpStream::Statistics(RtpStatistics *stats) {
+  std::vector < RtpStatsCounters * >counters(1, &rx_stats_);
+  int64_t low = INT64_MAX;
+  int64_t high = INT64_MIN;
+  uint32_t base = 0;
+  bool synced = false;
+
+  rx_stats_.Snapshot(stats);
+  if (rx_lanes_.empty())
+    return;
+
+  /* Every lane's packets, sequence numbers counted from the first lane's */
+  for (size_t c = 0; c < rx_lanes_.size(); c++)
+    counters.push_back(rx_lanes_[c]->Stats());
+  stats->packets = 0;
+  stats->bytes = 0;
+  stats->reordered = 0;
+  stats->duplicates = 0;
+  stats->jitter = 0;
+  for (size_t c = 0; c < counters.size(); c++) {
+    if (!synced && counters[c]->packets_.load(std::memory_order_relaxed)) {
+      base = counters[c]->first_.load(std::memory_order_relaxed);
+      synced = true;
+    }
+    RtpStatsCounters::Merge(stats, &low, &high, base, counters[c]);
+  }
+  stats->packets -= stats->duplicates;
+  stats->lost = synced && (high - low > (int64_t) stats->packets) ?
+    high - low - stats->packets : 0;
+  stats->packets += stats->duplicates;
+}
+
+/* Number of receive frame buffers, RTP_FRAME_POOL by default, call before Open() */
+void RtpStream::SetFramePool(int count) {
+  rx_frames_ = count;
+}
+
+//
+// Frames that can be in flight at once and how long (ms) to wait for
+// reordered packets after the marker before publishing. Call before Open().
+//
+void RtpStream::SetJitterBuffer(int frames, int window_ms) {
+  rx_jitter_buffer_.Configure(frames, window_ms);
 }
 
-/* Broadcast the stream to port i.e. 5004 */
+/* Set the transmit queue depth and what to do when it is full, call before Open() */
+void RtpStream::SetQueue(int depth, QueuePolicy policy) {
+  tx_queue_.Configure(depth, policy);
+}
+
+//
+// Resolve an IPv4 host name or dotted address, returns false if unknown
+//
+static bool Resolve(const char *hostname, int port, struct sockaddr_in *addr) {
+  struct addrinfo hints;
+  struct addrinfo *result;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  if (getaddrinfo(hostname, NULL, &hints, &result) != 0)
+    return false;
+  memcpy(addr, result->ai_addr, sizeof(*addr));
+  addr->sin_port = htons(port);
+  freeaddrinfo(result);
+  return true;
+}
+
+/* True for a dotted address in 224.0.0.0/4 */
+static bool Multicast(const char *hostname) {
+  struct in_addr address;
+
+  return (inet_pton(AF_INET, hostname, &address) == 1) &&
+    IN_MULTICAST(ntohl(address.s_addr));
+}
+
+//
+// Multicast interface request for group on the interface set by
+// SetMulticast(), an address or (on Linux) an interface name. Empty means
+// let the kernel choose.
+//
+#ifdef __linux__
+typedef struct ip_mreqn MulticastRequest;
+#else
+typedef struct ip_mreq MulticastRequest;
+#endif
+
+static void MulticastInterface(const char *interface, struct in_addr group,
+                               MulticastRequest *request) {
+  struct in_addr address;
+
+  memset(request, 0, sizeof(*request));
+  request->imr_multiaddr = group;
+  address.s_addr = htonl(INADDR_ANY);
+  if (interface[0] && (inet_pton(AF_INET, interface, &address) != 1)) {
+    address.s_addr = htonl(INADDR_ANY);
+#ifdef __linux__
+    request->imr_ifindex = if_nametoindex(interface);
+#endif
+  }
+#ifdef __linux__
+  request->imr_address = address;
+#else
+  request->imr_interface = address;
+#endif
+}
+
+//
+// Interface (address or name), TTL and loopback used for multicast, both to
+// join groups and to send to a group. Call before Open().
+//
+void RtpStream::SetMulticast(const char *interface, int ttl, bool loopback) {
+  strncpy(multicast_if_, interface ? interface : "", sizeof(multicast_if_) - 1);
+  multicast_ttl_ = ttl;
+  multicast_loop_ = loopback;
+}
+
+//
+// Replicate the stream to another unicast receiver. Each packet is built once
+// and handed to the kernel once per destination in the same sendmmsg().
+// Call before Open().
+//
+void RtpStream::AddDestination(char *hostname, int port) {
+  cout << "[RTP] AddDestination " << hostname << ":" << port << "\n";
+  tx_extra_.push_back(std::make_pair(std::string(hostname), port));
+}
+
+/* Join a multicast group on the receive socket, the stream must be open */
+bool RtpStream::JoinGroup(const char *group) {
+  MulticastRequest request;
+  struct in_addr address;
+
+  if ((sockfd_in_ < 0) || (inet_pton(AF_INET, group, &address) != 1) ||
+      !IN_MULTICAST(ntohl(address.s_addr)))
+    return false;
+  MulticastInterface(multicast_if_, address, &request);
+  if (setsockopt(sockfd_in_, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char *) &request,
+                 sizeof(request)) < 0) {
+    cout << "ERROR failed to join multicast group " << group << "\n";
+    return false;
+  }
+  cout << "[RTP] Joined multicast group " << group << "\n";
+  return true;
+}
+
+/* Leave a group, closing the stream leaves every group it joined */
+bool RtpStream::LeaveGroup(const char *group) {
+  MulticastRequest request;
+  struct in_addr address;
+
+  if ((sockfd_in_ < 0) || (inet_pton(AF_INET, group, &address) != 1))
+    return false;
+  MulticastInterface(multicast_if_, address, &request);
+  return setsockopt(sockfd_in_, IPPROTO_IP, IP_DROP_MEMBERSHIP,
+                    (char *) &request, sizeof(request)) == 0;
+}
+
+/* Receive on port i.e. 5004, hostname may be a multicast group to join */
 void RtpStream::RtpStreamIn(char *hostname, int portno) {
   cout << "[RTP] RtpStreamIn " << hostname << portno << "\n";
   port_no_in_ = portno;
@@ -122,7 +492,126 @@ void RtpStream::RtpStreamOut(char *hostname, int portno) {
   strcpy(hostname_out_, hostname);
 }
 
+//
+// Write every datagram received from now on, on every lane, to a pcap file
+// at path until StopRecording() or Close(). Call after RtpStreamIn().
+//
+bool RtpStream::Record(const char *path) {
+  struct in_addr group;
+  uint32_t address = 0;
+
+  StopRecording();
+  if (Multicast(hostname_in_) &&
+      (inet_pton(AF_INET, hostname_in_, &group) == 1))
+    address = ntohl(group.s_addr);
+  if (!rx_recorder_.Open(path, address, port_no_in_))
+    return false;
+  cout << "[RTP] Recording to " << path << "\n";
+  rx_recording_ = true;
+  return true;
+}
+
+void RtpStream::StopRecording() {
+  if (!rx_recording_)
+    return;
+  /* A receive thread part way through a packet finishes it under the lock */
+  rx_recording_ = false;
+  rx_recorder_.Close();
+  cout << "[RTP] Recorded " << rx_recorder_.Packets() << " packets\n";
+}
+
+/* Lanes only spread a unicast socket, not the packet ring or io_uring */
+bool RtpStream::LanesWanted() {
+  return (rx_lanes_wanted_ > 1) && !Multicast(hostname_in_) &&
+    !rx_ring_wanted_ && (io_backend_ != IO_URING);
+}
+
+//
+// Have the kernel hand each packet of the port's SO_REUSEPORT group to the
+// socket at its RTP sequence number modulo lanes, so one sender's packets
+// are spread evenly. Without it the kernel spreads by sender address and
+// port.
+//
+static bool SpreadBySequence(int sockfd, int lanes) {
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+  struct sock_filter code[] = {
+    {BPF_LD | BPF_H | BPF_ABS, 0, 0, 2},        /* sequence number, after the UDP header */
+    {BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t) lanes},
+    {BPF_RET | BPF_A, 0, 0, 0}
+  };
+  struct sock_fprog program;
+
+  program.len = sizeof(code) / sizeof(code[0]);
+  program.filter = code;
+  return setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program,
+                    sizeof(program)) == 0;
+#else
+  return false;
+#endif
+}
+
+void RtpStream::OpenLanes() {
+  int lanes;
+
+  CloseLanes();
+  for (int c = 1; c < rx_lanes_wanted_; c++) {
+    RtpLane *lane = new RtpLane(this, c);
+    int cpu = rx_lane_cpus_.empty() ? -1 :
+      rx_lane_cpus_[c % rx_lane_cpus_.size()];
+
+    rx_lanes_.push_back(lane);
+    if (!lane->Open(cpu)) {
+      CloseLanes();
+      cout << "[RTP] Lanes unavailable, receiving on one thread\n";
+      return;
+    }
+  }
+#ifdef __linux__
+  if (!rx_lane_cpus_.empty()) {
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(rx_lane_cpus_[0], &set);
+    if (pthread_setaffinity_np(rx_thread_, sizeof(set), &set) != 0)
+      cout << "[RTP] Could not pin lane 0 to CPU " << rx_lane_cpus_[0] << "\n";
+  }
+#endif
+
+  /* Socket n of the group is lane n, in the order they were bound */
+  lanes = rx_lanes_.size() + 1;
+  if (SpreadBySequence(sockfd_in_, lanes))
+    cout << "[RTP] Receiving on " << lanes << " lanes by sequence number\n";
+  else
+    cout << "[RTP] Receiving on " << lanes << " lanes by sender port\n";
+}
+
+/* Sending to a group, TTL, loopback and interface for a transmit socket */
+void RtpStream::MulticastOut(int sockfd) {
+  if (IN_MULTICAST(ntohl(server_addr_out_.sin_addr.s_addr))) {
+    MulticastRequest request;
+    unsigned char ttl = multicast_ttl_;
+    unsigned char loop = multicast_loop_;
+
+    setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_TTL, (char *) &ttl,
+               sizeof(ttl));
+    setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_LOOP, (char *) &loop,
+               sizeof(loop));
+    if (multicast_if_[0]) {
+      MulticastInterface(multicast_if_, server_addr_out_.sin_addr, &request);
+      if (setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_IF,
+                     (char *) &request, sizeof(request)) < 0)
+        cout << "ERROR multicast interface " << multicast_if_ << "\n";
+    }
+  }
+}
+
 bool RtpStream::Open() {
+  if (!VideoFormatFits(&format_, height_, width_)) {
+    cout << "ERROR " << width_ << "x" << height_ << " is not whole " <<
+      format_.name << " pixel groups\n";
+    return false;
+  }
+
   if (port_no_in_) {
     struct sockaddr_in si_me;
     int i, slen = sizeof(si_me);
@@ -139,26 +628,172 @@ bool RtpStream::Open() {
     si_me.sin_port = htons(port_no_in_);
     si_me.sin_addr.s_addr = htonl(INADDR_ANY);
 
+    /* Lanes share the port, the kernel picks a socket per packet */
+    if (LanesWanted()) {
+      int reuse = 1;
+
+      setsockopt(sockfd_in_, SOL_SOCKET, SO_REUSEPORT, (char *) &reuse,
+                 sizeof(reuse));
+    }
+
+    /* Receivers of different groups may share the port */
+    if (Multicast(hostname_in_)) {
+      int reuse = 1;
+
+      setsockopt(sockfd_in_, SOL_SOCKET, SO_REUSEADDR, (char *) &reuse,
+                 sizeof(reuse));
+    }
+
     //bind socket to port
     if (bind(sockfd_in_, (struct sockaddr *) &si_me, sizeof(si_me)) == -1) {
       cout << "ERROR binding socket\n";
       return error;
     }
-#if	RTP_MULTICAST
+
+    /* Multicast, join the group given to RtpStreamIn() */
+    if (Multicast(hostname_in_)) {
+#ifdef IP_MULTICAST_ALL
+      int all = 0;
+
+      /* Only the groups joined on this socket, not every group on the port */
+      setsockopt(sockfd_in_, IPPROTO_IP, IP_MULTICAST_ALL, &all, sizeof(all));
+#endif
+      JoinGroup(hostname_in_);
+    }
+
+    /* Frame buffers, holds YUV data */
+    if (!rx_running_) {
+      int frames = rx_frames_;
+
+      /* Frames in flight, the ready frame and one held by the consumer */
+      if (frames < rx_jitter_buffer_.Frames() + 2)
+        frames = rx_jitter_buffer_.Frames() + 2;
+      if (!rx_pool_.Allocate(frames, VideoFrameBytes(&format_, height_, width_),
+                             VideoRows(&format_, height_), memory_hugepages_,
+                             MemoryNode(true))) {
+        cout << "ERROR allocating frame pool\n";
+        return false;
+      }
+      rx_jitter_buffer_.Open(&rx_pool_, &rx_stats_, VideoRows(&format_, height_),
+                             VideoHostRowBytes(&format_, width_),
+                             width_ / format_.xinc, FrameReady, this);
+      rx_track_.synced = false;
+    }
+
+    /* Wake up regularly to expire frames waiting in the jitter buffer */
     {
-      struct ip_mreq multi;
-
-      // Multicast
-      multi.imr_multiaddr.s_addr = inet_addr(IP_MULTICAST_IN);
-      multi.imr_interface.s_addr = htonl(INADDR_ANY);
-      if (setsockopt
-          (sockfd_in_, IPPROTO_UDP, IP_ADD_MEMBERSHIP, &multi,
-           sizeof(multi)) < 0) {
-        cout << "ERROR failed to join multicast group " << IP_MULTICAST_IN <<
-          "\n";
+      struct timeval tv;
+      int window = rx_jitter_buffer_.Window();
+
+      if (window < 1)
+        window = 1;
+      tv.tv_sec = window / 1000;
+      tv.tv_usec = (window % 1000) * 1000;
+      setsockopt(sockfd_in_, SOL_SOCKET, SO_RCVTIMEO, (char *) &tv, sizeof(tv));
+    }
+
+    /* The socket stays bound for the port and groups but queues nothing */
+    if (rx_ring_wanted_ && !rx_running_) {
+      struct in_addr group;
+      uint32_t address = 0;
+
+      if (Multicast(hostname_in_) &&
+          (inet_pton(AF_INET, hostname_in_, &group) == 1))
+        address = ntohl(group.s_addr);
+      if (rx_ring_.Open(rx_ring_if_, address, port_no_in_,
+                        rx_jitter_buffer_.Window()) &&
+          PacketRing::DropAll(sockfd_in_))
+        cout << "[RTP] Receiving through packet ring " <<
+          (rx_ring_if_[0] ? rx_ring_if_ : "on every interface") << "\n";
+      else {
+        rx_ring_.Close();
+        cout << "[RTP] Packet ring unavailable, receiving from the socket\n";
       }
     }
+    /* One thread for every io_uring stream rather than one each */
+    if ((io_backend_ == IO_URING) && !rx_running_ && !rx_ring_.Active()) {
+      if (UringReceiver::Shared()->Attach(this)) {
+        cout << "[RTP] Receiving through io_uring\n";
+        rx_uring_ = true;
+        rx_running_ = true;
+      } else
+        cout << "[RTP] io_uring unavailable, receiving from the socket\n";
+    }
+
+#ifdef UDP_GRO
+    /* Let the kernel coalesce a run of datagrams into one big receive */
+    if (offload_wanted_ && !rx_running_ && !rx_ring_.Active() &&
+        !LanesWanted()) {
+      int on = 1;
+
+      if (setsockopt(sockfd_in_, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0) {
+        cout << "[RTP] Receiving with UDP_GRO\n";
+        rx_gro_ = true;
+        rx_size_ = RTP_GSO_BYTES;
+      } else
+        cout << "[RTP] UDP_GRO not supported, receiving packets\n";
+    }
+#endif
+
+    /* A batch of receive buffers for recvmmsg() */
+    FrameMemory::Free(rx_buffer_);
+    free(rx_msgs_);
+    free(rx_iov_);
+    rx_buffer_ = FrameMemory::Allocate((size_t) RTP_BATCH_SIZE * rx_size_,
+                                       memory_hugepages_, MemoryNode(true));
+    rx_msgs_ = (struct mmsghdr *) calloc(RTP_BATCH_SIZE, sizeof(struct mmsghdr));
+    rx_iov_ = (struct iovec *) calloc(RTP_BATCH_SIZE, sizeof(struct iovec));
+    for (int c = 0; c < RTP_BATCH_SIZE; c++) {
+      rx_iov_[c].iov_base = &rx_buffer_[(size_t) c * rx_size_];
+      rx_iov_[c].iov_len = rx_size_;
+      rx_msgs_[c].msg_hdr.msg_iov = &rx_iov_[c];
+      rx_msgs_[c].msg_hdr.msg_iovlen = 1;
+    }
+#if !(__MINGW64__ || __MINGW32__)
+    /* Room for the kernel receive timestamp and the coalesced packet size */
+    free(rx_cmsg_);
+    rx_cmsg_ = 0;
+    if (RTP_TRACE || rx_gro_)
+      rx_cmsg_ = (char *) calloc(RTP_BATCH_SIZE, RX_CMSG_SPACE);
 #endif
+#if RTP_TRACE && !(__MINGW64__ || __MINGW32__)
+    /* Kernel receive timestamps to time the socket queue */
+    {
+      int on = 1;
+
+      setsockopt(sockfd_in_, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+    }
+#endif
+
+    if (!rx_running_) {
+      pthread_attr_t tattr;
+      sched_param param;
+
+      // Elevate priority to get the RTP packets in quickly
+      pthread_attr_init(&tattr);
+      pthread_attr_setinheritsched(&tattr, PTHREAD_EXPLICIT_SCHED);
+      pthread_attr_setschedpolicy(&tattr, SCHED_FIFO);
+      param.sched_priority = 99;
+      pthread_attr_setschedparam(&tattr, &param);
+
+      rx_running_ = true;
+      if (pthread_create(&rx_thread_, &tattr, ReceiveThread, this) != 0) {
+        /* Not allowed real time priority, run as a normal thread */
+        if (pthread_create(&rx_thread_, NULL, ReceiveThread, this) != 0) {
+          cout << "ERROR starting receive thread\n";
+          rx_running_ = false;
+          pthread_attr_destroy(&tattr);
+          return false;
+        }
+      }
+      pthread_attr_destroy(&tattr);
+
+      /* More receive threads on sockets of their own, rx_thread_ is lane 0 */
+      if (LanesWanted())
+        OpenLanes();
+      else if (rx_lanes_wanted_ > 1)
+        cout << "[RTP] Lanes need a unicast socket, receiving on one thread\n";
+    }
   }
 
   if (port_no_out_) {
@@ -169,22 +804,199 @@ bool RtpStream::Open() {
       return error;
     }
 
-    /* gethostbyname: get the server's DNS entry */
-    server_out_ = gethostbyname(hostname_out_);
-    if (server_out_ == NULL) {
-      fprintf(stderr, "ERROR, no such host as %s\n", hostname_out_);
-      exit(0);
+    /* The receiver's address, then any extra unicast destinations */
+    if (!Resolve(hostname_out_, port_no_out_, &server_addr_out_)) {
+      cout << "ERROR, no such host as " << hostname_out_ << "\n";
+      return false;
     }
+    server_len_out_ = sizeof(server_addr_out_);
+    tx_dest_.assign(1, server_addr_out_);
+    for (size_t c = 0; c < tx_extra_.size(); c++) {
+      struct sockaddr_in addr;
 
-    /* build the server's Internet address */
-    bzero((char *) &server_addr_out_, sizeof(server_addr_out_));
-    server_addr_out_.sin_family = AF_INET;
-    bcopy((char *) server_out_->h_addr,
-          (char *) &server_addr_out_.sin_addr.s_addr, server_out_->h_length);
-    server_addr_out_.sin_port = htons(port_no_out_);
+      if (!Resolve(tx_extra_[c].first.c_str(), tx_extra_[c].second, &addr)) {
+        cout << "ERROR, no such host as " << tx_extra_[c].first << "\n";
+        return false;
+      }
+      tx_dest_.push_back(addr);
+    }
 
-    /* send the message to the server */
-    server_len_out_ = sizeof(server_addr_out_);
+    MulticastOut(sockfd_out_);
+
+    /* work out the packet layout and allocate a batch of packet buffers */
+    packetizer_.SetFormat(&format_);
+    tx_partial_.SetFormat(&format_);
+    if (packetizer_.Layout(height_, width_, mtu_) == 0) {
+      cout << "ERROR MTU " << mtu_ << " too small\n";
+      return false;
+    }
+    tx_headers_.Build(&packetizer_, RTP_PAYLOAD_TYPE, source_);
+    tx_dirty_.Reset(VideoRows(&format_, height_));
+    FrameMemory::Free(tx_buffer_);
+    free(tx_msgs_);
+    free(tx_iov_);
+    free(tx_cmsg_);
+    tx_cmsg_ = 0;
+    //
+    // One message per packet per destination, a packet's copies are next to
+    // each other and share its iovecs (and SO_TXTIME control message)
+    //
+    tx_buffer_ = FrameMemory::Allocate(RTP_BATCH_SIZE * mtu_, memory_hugepages_,
+                                       MemoryNode(false));
+    tx_msgs_ = (struct mmsghdr *) calloc(RTP_BATCH_SIZE * tx_dest_.size(),
+                                         sizeof(struct mmsghdr));
+    tx_iov_ = (struct iovec *) calloc(RTP_BATCH_SIZE * 2, sizeof(struct iovec));
+    for (int c = 0; c < RTP_BATCH_SIZE; c++) {
+      tx_iov_[c * 2].iov_base = &tx_buffer_[c * mtu_];
+      for (size_t d = 0; d < tx_dest_.size(); d++) {
+        struct msghdr *msg = &tx_msgs_[c * tx_dest_.size() + d].msg_hdr;
+
+        msg->msg_name = &tx_dest_[d];
+        msg->msg_namelen = sizeof(tx_dest_[d]);
+        msg->msg_iov = &tx_iov_[c * 2];
+        msg->msg_iovlen = 1;
+      }
+    }
+
+    /* The same for whole packets from SendPackets(), never paced */
+    free(tx_raw_msgs_);
+    free(tx_raw_iov_);
+    tx_raw_msgs_ = (struct mmsghdr *) calloc(RTP_BATCH_SIZE * tx_dest_.size(),
+                                             sizeof(struct mmsghdr));
+    tx_raw_iov_ = (struct iovec *) calloc(RTP_BATCH_SIZE * 2,
+                                          sizeof(struct iovec));
+    for (int c = 0; c < RTP_BATCH_SIZE * (int) tx_dest_.size(); c++) {
+      tx_raw_msgs_[c].msg_hdr.msg_name = &tx_dest_[c % tx_dest_.size()];
+      tx_raw_msgs_[c].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    }
+
+#ifdef SO_TXTIME
+    /* Kernel pacing, every packet carries its launch time */
+    if (pacer_.Enabled() && pacer_.KernelPacing(sockfd_out_)) {
+      tx_cmsg_ = (char *) calloc(RTP_BATCH_SIZE, CMSG_SPACE(sizeof(uint64_t)));
+      for (int c = 0; c < RTP_BATCH_SIZE; c++) {
+        struct cmsghdr *cmsg;
+
+        for (size_t d = 0; d < tx_dest_.size(); d++) {
+          struct msghdr *msg = &tx_msgs_[c * tx_dest_.size() + d].msg_hdr;
+
+          msg->msg_control = &tx_cmsg_[c * CMSG_SPACE(sizeof(uint64_t))];
+          msg->msg_controllen = CMSG_SPACE(sizeof(uint64_t));
+        }
+        cmsg = CMSG_FIRSTHDR(&tx_msgs_[c * tx_dest_.size()].msg_hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_TXTIME;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+      }
+    }
+#endif
+
+    /* A message per run of packets per destination, filled in as they go */
+    free(tx_gso_msgs_);
+    free(tx_gso_iov_);
+    free(tx_gso_cmsg_);
+    tx_gso_msgs_ = 0;
+    tx_gso_iov_ = 0;
+    tx_gso_cmsg_ = 0;
+    tx_gso_ = false;
+#ifdef UDP_SEGMENT
+    if (offload_wanted_) {
+      int size = 0;
+      socklen_t len = sizeof(size);
+
+      if (tx_cmsg_)
+        cout << "[RTP] UDP_SEGMENT not used with kernel pacing\n";
+      else if (getsockopt(sockfd_out_, SOL_UDP, UDP_SEGMENT, &size, &len) < 0)
+        cout << "[RTP] UDP_SEGMENT not supported, sending packets\n";
+      else {
+        tx_gso_msgs_ = (struct mmsghdr *) calloc(RTP_BATCH_SIZE *
+                                                 tx_dest_.size(),
+                                                 sizeof(struct mmsghdr));
+        tx_gso_iov_ = (struct iovec *) calloc(RTP_BATCH_SIZE * 2,
+                                              sizeof(struct iovec));
+        tx_gso_cmsg_ = (char *) calloc(RTP_BATCH_SIZE,
+                                       CMSG_SPACE(sizeof(uint16_t)));
+        for (int c = 0; c < RTP_BATCH_SIZE; c++) {
+          struct cmsghdr *cmsg = (struct cmsghdr *)
+            &tx_gso_cmsg_[c * CMSG_SPACE(sizeof(uint16_t))];
+
+          cmsg->cmsg_level = SOL_UDP;
+          cmsg->cmsg_type = UDP_SEGMENT;
+          cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        }
+        cout << "[RTP] Sending with UDP_SEGMENT\n";
+        tx_gso_ = true;
+      }
+    }
+#endif
+
+    /* Batches go out through one io_uring_enter() on a registered socket */
+    if (io_backend_ == IO_URING) {
+      if (tx_uring_.Setup(RTP_BATCH_SIZE) && tx_uring_.RegisterFiles(1) &&
+          tx_uring_.SetFile(0, sockfd_out_))
+        cout << "[RTP] Sending through io_uring\n";
+      else {
+        tx_uring_.Close();
+        cout << "[RTP] io_uring unavailable, sending with sendmmsg()\n";
+      }
+    }
+
+    /* Band threads, sharing the stream's source port if they can */
+    CloseBands();
+    if ((tx_bands_wanted_ > 1) && session_)
+      cout << "[RTP] Bands are not used with a session\n";
+    else if (tx_bands_wanted_ > 1) {
+      int port = 0;
+#if defined(SO_REUSEPORT) && !(__MINGW64__ || __MINGW32__)
+      struct sockaddr_in local;
+      socklen_t len = sizeof(local);
+      int on = 1;
+
+      memset(&local, 0, sizeof(local));
+      local.sin_family = AF_INET;
+      local.sin_addr.s_addr = htonl(INADDR_ANY);
+      if ((setsockopt(sockfd_out_, SOL_SOCKET, SO_REUSEPORT, &on,
+                      sizeof(on)) == 0) &&
+          (bind(sockfd_out_, (struct sockaddr *) &local, sizeof(local)) == 0) &&
+          (getsockname(sockfd_out_, (struct sockaddr *) &local, &len) == 0))
+        port = ntohs(local.sin_port);
+#endif
+      for (int c = 0; c < tx_bands_wanted_; c++) {
+        RtpBand *band = new RtpBand(this, c);
+        int cpu = tx_band_cpus_.empty() ? -1 :
+          tx_band_cpus_[c % tx_band_cpus_.size()];
+
+        tx_bands_.push_back(band);
+        if (!band->Open(port, cpu)) {
+          CloseBands();
+          break;
+        }
+      }
+      if (tx_bands_.empty())
+        cout << "[RTP] Bands unavailable, sending from one thread\n";
+      else
+        cout << "[RTP] Sending in " << tx_bands_.size() << " bands\n";
+    }
+
+    /* Reopen the queue a previous Close() shut down */
+    if (!tx_running_)
+      tx_queue_.Reset();
+
+    /* Hand the stream to its session's worker pool */
+    if (session_ && !tx_running_) {
+      session_->Attach(this);
+      tx_running_ = true;
+    }
+#if RTP_THREADED
+    /* Start the sender, it lives until Close() */
+    if (!tx_running_) {
+      if (pthread_create(&tx_thread_, NULL, TransmitThread, this) != 0) {
+        cout << "ERROR starting transmit thread\n";
+        return false;
+      }
+      tx_running_ = true;
+    }
+#endif
 #if 0
     int n = sendto(sockfd_out_, (char *) "hello", 5, 0,
                    (const sockaddr *) &server_addr_out_, server_len_out_);
@@ -200,266 +1012,1010 @@ bool RtpStream::Open() {
 }
 
 void RtpStream::Close() {
-  if (port_no_in_) {
-    close(sockfd_in_);
+  StopRecording();
+  if (rx_running_) {
+    rx_running_ = false;
+    if (rx_uring_) {
+      /* Returns once the shared receiver has cancelled our receive */
+      UringReceiver::Shared()->Detach(this);
+      rx_uring_ = false;
+    } else {
+      /* Wake the receiver out of recvmmsg() then wait for it */
+      shutdown(sockfd_in_, SHUT_RDWR);
+      pthread_join(rx_thread_, 0);
+    }
+    /* Stopped but kept until the next Open(), Statistics() still counts them */
+    for (size_t c = 0; c < rx_lanes_.size(); c++)
+      rx_lanes_[c]->Close();
+    rx_gro_ = false;
+    rx_size_ = MAX_UDP_DATA;
+    rx_ring_.Close();
+    rx_lease_.Release();
+    rx_jitter_buffer_.Flush();
+    rx_pool_.Free();
   }
 
-  if (port_no_out_) {
-    close(sockfd_out_);
+  if (tx_running_ && session_) {
+    /* The session sends whatever is still queued, then lets go */
+    session_->Detach(this);
+    tx_running_ = false;
   }
-}
 
-#if ENDIAN_SWAP
-void EndianSwap32(uint32_t * data, int length) {
-  int c = 0;
+  if (tx_running_) {
+    /* Let the sender drain the queue then stop */
+    tx_queue_.Shutdown();
+    pthread_join(tx_thread_, 0);
+    tx_running_ = false;
+  }
+  tx_uring_.Close();
+  CloseBands();
+
+  if (sockfd_in_ >= 0) {
+    close(sockfd_in_);
+    sockfd_in_ = -1;
+  }
 
-  for (c = 0; c < length; c++)
-    data[c] = __bswap_32(data[c]);
+  if (sockfd_out_ >= 0) {
+    close(sockfd_out_);
+    sockfd_out_ = -1;
+  }
 }
-void EndianSwap16(uint16_t * data, int length) {
-  int c = 0;
 
-  for (c = 0; c < length; c++)
-    data[c] = __bswap_16(data[c]);
-}
-#endif
-void RtpStream::UpdateHeader(Header * packet, int line, int last,
-                             int32_t timestamp, int32_t source) {
-  bzero((char *) packet, sizeof(Header));
-  packet->rtp.protocol = RTP_VERSION << 30;
-  packet->rtp.protocol = packet->rtp.protocol | RTP_PAYLOAD_TYPE << 16;
-  packet->rtp.protocol = packet->rtp.protocol | sequence_number_++;
-  /* leaving other fields as zero TODO Fix */
-  packet->rtp.timestamp = timestamp += (Hz90 / RTP_FRAMERATE);
-  packet->rtp.source = source;
-  packet->payload.extended_sequence_number = 0; /* TODO : Fix extended seq numbers */
-  packet->payload.line[0].length = width_ * 2;
-  packet->payload.line[0].line_number = line;
-  packet->payload.line[0].offset = 0;
-  if (last == 1) {
-    packet->rtp.protocol = packet->rtp.protocol | 1 << 23;
-  }
+/* Depacketize() for rx_thread_ and the io_uring receiver */
+int RtpStream::Depacketize(char *data, int len) {
+  return Depacketize(data, len, &rx_track_, rx_now_);
 }
 
-void *ReceiveThread(void *data) {
-  TxData *arg;
-  ssize_t len = 0;
-  RtpPacket *packet;
-  bool receiving = true;
+//
+// Depacketize one datagram straight into the frame buffer. Returns 1 if the
+// packet carried the marker bit (last packet of the frame), 0 if not and -1
+// if it was not a valid packet for this stream. Lanes call it at the same
+// time, each with its own track and arrival time.
+//
+int RtpStream::Depacketize(char *data, int len, RxTrack *track, uint64_t now) {
+  RtpPacket *packet = (RtpPacket *) data;
+  int frame_size = VideoFrameBytes(&format_, height_, width_);
+  int rows = VideoRows(&format_, height_);
+  int row_bytes = VideoHostRowBytes(&format_, width_);
   int scancount = 0;
-  int lastpacket;
+  int marker;
+  int slot;
+  char *frame;
+  bool scanline = true;
+  uint32_t protocol;
+  uint32_t timestamp;
 
-  arg = (TxData *) data;
+  if (rx_recording_)
+    rx_recorder_.Write(data, len, now);
+  if (len < RTP_HEADER_SIZE + RTP_LINE_HEADER_SIZE)
+    return -1;
 
-  while (receiving) {
-    int marker;
+  protocol = RtpNet32(packet->head.rtp.protocol);
+  timestamp = RtpNet32(packet->head.rtp.timestamp);
 
+  //
+  // Decode Header bits and confirm RTP packet
+  //
 #if RTP_CHECK
-    int version;
-    int payloadType;
-    int seqNo, last;
+  {
+    int payloadType = (protocol & 0x007F0000) >> 16;
+    int version = (protocol & 0xC0000000) >> 30;
+
+    if ((payloadType != RTP_PAYLOAD_TYPE) || (version != RTP_VERSION))
+      return -1;
+  }
 #endif
-    bool valid = false;
+  marker = (protocol & RTP_MARKER_BIT) >> 23;
+
+  {
+    uint16_t ext = RtpNet16(packet->head.payload.extended_sequence_number);
+    uint32_t seq;
+
+    seq = ((uint32_t) ext << 16) | (protocol & 0xFFFF);
+    TrackSequence(track, now, seq, timestamp, len);
+  }
+
+  //
+  // Count the number of scanlines in the packet
+  //
+  while (scanline) {
+    int more;
+
+    if ((scancount == NUM_LINES_PER_PACKET) ||
+        (RtpPacketizer::HeaderSize(scancount + 1) > len))
+      return -1;
+    more = (RtpNet16(packet->head.payload.line[scancount].offset) & 0x8000) >> 15;
+    if (!more)
+      scanline = false;         // The last scanline
+    scancount++;
+  }
+
+  /* Frame for this timestamp, held until Received(), late packets dropped */
+  slot = rx_jitter_buffer_.Frame(timestamp, now);
+  if (slot < 0)
+    return -1;
+  frame = rx_jitter_buffer_.Data(slot);
+
+  //
+  // Now we know the number of scanlines we can copy the data
+  //
+  int payloadoffset = RtpPacketizer::HeaderSize(scancount);
+  int payload = 0;
+
+  for (int c = 0; c < scancount; c++) {
+    uint32_t os;
+    uint32_t pixel;
+    uint32_t length;
+    uint32_t offset;
+    uint32_t row;
+    uint32_t host;
+
+    os = payloadoffset + payload;
+    row = (RtpNet16(packet->head.payload.line[c].line_number) & 0x7FFF) /
+      format_.yinc;
+    offset = RtpNet16(packet->head.payload.line[c].offset) & 0x7FFF;
+    length = RtpNet16(packet->head.payload.line[c].length);
+    pixel = row * row_bytes + offset / format_.xinc * format_.host;
+    host = length / format_.pgroup * format_.host;
 
     //
-    // Read data until we get the next RTP header
+    // Never trust the wire, drop anything that runs off the packet or frame
+    // or is not whole pixel groups
     //
-    while (!valid) {
-      //
-      // Read in the RTP data
-      // 
-      len =
-        recvfrom(arg->stream->sockfd_in_, arg->stream->udpdata, MAX_UDP_DATA, 0,
-                 NULL, NULL);
-
-      packet = (RtpPacket *) arg->stream->udpdata;
-#if ENDIAN_SWAP
-      EndianSwap32((uint32_t *) packet, sizeof(RtpHeader) / 4);
-#endif
-      //
-      // Decode Header bits and confirm RTP packet
-      //
-#if RTP_CHECK
-      payloadType = (packet->head.rtp.protocol & 0x007F0000) >> 16;
-      version = (packet->head.rtp.protocol & 0xC0000000) >> 30;
-      seqNo = (packet->head.rtp.protocol & 0x0000FFFF);
-      if ((payloadType == 96) && (version == 2))
+    if ((length % format_.pgroup) || (offset % format_.xinc) ||
+        (row >= (uint32_t) rows) || (os + length > (uint32_t) len) ||
+        (pixel + host > (uint32_t) frame_size))
+      break;
+#if GST_1_FUDGE
+    format_.unpack((uint8_t *) & data[os], (uint8_t *) & frame[pixel + 3],
+                   length / format_.pgroup * format_.samples);
+#else
+    format_.unpack((uint8_t *) & data[os], (uint8_t *) & frame[pixel],
+                   length / format_.pgroup * format_.samples);
 #endif
-      {
-#if 0
-        if (seqNo != last + 1) {
+    rx_jitter_buffer_.Line(slot, row, offset / format_.xinc,
+                           length / format_.pgroup);
+    payload += length;
+  }
 
-          printf("Dropped %d packets (%d to %d)\n", seqNo - last, last, seqNo);
-          last = seqNo;
-        }
+  if (marker)
+    rx_jitter_buffer_.Marker(slot, now);
+  rx_jitter_buffer_.Received(slot, now);
+  return marker;
+}
+
+//
+// Start counting from seq, on the first packet or once the sender has
+// restarted. Everything before it counts as received, and for the span
+// worked out across lanes the packets so far as if they came just before it.
+//
+static void RestartTrack(RxTrack *track, uint32_t seq) {
+  RtpStatsCounters *stats = track->stats;
+  uint64_t packets = stats->packets_.load(std::memory_order_relaxed) -
+    stats->duplicates_.load(std::memory_order_relaxed);
+
+  track->synced = true;
+  track->expected = seq;
+  track->bad = seq - 1;
+  memset(track->seen, 0xff, sizeof(track->seen));
+  stats->first_.store(seq - (packets - 1), std::memory_order_relaxed);
+}
+
+//
+// Loss, reordering and jitter accounting for one packet using the RFC 4175
+// extended sequence number, with the RFC 3550 A.1 checks scaled up for video
+// packet rates. Late packets are counted by the jitter buffer.
+//
+void RtpStream::TrackSequence(RxTrack *track, uint64_t now, uint32_t seq,
+                              uint32_t timestamp, int len) {
+  RtpStatsCounters *stats = track->stats;
+  uint32_t delta;
+  uint64_t *seen;
+  uint64_t bit;
+
+  RtpStatsCounters::Add(stats->packets_, 1);
+  RtpStatsCounters::Add(stats->bytes_, len);
+
+  if (!track->synced) {
+    RestartTrack(track, seq);
+    track->timestamp = timestamp;
+    track->transit = (now * 9 / 100000) - timestamp;
+  }
+
+  delta = seq - track->expected;
+  seen = &track->seen[(seq % RTP_MAX_MISORDER) / 64];
+  bit = 1ULL << (seq & 63);
+  if ((delta >= RTP_MAX_DROPOUT) && (-delta > RTP_MAX_MISORDER)) {
+    if (seq != track->bad) {
+      /* Too far to be loss or reordering, believe it if the next follows */
+      track->bad = seq + 1;
+      return;
+    }
+    /* Two in a row after a jump, the sender has restarted */
+    RestartTrack(track, seq);
+    delta = 0;
+  }
+
+  if (delta < RTP_MAX_DROPOUT) {
+    /* Anything skipped is lost until it turns up */
+    RtpStatsCounters::Add(stats->lost_, delta);
+    if (delta >= RTP_MAX_MISORDER)
+      memset(track->seen, 0, sizeof(track->seen));
+    for (uint32_t c = 0; (c < delta) && (delta < RTP_MAX_MISORDER); c++) {
+      uint32_t missing = track->expected + c;
+
+      track->seen[(missing % RTP_MAX_MISORDER) / 64] &=
+        ~(1ULL << (missing & 63));
+    }
+    *seen |= bit;
+    track->expected = seq + 1;
+    stats->next_.store(track->expected, std::memory_order_relaxed);
+  } else if (*seen & bit) {
+    /* Behind the newest and received already, or from before the first */
+    RtpStatsCounters::Add(stats->duplicates_, 1);
+  } else {
+    /* Filled a gap we already counted as lost */
+    *seen |= bit;
+    RtpStatsCounters::Add(stats->reordered_, 1);
+    RtpStatsCounters::Add(stats->lost_, -1);
+  }
+
+  /* RFC 3550 A.8 interarrival jitter, measured on the first packet of a frame */
+  if ((int32_t) (timestamp - track->timestamp) > 0) {
+    uint32_t arrival = now * 9 / 100000;        /* 90kHz */
+    int32_t transit = arrival - timestamp;
+    int32_t d = transit - track->transit;
+
+    track->transit = transit;
+    if (d < 0)
+      d = -d;
+    track->jitter += d - ((track->jitter + 8) >> 4);
+    stats->jitter_.store(track->jitter >> 4, std::memory_order_relaxed);
+    track->timestamp = timestamp;
+  }
+}
+
+//
+// Pull in as many datagrams as are waiting, blocking for the first one.
+// Returns the number of packets in rx_msgs_. From the packet ring rx_iov_
+// points into the ring until the next call.
+//
+int RtpStream::ReceiveBatch() {
+  if (rx_ring_.Active()) {
+    int n = rx_ring_.Next(rx_iov_, RTP_BATCH_SIZE);
+
+    for (int c = 0; c < n; c++)
+      rx_msgs_[c].msg_len = rx_iov_[c].iov_len;
+    return n;
+  }
+#if __MINGW64__ || __MINGW32__
+  int n = recvfrom(sockfd_in_, (char *) rx_iov_[0].iov_base, MAX_UDP_DATA, 0,
+                   NULL, NULL);
+  if (n < 0)
+    return n;
+  rx_msgs_[0].msg_len = n;
+  return n ? 1 : 0;
 #else
-        valid = true;
+  /* The kernel shortens msg_controllen to what it wrote */
+  for (int c = 0; rx_cmsg_ && (c < RTP_BATCH_SIZE); c++) {
+    rx_msgs_[c].msg_hdr.msg_control = &rx_cmsg_[c * RX_CMSG_SPACE];
+    rx_msgs_[c].msg_hdr.msg_controllen = RX_CMSG_SPACE;
+  }
+  return recvmmsg(sockfd_in_, rx_msgs_, RTP_BATCH_SIZE, MSG_WAITFORONE, NULL);
 #endif
-      }
+}
+
+#if RTP_TRACE && !(__MINGW64__ || __MINGW32__)
+//
+// How long each datagram of a batch sat on the socket, from the kernel's
+// receive timestamp to now. Both are CLOCK_REALTIME.
+//
+static void TraceSocketQueue(struct mmsghdr *msgs, int n) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  for (int c = 0; c < n; c++) {
+    struct cmsghdr *cmsg;
+
+    for (cmsg = CMSG_FIRSTHDR(&msgs[c].msg_hdr); cmsg;
+         cmsg = CMSG_NXTHDR(&msgs[c].msg_hdr, cmsg)) {
+      struct timespec ts;
+      int64_t ns;
+
+      if ((cmsg->cmsg_level != SOL_SOCKET) ||
+          (cmsg->cmsg_type != SCM_TIMESTAMPNS))
+        continue;
+      memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+      ns = (int64_t) (now.tv_sec - ts.tv_sec) * 1000000000 +
+        (now.tv_nsec - ts.tv_nsec);
+      if (ns >= 0)
+        RTP_TRACE_NS(TRACE_RX_SOCKET, ns);
     }
-    if (valid) {                // Start to decode packet   
-      bool scanline = true;
+  }
+}
+#endif
 
-      // Decode Header bits
-      marker = (packet->head.rtp.protocol & 0x00800000) >> 23;
-#if RTP_CHECK
-      printf
-        ("[RTP] seqNo %d, Packet %d, marker %d, Rx length %d, timestamp 0x%08x\n",
-         seqNo, payloadType, marker, len, packet->head.rtp.timestamp);
+//
+// The jitter buffer has published a frame to Recieve(), pass it on to the
+// application's callback.
+//
+void RtpStream::FrameReady(char *frame, const FrameCoverage * coverage,
+                           void *data) {
+  RtpStream *stream = (RtpStream *) data;
+
+  stream->frame_++;
+  if (stream->rx_callback_)
+    stream->rx_callback_(frame, coverage, stream->rx_user_);
+}
+
+/* Packet size of a UDP_GRO run, 0 if the message is a single datagram */
+static int GroSize(struct msghdr *msg) {
+#ifdef UDP_GRO
+  struct cmsghdr *cmsg;
+
+  for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+    if ((cmsg->cmsg_level == SOL_UDP) && (cmsg->cmsg_type == UDP_GRO)) {
+      int size;
+
+      memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+      return size;
+    }
+  }
 #endif
+  return 0;
+}
+
+//
+// Long lived receiver, one per stream, runs from Open() until Close()
+//
+void *ReceiveThread(void *data) {
+  RtpStream *stream = (RtpStream *) data;
 
-      //
-      // Count the number of scanlines in the packet
-      //
-      while (scanline) {
-        int more;
+  while (stream->rx_running_) {
+    int n = stream->ReceiveBatch();
 
-#if ENDIAN_SWAP
-        EndianSwap16((uint16_t *) & packet->head.payload.line[scancount],
-                     sizeof(LineHeader) / 2);
+    stream->rx_now_ = RtpPacer::Now();
+    if (n < 0) {
+      if ((errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        stream->rx_jitter_buffer_.Expire(stream->rx_now_);
+        continue;
+      }
+      cout << "[RTP] Receive socket failure fd=" << stream->sockfd_in_ << "\n";
+      break;
+    }
+#if RTP_TRACE && !(__MINGW64__ || __MINGW32__)
+    TraceSocketQueue(stream->rx_msgs_, n);
 #endif
-        more = (packet->head.payload.line[scancount].offset & 0x8000) >> 15;
-        if (!more)
-          scanline = false;     // The last scanline
-        scancount++;
+    {
+      RTP_TRACE_SCOPE(TRACE_RX_DEPACKETIZE);
+
+      for (int c = 0; c < n; c++) {
+        char *data = (char *) stream->rx_iov_[c].iov_base;
+        int len = stream->rx_msgs_[c].msg_len;
+        int size = stream->rx_gro_ ? GroSize(&stream->rx_msgs_[c].msg_hdr) : 0;
+
+        /* A coalesced run splits back into packets of size, the last shorter */
+        if (size <= 0)
+          size = len;
+        for (int offset = 0; offset < len; offset += size)
+          stream->Depacketize(&data[offset], std::min(size, len - offset));
       }
+    }
+    stream->rx_jitter_buffer_.Expire(stream->rx_now_);
+  }
+  return 0;
+}
 
-      //
-      // Now we know the number of scanlines we can copy the data
-      //
-      int payloadoffset =
-        sizeof(RtpHeader) + 2 + (scancount * sizeof(LineHeader));
-      int payload = 0;
-
-      lastpacket = payloadoffset;
-      for (int c = 0; c < scancount; c++) {
-        uint32_t os;
-        uint32_t pixel;
-        uint32_t length;
-
-        os = payloadoffset + payload;
-        pixel =
-          ((packet->head.payload.line[c].offset & 0x7FFF) * 2) +
-          ((packet->head.payload.line[c].line_number & 0x7FFF) *
-           (arg->width * 2));
-        length = packet->head.payload.line[c].length & 0xFFFF;
+/* Called on the receive thread every time a frame is published */
+void RtpStream::SetFrameCallback(FrameReadyCallback callback, void *user) {
+  rx_callback_ = callback;
+  rx_user_ = user;
+}
 
-#if GST_1_FUDGE
-        memcpy(&arg->stream->buffer_in_[pixel + 3], &arg->stream->udpdata[os],
-               length);
+//
+// Lease the next completed frame. timeout is in milliseconds, ULONG_MAX waits
+// forever. The frame is not overwritten until the lease is released.
+//
+bool RtpStream::Recieve(FrameLease * lease, unsigned long timeout) {
+  if (!rx_running_)
+    return false;
+  return rx_pool_.Acquire(lease, timeout);
+}
+
+//
+// Wait for the next completed frame, the pointer stays valid until the next
+// call to Recieve(). Returns false if no frame completed in time.
+//
+bool RtpStream::Recieve(void **cpu, unsigned long timeout) {
+  if (!Recieve(&rx_lease_, timeout))
+    return false;
+  *cpu = (void *) rx_lease_.Data();
+  return true;
+}
+
+//
+// Send count whole RTP packets, e.g. from a capture, to every destination as
+// they are, each packet parts (1 or 2) iovecs of iov such as a rewritten
+// header and the rest of the packet. Not paced and not while the stream is
+// transmitting frames, the caller times them. Returns the packets sent or -1.
+//
+int RtpStream::SendPackets(const struct iovec *iov, int count, int parts) {
+  size_t dests = tx_dest_.size();
+  int sent = 0;
+
+  if ((sockfd_out_ < 0) || !tx_raw_msgs_ || (parts < 1) || (parts > 2))
+    return -1;
+  while (sent < count) {
+    int n = std::min(count - sent, RTP_BATCH_SIZE);
+
+    memcpy(tx_raw_iov_, &iov[sent * parts], n * parts * sizeof(struct iovec));
+    for (int c = 0; c < n; c++) {
+      for (size_t d = 0; d < dests; d++) {
+        tx_raw_msgs_[c * dests + d].msg_hdr.msg_iov = &tx_raw_iov_[c * parts];
+        tx_raw_msgs_[c * dests + d].msg_hdr.msg_iovlen = parts;
+      }
+    }
+    if (SendBatch(tx_raw_msgs_, n * dests) < 0) {
+      cout << "[RTP] Transmit socket failure fd=" << sockfd_out_ << "\n";
+      return -1;
+    }
+    sent += n;
+  }
+  return sent;
+}
+
+//
+// Hand a batch of packets to the kernel, sendmmsg() may send fewer than asked
+// so keep going until the whole batch has gone.
+//
+int RtpStream::SendBatch(struct mmsghdr *msgs, int count) {
+  int sent = 0;
+  RTP_TRACE_SCOPE(TRACE_TX_SEND);
+
+  if (tx_uring_.Active())
+    return UringSend(msgs, count);
+  while (sent < count) {
+#if __MINGW64__ || __MINGW32__
+    struct msghdr *msg = &msgs[sent].msg_hdr;
+    char flat[RTP_MAX_MTU];
+    size_t len = 0;
+
+    /* No scatter/gather sendto() so gather into one buffer */
+    for (size_t i = 0; i < msg->msg_iovlen; i++) {
+      memcpy(&flat[len], msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len);
+      len += msg->msg_iov[i].iov_len;
+    }
+    int n = sendto(sockfd_out_, flat, len, 0,
+                   (const sockaddr *) msg->msg_name, msg->msg_namelen);
+    if (n >= 0)
+      n = 1;
 #else
-        memcpy(&arg->stream->buffer_in_[pixel], &arg->stream->udpdata[os],
-               length);
+    int n = sendmmsg(sockfd_out_, &msgs[sent], count - sent, 0);
 #endif
-        lastpacket += length;
-        payload += length;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return n;
+    }
+    sent += n;
+  }
+  return sent;
+}
+
+//
+// SendBatch() through io_uring, a sendmsg() per message all submitted and
+// waited for in one io_uring_enter(). Not linked, linking halves the rate,
+// so a full socket buffer may reorder a few packets. Each carries its line
+// and offset so the receiver puts them in place regardless.
+//
+int RtpStream::UringSend(struct mmsghdr *msgs, int count) {
+#ifdef __linux__
+  int sent = 0;
+
+  while (sent < count) {
+    struct io_uring_sqe *sqe;
+    int queued = 0;
+    int failed = 0;
+
+    while ((sent + queued < count) && (sqe = tx_uring_.Sqe())) {
+      sqe->opcode = IORING_OP_SENDMSG;
+      sqe->fd = 0;
+      sqe->flags = IOSQE_FIXED_FILE;
+      sqe->addr = (uint64_t) (uintptr_t) & msgs[sent + queued].msg_hdr;
+      sqe->user_data = sent + queued;
+      queued++;
+    }
+    while (tx_uring_.Ready() < (unsigned) queued) {
+      if (tx_uring_.Submit(queued - tx_uring_.Ready()) < 0)
+        return -1;
+    }
+    for (int c = 0; c < queued; c++) {
+      struct io_uring_cqe *cqe = tx_uring_.Completion(c);
+
+      if ((cqe->res < 0) && !failed)
+        failed = cqe->res;
+    }
+    tx_uring_.Consume(queued);
+    if (failed) {
+      errno = -failed;
+      return -1;
+    }
+    sent += queued;
+  }
+  return sent;
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+//
+// Start sending a frame. RGB frames are converted a packet at a time straight
+// into the payload, so the source is read once and the UYVY data never leaves
+// the batch buffers.
+//
+void RtpStream::BeginFrame(TxData *frame) {
+  RTP_TRACE_SPAN(TRACE_TX_QUEUE, frame->queued);
+  tx_started_ = RTP_TRACE_NOW();
+  tx_frame_ = *frame;
+  tx_active_ = true;
+  tx_packet_ = 0;
+  tx_batch_ = 0;
+  tx_convert_ = 0;
+  tx_pixel_bytes_ = 0;
+  if (frame->format != PIXEL_UYVY) {
+    tx_convert_ = ColourLineKernel(ColourKernelsBest(), frame->format,
+                                   PIXEL_UYVY);
+    tx_pixel_bytes_ = PixelBytes(frame->format);
+  }
+
+  //
+  // Changed lines only, the layout and its headers are built for this frame.
+  // The source is hashed as it is, before any conversion.
+  //
+  tx_layout_ = &packetizer_;
+  tx_builder_ = &tx_headers_;
+  if (tx_dirty_.Enabled()) {
+    const uint8_t *lines;
+    RTP_TRACE_SCOPE(TRACE_TX_DIRTY);
+
+    if (tx_convert_)
+      lines = tx_dirty_.Update((uint8_t *) frame->rgbframe,
+                               width_ * tx_pixel_bytes_);
+    else
+      lines = tx_dirty_.Update((uint8_t *) frame->yuvframe,
+                               VideoHostRowBytes(&format_, width_));
+    if (!tx_dirty_.Full()) {
+      tx_partial_.Layout(height_, width_, mtu_, lines);
+      tx_partial_headers_.Build(&tx_partial_, RTP_PAYLOAD_TYPE, source_);
+      tx_layout_ = &tx_partial_;
+      tx_builder_ = &tx_partial_headers_;
+    }
+  }
+
+  if (pacer_.Enabled())
+    pacer_.StartFrame(tx_layout_->FrameBytes() * tx_dest_.size(),
+                      RTP_PACING_BURST * mtu_ * tx_dest_.size());
+
+  /* 90kHz sampling time of the frame */
+  tx_time_ = (pacer_.Enabled() ? pacer_.FrameStart() : RtpPacer::Now()) *
+    9 / 100000;
+}
+
+//
+// Header and payload of packet n of the frame into iov[0]'s buffer, or the
+// payload left in the frame as iov[1] for zero copy. Returns the iovecs
+// used. Only reads the stream, bands call it at the same time.
+//
+int RtpStream::WritePacket(int n, uint32_t sequence, struct iovec *iov) {
+  TxData *arg = &tx_frame_;
+  const PacketLayout *layout = tx_layout_->Packet(n);
+  char *packet = (char *) iov[0].iov_base;
+  int header = tx_builder_->Write(packet, n, layout, sequence, tx_time_);
+
+  /* Line segments in a packet are contiguous in the frame */
+  if (arg->zerocopy && (format_.depth == 8)) {
+    iov[0].iov_len = header;
+    iov[1].iov_base = &arg->yuvframe[layout->frame_offset];
+    iov[1].iov_len = layout->size - header;
+    return 2;
+  }
+  if (tx_convert_) {
+    //
+    // Whole pixel groups, and RGB lines are as contiguous as UYVY ones,
+    // so the packet's pixels are one run in the source frame
+    //
+    uint32_t pixel = layout->frame_offset / PGROUP_SIZE * PGROUP_PIXELS;
+
+    tx_convert_((uint8_t *) & arg->rgbframe[pixel * tx_pixel_bytes_],
+                (uint8_t *) & packet[header],
+                (layout->size - header) / PGROUP_SIZE * PGROUP_PIXELS);
+  } else {
+    /* A copy for 8 bit, packed for deeper samples */
+    format_.pack((uint8_t *) & arg->yuvframe[layout->frame_offset],
+                 (uint8_t *) & packet[header],
+                 (layout->size - header) / format_.pgroup * format_.samples);
+  }
+  iov[0].iov_len = layout->size;
+  return 1;
+}
+
+//
+// Packetize the next burst of the frame into tx_msgs_ and return the time it
+// may be sent. When pacing in user space bursts are small and spaced out,
+// with SO_TXTIME the kernel holds each packet until its own launch time. A
+// SO_TXTIME burst spans at most RTP_PACING_AHEAD_NS and is sent that long
+// before it is due, so the qdisc never holds more than a little of a frame.
+//
+uint64_t RtpStream::FillBurst() {
+  int packets = tx_layout_->Packets();
+  int batch_size = RTP_BATCH_SIZE;
+  int batch_bytes = 0;
+  bool paced = pacer_.Enabled();
+  uint64_t launch = 0;
+  uint64_t last = UINT64_MAX;   /* latest launch time the burst may hold */
+  RTP_TRACE_SCOPE(tx_convert_ ? TRACE_TX_CONVERT : TRACE_TX_PACKETIZE);
+
+  if (paced && !tx_cmsg_)
+    batch_size = RTP_PACING_BURST;
+
+  for (tx_batch_ = 0; (tx_batch_ < batch_size) && (tx_packet_ < packets) &&
+       (pacer_.Due() <= last); tx_batch_++, tx_packet_++) {
+    const PacketLayout *layout = tx_layout_->Packet(tx_packet_);
+    struct msghdr *msg = &tx_msgs_[tx_batch_ * tx_dest_.size()].msg_hdr;
+
+    msg->msg_iovlen = WritePacket(tx_packet_, sequence_number_,
+                                  &tx_iov_[tx_batch_ * 2]);
+    sequence_number_++;
+
+    /* Every destination's copy of the packet shares its iovecs */
+    for (size_t d = 1; d < tx_dest_.size(); d++)
+      tx_msgs_[tx_batch_ * tx_dest_.size() + d].msg_hdr.msg_iovlen =
+        msg->msg_iovlen;
+
+    batch_bytes += (RTP_IP_UDP_HEADER + layout->size) * tx_dest_.size();
+    if (paced && tx_cmsg_) {
+      uint64_t when = pacer_.Schedule((RTP_IP_UDP_HEADER + layout->size) *
+                                      tx_dest_.size());
+
+      if (tx_batch_ == 0) {
+        launch = when > RTP_PACING_AHEAD_NS ? when - RTP_PACING_AHEAD_NS : 0;
+        last = when + RTP_PACING_AHEAD_NS;
       }
+      memcpy(CMSG_DATA(CMSG_FIRSTHDR(msg)), &when, sizeof(when));
+    }
+  }
+
+  if (paced && !tx_cmsg_)
+    launch = pacer_.Schedule(batch_bytes);
+  tx_launch_ = launch;
+  return launch;
+}
 
-      if (marker)
-        receiving = false;
+//
+// Send the burst built by FillBurst(). Once the last packet has gone the
+// frame is released. Returns -1 on a socket error, the rest of the frame is
+// then abandoned.
+//
+int RtpStream::SendBurst() {
+  int sent = -1;
+  int ret = 0;
 
-      scanline = true;
-      scancount = 0;
+  if (tx_gso_) {
+    sent = SendSegmented();
+    /* The route's device can not checksum segments, e.g. some tunnels */
+    if ((sent < 0) && (errno == EIO)) {
+      cout << "[RTP] UDP_SEGMENT failed, sending packets\n";
+      tx_gso_ = false;
     }
   }
+  if (!tx_gso_)
+    sent = SendBatch(tx_msgs_, tx_batch_ * tx_dest_.size());
+  if (sent < 0) {
+    cout << "[RTP] Transmit socket failure fd=" << sockfd_out_ << "\n";
+    tx_packet_ = tx_layout_->Packets();
+    ret = -1;
+  }
+  tx_batch_ = 0;
 
-  arg->yuvframe = arg->stream->buffer_in_;
+  if (tx_packet_ == tx_layout_->Packets()) {
+    TxData *arg = &tx_frame_;
 
-  return 0;
+    /* The kernel has its own copy of every packet, release the frame */
+    tx_active_ = false;
+    RTP_TRACE_SPAN(TRACE_TX_FRAME, tx_started_);
+    if (arg->done)
+      arg->done(tx_convert_ ? arg->rgbframe : arg->yuvframe, arg->user);
+  }
+  return ret;
 }
 
-bool RtpStream::Recieve(void **cpu, unsigned long timeout) {
-  sched_param param;
-  pthread_attr_t tattr;
-  pthread_t rx;
+static size_t MessageBytes(const struct msghdr *msg) {
+  size_t bytes = 0;
 
-  arg_rx.rgbframe = 0;
-  arg_rx.width = width_;
-  arg_rx.height = height_;
-  arg_rx.stream = this;
+  for (size_t c = 0; c < msg->msg_iovlen; c++)
+    bytes += msg->msg_iov[c].iov_len;
+  return bytes;
+}
 
-#if RTP_THREADED
-  // Elevate priority to get the RTP packets in quickly
-  pthread_attr_init(&tattr);
-  pthread_attr_getschedparam(&tattr, &param);
-  param.sched_priority = 99;
-  pthread_attr_setschedparam(&tattr, &param);
+//
+// Send the burst in tx_msgs_ as runs of equal sized packets, the last of a
+// run may be shorter, each run one UDP_SEGMENT message per destination for
+// the kernel (or NIC) to split. Most of a frame's packets are the full MTU
+// so a run is usually as long as the limits allow.
+//
+int RtpStream::SendSegmented() {
+#ifdef UDP_SEGMENT
+  size_t dests = tx_dest_.size();
+  int packet = 0;
+  int runs = 0;
+  int iovs = 0;
+
+  while (packet < tx_batch_) {
+    uint16_t size = MessageBytes(&tx_msgs_[packet * dests].msg_hdr);
+    char *cmsg = &tx_gso_cmsg_[runs * CMSG_SPACE(sizeof(uint16_t))];
+    int first = iovs;
+    int count = 0;
+    size_t bytes = 0;
 
-  // Start a thread so we can start capturing the next frame while transmitting the data
-  pthread_create(&rx, &tattr, ReceiveThread, &arg_rx);
+    while ((packet < tx_batch_) && (count < RTP_GSO_SEGMENTS)) {
+      struct msghdr *msg = &tx_msgs_[packet * dests].msg_hdr;
+      size_t len = MessageBytes(msg);
 
-  // Wait for completion
-  pthread_join(rx, 0);
+      if ((len > size) || (bytes + len > RTP_GSO_BYTES))
+        break;
+      memcpy(&tx_gso_iov_[iovs], msg->msg_iov,
+             msg->msg_iovlen * sizeof(struct iovec));
+      iovs += msg->msg_iovlen;
+      bytes += len;
+      count++;
+      packet++;
+      if (len < size)
+        break;
+    }
+    memcpy(CMSG_DATA((struct cmsghdr *) cmsg), &size, sizeof(size));
+
+    for (size_t d = 0; d < dests; d++) {
+      struct msghdr *msg = &tx_gso_msgs_[runs * dests + d].msg_hdr;
+
+      msg->msg_name = &tx_dest_[d];
+      msg->msg_namelen = sizeof(tx_dest_[d]);
+      msg->msg_iov = &tx_gso_iov_[first];
+      msg->msg_iovlen = iovs - first;
+      msg->msg_control = count > 1 ? cmsg : 0;
+      msg->msg_controllen = count > 1 ? CMSG_SPACE(sizeof(uint16_t)) : 0;
+    }
+    runs++;
+  }
+  return SendBatch(tx_gso_msgs_, runs * dests);
 #else
-  ReceiveThread(&arg_rx);
+  errno = ENOSYS;
+  return -1;
 #endif
-  *cpu = (void *) buffer_in_;
-  return true;
 }
 
-void *TransmitThread(void *data) {
-  RtpPacket packet;
-  TxData *arg;
-  char *yuv;
-  int c = 0;
-  int n = 0;
+/* Wait for a burst's launch time, 0 to send straight away */
+void RtpStream::Pace(uint64_t launch) {
+  uint64_t start;
 
-  arg = (TxData *) data;
+  if (!launch)
+    return;
+  start = RTP_TRACE_NOW();
+  RtpPacer::Wait(launch);
+  RTP_TRACE_SPAN(TRACE_TX_PACE, start);
+}
 
-  RtpStream::sequence_number_ = 0;
+//
+// Send a frame as bands, each band's sequence numbers counted from where the
+// band before it ends. The last band keeps back the marker packet and sends
+// it once all the others are done, so it is the last to leave.
+//
+int RtpStream::TransmitBands(TxData *frame) {
+  int bands = tx_bands_.size();
+  int packets, ret = 0;
+  uint32_t sequence;
 
-  /* send a frame */
-  pthread_mutex_lock(&arg->stream->mutex_);
-  {
-    struct timeval NTP_value;
-    int32_t time = 10000;
+  BeginFrame(frame);
+  packets = tx_layout_->Packets();
+  sequence = sequence_number_;
+  sequence_number_ += packets;
+  for (int c = 0; c < bands; c++) {
+    int first = (int64_t) packets * c / bands;
+    int last = (int64_t) packets * (c + 1) / bands;
+
+    if (c == bands - 1)
+      last = packets - 1;
+    tx_bands_[c]->Start(first, last < first ? first : last, sequence + first);
+  }
+  for (int c = 0; c < bands; c++) {
+    if (tx_bands_[c]->Wait() < 0)
+      ret = -1;
+  }
+  if ((ret == 0) && (packets > 0) &&
+      (tx_bands_[bands - 1]->Send(packets - 1, packets, sequence + packets - 1,
+                                  false) < 0))
+    ret = -1;
 
-    for (c = 0; c < (arg->height); c++) {
-      int x, last = 0;
+  /* Every band has its own copy of its packets, release the frame */
+  tx_active_ = false;
+  RTP_TRACE_SPAN(TRACE_TX_FRAME, tx_started_);
+  if (frame->done)
+    frame->done(tx_convert_ ? frame->rgbframe : frame->yuvframe, frame->user);
+  return ret;
+}
 
-      if (c == arg->height - 1)
-        last = 1;
-      arg->stream->UpdateHeader((Header *) & packet, c, last, time, RTP_SOURCE);
+/* Packetize and send a whole frame, returns -1 on a socket error */
+int RtpStream::TransmitFrame(TxData *frame) {
+  int ret = 0;
 
-#if ENDIAN_SWAP
-      EndianSwap32((uint32_t *) & packet, sizeof(RtpHeader) / 4);
-      EndianSwap16((uint16_t *) & packet.head.payload,
-                   sizeof(PayloadHeader) / 2);
-#endif
-      n =
-        sendto(arg->stream->sockfd_out_, (char *) &packet,
-               24 + (arg->width * 2), 0,
-               (const sockaddr *) &arg->stream->server_addr_out_,
-               arg->stream->server_len_out_);
-
-      if (n < 0) {
-        cout << "[RTP] Transmit socket failure fd=" << arg->stream->
-          sockfd_out_ << "\n";
-        return 0;
-      }
+  if (!tx_bands_.empty())
+    return TransmitBands(frame);
+  BeginFrame(frame);
+  while (tx_active_) {
+    Pace(FillBurst());
+    if (SendBurst() < 0)
+      ret = -1;
+  }
+  return ret;
+}
+
+//
+// When a session worker should next call TxWork(): the launch time of a
+// burst waiting to go, 0 if there is work to do now or UINT64_MAX if idle.
+//
+uint64_t RtpStream::TxDue() {
+  if (tx_batch_)
+    return tx_launch_;
+  if (tx_active_ || tx_queue_.Depth())
+    return 0;
+  return UINT64_MAX;
+}
+
+//
+// One burst of work for a session worker. A paced burst that is not due yet
+// is left in tx_msgs_ and sent on a later call.
+//
+void RtpStream::TxWork() {
+  if (!tx_batch_) {
+    if (!tx_active_) {
+      TxData frame;
+
+      if (!tx_queue_.TryPop(&frame))
+        return;
+      BeginFrame(&frame);
     }
+    if (FillBurst() > RtpPacer::Now() + RTP_PACING_SPIN_NS)
+      return;
   }
-  pthread_mutex_unlock(&arg->stream->mutex_);
-  return 0;
+  Pace(tx_launch_);
+  SendBurst();
 }
 
-// Arguments sent to thread
-sched_param param;
-pthread_t tx;
-static TxData arg_tx;
+//
+// Long lived sender, one per stream, fed from tx_queue_ until Close()
+//
+void *TransmitThread(void *data) {
+  RtpStream *stream = (RtpStream *) data;
+  TxData frame;
 
-int RtpStream::Transmit(char *rgbframe) {
-  arg_tx.rgbframe = rgbframe;
-  arg_tx.width = width_;
-  arg_tx.height = height_;
-  arg_tx.stream = this;
+  while (stream->tx_queue_.Pop(&frame))
+    stream->TransmitFrame(&frame);
+  return 0;
+}
+
+/* Done callback of a frame queued without one, wakes Queue() */
+static void FrameSent(char *frame, void *user) {
+  (void) frame;
+  sem_post((sem_t *) user);
+}
 
+//
+// Queue a frame for the transmit thread (or the session workers). If the
+// queue policy discards a frame its done callback is run here so the owner
+// gets the buffer back. A frame without a done callback is the caller's to
+// reuse as soon as this returns, so wait until it has been sent. Returns -1,
+// without calling done, if the stream is closed.
+//
+int RtpStream::Queue(TxData *frame) {
 #if RTP_THREADED
-  // Start a thread so we can start capturing the next frame while transmitting the data
-  pthread_join(tx, 0);
-  pthread_create(&tx, NULL, TransmitThread, &arg_tx);
+  TxData dropped;
+  QueueResult result;
+
+  if (!tx_running_)
+    return -1;
+  if (!frame->done) {
+    sem_t sent;
+    int ret;
+
+    sem_init(&sent, 0, 0);
+    frame->done = FrameSent;
+    frame->user = &sent;
+    ret = Queue(frame);
+    while ((ret == 0) && (sem_wait(&sent) < 0) && (errno == EINTR));
+    sem_destroy(&sent);
+    return ret;
+  }
+  frame->queued = RTP_TRACE_NOW();
+  result = tx_queue_.Push(*frame, &dropped);
+  if (result == QUEUE_CLOSED)
+    return -1;
+  if (result == QUEUE_DROPPED) {
+    if (dropped.done)
+      dropped.done(dropped.format == PIXEL_UYVY ? dropped.yuvframe :
+                   dropped.rgbframe, dropped.user);
+  }
+  if (session_)
+    session_->Wake();
   return 0;                     // Cant know the if the transmit was successfull if done in a thread
 #else
-  return TransmitThread(&arg_tx);
+  frame->queued = RTP_TRACE_NOW();
+  return TransmitFrame(frame);
 #endif
 }
+
+/* Send a frame in the stream format, returns once it has been sent */
+int RtpStream::Transmit(char *rgbframe) {
+  TxData frame;
+
+  frame.rgbframe = rgbframe;
+  frame.yuvframe = rgbframe;    // Frame is sent as is, already in the stream format
+  frame.width = width_;
+  frame.height = height_;
+  frame.stream = this;
+  frame.zerocopy = false;
+  frame.format = PIXEL_UYVY;
+  frame.done = 0;
+  frame.user = 0;
+  return Queue(&frame);
+}
+
+//
+// Send a UYVY frame without copying the payload. Each packet is a pair of
+// iovecs, the RTP header and a pointer into the frame. The frame must not be
+// modified or freed until done is called, which happens on the transmit
+// thread once the last packet has been passed to the kernel (or on the
+// calling thread if the queue policy drops the frame). Formats deeper than 8
+// bits are packed into the packet buffers instead, the callback still holds.
+//
+int RtpStream::TransmitZeroCopy(char *yuvframe, FrameDoneCallback done,
+                                void *user) {
+  TxData frame;
+
+  frame.rgbframe = 0;
+  frame.yuvframe = yuvframe;
+  frame.width = width_;
+  frame.height = height_;
+  frame.stream = this;
+  frame.zerocopy = true;
+  frame.format = PIXEL_UYVY;
+  frame.done = done;
+  frame.user = user;
+  return Queue(&frame);
+}
+
+//
+// Send an RGB24 or RGBA frame, converting to UYVY as it is packetized. The
+// frame is read on the transmit thread so it must not be modified or freed
+// until done is called, without a callback this waits until the frame has
+// been sent. Returns -1 if the format can not be sent or the
+// stream is not YCbCr-4:2:2 8 bit.
+//
+int RtpStream::TransmitRgb(char *rgbframe, PixelFormat format,
+                           FrameDoneCallback done, void *user) {
+  TxData frame;
+
+  if ((format != PIXEL_RGB24) && (format != PIXEL_RGBA))
+    return -1;
+  if ((format_.sampling != SAMPLING_YCBCR_422) || (format_.depth != 8))
+    return -1;
+  frame.rgbframe = rgbframe;
+  frame.yuvframe = 0;
+  frame.width = width_;
+  frame.height = height_;
+  frame.stream = this;
+  frame.zerocopy = false;
+  frame.format = format;
+  frame.done = done;
+  frame.user = user;
+  return Queue(&frame);
+}
@@ -47,6 +47,24 @@ Use his program to stream data to the udpsc example above on the tegra X1
 # define __bswap_16(x) \
     (__extension__							      \
      ({ unsigned short int __bsx = (x); __bswap_constant_16 (__bsx); }))
+/* Scatter/gather message types, sendmmsg() is emulated with sendto() */
+struct iovec {
+  void *iov_base;
+  size_t iov_len;
+};
+struct msghdr {
+  void *msg_name;
+  int msg_namelen;
+  struct iovec *msg_iov;
+  size_t msg_iovlen;
+  void *msg_control;
+  size_t msg_controllen;
+  int msg_flags;
+};
+struct mmsghdr {
+  struct msghdr msg_hdr;
+  unsigned int msg_len;
+};
 #else
 #include <byteswap.h>
 #include <sys/types.h>
@@ -55,20 +73,41 @@ Use his program to stream data to the udpsc example above on the tegra X1
 #include <netdb.h>
 #endif
 #include <limits.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include "rtp_packetizer.h"
+#include "frame_queue.h"
+#include "rtp_pacer.h"
+#include "frame_pool.h"
+#include "frame_memory.h"
+#include "rtp_stats.h"
+#include "jitter_buffer.h"
+#include "colourspace.h"
+#include "rtp_header.h"
+#include "dirty_lines.h"
+#include "video_format.h"
+#include "rtp_trace.h"
+#include "packet_ring.h"
+#include "uring.h"
+#include "rtp_capture.h"
 
-#define ENDIAN_SWAP           __arm__ || __amd64__ || __x86_64__        /* Perform endian swap, __arm__ defined by gcc */
 #define RTP_VERSION           0x2       /* RFC 1889 Version 2 */
 #define RTP_PADDING           0x0
 #define RTP_EXTENSION         0x0
 #define RTP_MARKER            0x0
 #define RTP_PAYLOAD_TYPE      0x60      /* 96 Dynamic Type */
-#define RTP_SOURCE            0x12345678        /* Sould be unique */
 #define RTP_FRAMERATE         25
 
 #define Hz90                  90000
-#define NUM_LINES_PER_PACKET  1 /* can have more that one line in a packet */
+#define NUM_LINES_PER_PACKET  16        /* maximum line segments in one packet */
+#define RTP_BATCH_SIZE        64        /* packets handed to the kernel per sendmmsg() */
 #define MAX_BUFSIZE 	        1280 * 3        /* allow for RGB data upto 1280 pixels wide */
-#define MAX_UDP_DATA 		      1500      /* enough space for three lines of UDP data MTU size should be checked */
+#define MAX_UDP_DATA 		      RTP_MAX_MTU       /* largest datagram we can receive */
+#define RTP_GSO_BYTES         (65535 - RTP_IP_UDP_HEADER)       /* most one segmented send or coalesced receive carries */
+#define RTP_GSO_SEGMENTS      64        /* UDP_MAX_SEGMENTS on older kernels */
+#define RTP_MAX_DROPOUT       65536     /* larger forward jumps need a second packet to be believed */
+#define RTP_MAX_MISORDER      1024      /* larger backward jumps are a restart, not reordering */
 
 /* 12 byte RTP Raw video header */
 typedef struct __attribute__ ((__packed__)) {
@@ -100,10 +139,55 @@ typedef struct __attribute__ ((__packed__)) {
   char data[MAX_BUFSIZE];
 } RtpPacket;
 
-void yuvtorgb(int height, int width, char *yuv, char *rgba);
-void rgbtoyuv(int height, int width, char *rgb, char *yuv);
-void yuvtorgba(int height, int width, char *yuv, char *rgba);
 void yuvtorgb(int height, int width, char *yuv, char *rgb);
+void yuvtorgba(int height, int width, char *yuv, char *rgba);
+void rgbtoyuv(int height, int width, char *rgb, char *yuv);
+void rgbatoyuv(int height, int width, char *rgba, char *yuv);
+
+//
+// Called once every packet of a zero copy frame has been handed to the kernel,
+// after this the caller owns the frame buffer again and may reuse it.
+//
+typedef void (*FrameDoneCallback) (char *frame, void *user);
+
+/* System calls a stream's packets go through, see SetIoBackend() */
+typedef enum {
+  IO_SOCKET,                    /* sendmmsg() and recvmmsg() */
+  IO_URING                      /* io_uring, if the kernel allows it */
+} IoBackend;
+
+// 
+// Transmit data structure
+//
+class RtpStream;
+class RtpSession;
+class RtpBand;
+class RtpLane;
+
+typedef struct {
+  char *rgbframe;
+  char *yuvframe;
+  uint32_t width;
+  uint32_t height;
+  RtpStream *stream;
+  bool zerocopy;                /* payload iovecs point into yuvframe */
+  PixelFormat format;           /* PIXEL_UYVY or the RGB format of rgbframe */
+  FrameDoneCallback done;
+  void *user;
+  uint64_t queued;              /* RtpTrace::Now() when queued, with RTP_TRACE */
+} TxData;
+
+/* Sequence and jitter tracking of the packets one receive thread sees */
+typedef struct {
+  RtpStatsCounters *stats;      /* the thread's own counters */
+  bool synced;                  /* seen the first packet */
+  uint32_t expected;            /* next extended sequence number */
+  uint32_t bad;                 /* RFC 3550 A.1 bad_seq, a jump is believed if this comes next */
+  uint64_t seen[RTP_MAX_MISORDER / 64]; /* bit per sequence number received, by seq % RTP_MAX_MISORDER */
+  uint32_t timestamp;           /* newest RTP timestamp seen */
+  int32_t transit;
+  uint32_t jitter;              /* scaled by 16 as in RFC 3550 */
+} RxTrack;
 
 //
 // rtpstream RGB data
@@ -112,13 +196,59 @@ class RtpStream {
 public:
   RtpStream(int height, int width);
   ~RtpStream();
-  static unsigned long sequence_number_;
   void RtpStreamOut(char *hostname, int port);
   void RtpStreamIn(char *hostname, int port);
   int Transmit(char *rgbframe);
+  int TransmitZeroCopy(char *yuvframe, FrameDoneCallback done, void *user);
+  int TransmitRgb(char *rgbframe, PixelFormat format,
+                  FrameDoneCallback done = 0, void *user = 0);
+  bool SetFormat(Sampling sampling, int depth);
+  const VideoFormat *Format() { return &format_; }
+  void SetMtu(int mtu);
+  void SetMulticast(const char *interface, int ttl = 1, bool loopback = false);
+  void AddDestination(char *hostname, int port);
+  bool JoinGroup(const char *group);
+  bool LeaveGroup(const char *group);
+  void SetSource(uint32_t source);
+  uint32_t Source() { return source_; }
+  void SetQueue(int depth, QueuePolicy policy);
+  void SetPacing(int framerate, uint64_t max_bitrate = 0, bool kernel = false);
+  void SetDirtyLines(int refresh = RTP_DIRTY_REFRESH);
+  void RefreshFrame();
+  void SetHoldLines(bool hold);
+  void SetPacketRing(bool enable, const char *interface = "");
+  bool PacketRingActive() { return rx_ring_.Active(); }
+  void SetIoBackend(IoBackend backend);
+  bool UringReceiving() { return rx_uring_; }
+  bool UringSending() { return tx_uring_.Active(); }
+  void SetSegmentOffload(bool enable);
+  void SetBands(int bands, const std::vector < int >&cpus =
+                std::vector < int >());
+  int Bands() { return tx_bands_.size(); }
+  void SetLanes(int lanes, const std::vector < int >&cpus =
+                std::vector < int >());
+  int Lanes() { return rx_lanes_.size() + 1; }
+  int LaneSocket(int lane);
+  void SetMemory(bool hugepages, int node = RTP_NODE_AUTO);
+  int MemoryNode(bool receive, int cpu = -1);
+  bool HugePages() { return memory_hugepages_; }
+  bool Record(const char *path);
+  void StopRecording();
+  uint64_t PacketsRecorded() { return rx_recorder_.Packets(); }
+  int SendPackets(const struct iovec *iov, int count, int parts = 1);
+  bool GsoSending() { return tx_gso_; }
+  bool GroReceiving() { return rx_gro_; }
+  int QueueDepth() { return tx_queue_.Depth(); }
+  uint64_t FramesDropped() { return tx_queue_.Dropped(); }
   bool Open();
   void Close();
   bool Recieve(void **cpu, unsigned long timeout = ULONG_MAX);
+  bool Recieve(FrameLease * lease, unsigned long timeout = ULONG_MAX);
+  void SetFramePool(int count);
+  void SetJitterBuffer(int frames, int window_ms);
+  uint64_t FrameOverruns() { return rx_pool_.Overruns(); }
+  void Statistics(RtpStatistics * stats);
+  void SetFrameCallback(FrameReadyCallback callback, void *user);
   int sockfd_in_;
   int sockfd_out_;
   struct sockaddr_in server_addr_in_;
@@ -128,13 +258,110 @@ public:
   pthread_mutex_t mutex_;
   unsigned int frame_;
   char *gpuBuffer;
-  char udpdata[MAX_UDP_DATA];
-  char *buffer_in_;
-  void UpdateHeader(Header * packet, int line, int last, int32_t timestamp,
-                     int32_t source);
+  int SendBatch(struct mmsghdr *msgs, int count);
+  int UringSend(struct mmsghdr *msgs, int count);
+  int SendSegmented();
+  int TransmitFrame(TxData * frame);
+  void BeginFrame(TxData * frame);
+  uint64_t FillBurst();
+  int WritePacket(int n, uint32_t sequence, struct iovec *iov);
+  int TransmitBands(TxData * frame);
+  void Pace(uint64_t launch);
+  int SendBurst();
+  RtpPacketizer packetizer_;
+  RtpHeaderBuilder tx_headers_;
+  DirtyLines tx_dirty_;
+  RtpPacketizer tx_partial_;    /* layout of the changed lines of tx_frame_ */
+  RtpHeaderBuilder tx_partial_headers_;
+  RtpPacketizer *tx_layout_;    /* layout tx_frame_ is sent with */
+  RtpHeaderBuilder *tx_builder_;
+  int mtu_;
+  char *tx_buffer_;             /* RTP_BATCH_SIZE packets of mtu_ bytes */
+  struct mmsghdr *tx_msgs_;
+  struct iovec *tx_iov_;        /* two per packet, header and payload */
+  FrameQueue < TxData > tx_queue_;
+  RtpPacer pacer_;
+  char *tx_cmsg_;               /* SCM_TXTIME control message per packet */
+  Uring tx_uring_;              /* sends a batch instead of sendmmsg() */
+  bool tx_gso_;                 /* runs of equal sized packets go as one UDP_SEGMENT send */
+  struct mmsghdr *tx_gso_msgs_; /* a message per run per destination */
+  struct iovec *tx_gso_iov_;    /* the batch's iovecs back to back */
+  char *tx_gso_cmsg_;           /* UDP_SEGMENT control message per run */
+  struct mmsghdr *tx_raw_msgs_; /* SendPackets(), a message per packet per destination */
+  struct iovec *tx_raw_iov_;    /* up to two per packet */
+  int Depacketize(char *data, int len);
+  int Depacketize(char *data, int len, RxTrack * track, uint64_t now);
+  int ReceiveBatch();
+  void TrackSequence(RxTrack * track, uint64_t now, uint32_t seq,
+                     uint32_t timestamp, int len);
+  static void FrameReady(char *frame, const FrameCoverage * coverage,
+                         void *data);
+  uint64_t rx_now_;             /* arrival time of the current batch */
+  JitterBuffer rx_jitter_buffer_;
+  std::atomic < bool > rx_running_;
+  char *rx_buffer_;             /* RTP_BATCH_SIZE packets of MAX_UDP_DATA bytes */
+  struct mmsghdr *rx_msgs_;
+  struct iovec *rx_iov_;
+  char *rx_cmsg_;               /* SO_TIMESTAMPNS with RTP_TRACE and UDP_GRO per message */
+  bool rx_gro_;                 /* messages may hold several coalesced packets */
+  int rx_size_;                 /* bytes per receive buffer */
 private:
-  struct hostent *server_in_;
-  struct hostent *server_out_;
+  pthread_t rx_thread_;
+  FramePool rx_pool_;
+  bool rx_ring_wanted_;
+  char rx_ring_if_[100];
+  PacketRing rx_ring_;          /* AF_PACKET ring instead of recvmmsg() */
+  IoBackend io_backend_;
+  bool rx_uring_;               /* received by UringReceiver, no rx_thread_ */
+  bool offload_wanted_;         /* UDP_SEGMENT and UDP_GRO, see SetSegmentOffload() */
+  int rx_frames_;
+  FrameLease rx_lease_;         /* frame handed out by Recieve(void **) */
+  RtpStatsCounters rx_stats_;
+  RxTrack rx_track_;            /* packets seen by rx_thread_ */
+  RtpRecorder rx_recorder_;     /* every datagram received, see Record() */
+  std::atomic < bool > rx_recording_;
+  FrameReadyCallback rx_callback_;
+  void *rx_user_;
+  friend class RtpSession;
+  friend class RtpBand;
+  friend class RtpLane;
+  bool LanesWanted();
+  void OpenLanes();
+  void CloseLanes();
+  int rx_lanes_wanted_;
+  std::vector < int >rx_lane_cpus_;     /* lane n runs on [n % size], empty for any */
+  std::vector < RtpLane * >rx_lanes_;   /* receive threads besides rx_thread_ */
+  bool memory_hugepages_;       /* frame and packet buffers, see SetMemory() */
+  int memory_node_;
+  void MulticastOut(int sockfd);
+  void CloseBands();
+  int tx_bands_wanted_;
+  std::vector < int >tx_band_cpus_;     /* band n runs on [n % size], empty for any */
+  std::vector < RtpBand * >tx_bands_;   /* send the frames when not empty */
+  int Queue(TxData * frame);
+  uint64_t TxDue();
+  void TxWork();
+  pthread_t tx_thread_;
+  bool tx_running_;
+  RtpSession *session_;         /* sent by a session's workers, not tx_thread_ */
+  bool session_busy_;           /* claimed by a session worker */
+  uint32_t source_;             /* SSRC */
+  uint32_t sequence_number_;    /* RFC 4175 extended sequence number */
+  TxData tx_frame_;             /* frame being sent */
+  bool tx_active_;
+  int tx_packet_;               /* next packet of tx_frame_ to packetize */
+  int tx_batch_;                /* packets in tx_msgs_ waiting to be sent */
+  uint64_t tx_launch_;          /* when they may be sent */
+  uint32_t tx_time_;            /* RTP timestamp of tx_frame_ */
+  uint64_t tx_started_;         /* RtpTrace::Now() at BeginFrame() */
+  ColourLine tx_convert_;       /* RGB to UYVY kernel, 0 for UYVY frames */
+  int tx_pixel_bytes_;
+  std::vector < struct sockaddr_in > tx_dest_;  /* server_addr_out_ then the extra destinations */
+  std::vector < std::pair < std::string, int > > tx_extra_;
+  char multicast_if_[100];
+  int multicast_ttl_;
+  bool multicast_loop_;
+  VideoFormat format_;          /* sampling and depth, both directions */
   int height_;
   int width_;
   // Ingress port
@@ -145,17 +372,4 @@ private:
   int port_no_out_;
 };
 
-// 
-// Transmit data structure
-//
-typedef struct {
-  char *rgbframe;
-  char *yuvframe;
-  uint32_t width;
-  uint32_t height;
-  RtpStream *stream;
-} TxData;
-
-static TxData arg_rx;
-
 #endif
@@ -0,0 +1,413 @@
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+#include "rtp_trace.h"
+
+#define TRACE_FLAG_NS   1       /* length is already ns and start is the end */
+#define TRACE_SUB       (1 << RTP_TRACE_SUB_BITS)
+#define TRACE_BUCKETS   ((64 - RTP_TRACE_SUB_BITS + 1) * TRACE_SUB)
+
+typedef struct {
+  uint64_t start;               /* ticks */
+  uint32_t length;              /* ticks, or ns with TRACE_FLAG_NS */
+  uint16_t stage;
+  uint16_t flags;
+} TraceEvent;
+
+//
+// One per thread, written only by its thread and read only by the collector.
+// The writer never waits, if the collector falls a lap behind the oldest
+// events are overwritten and counted as overruns.
+//
+typedef struct {
+  TraceEvent events[RTP_TRACE_RING];
+  std::atomic < uint64_t > head;        /* events written, ever */
+  uint64_t tail;                /* events collected, ever */
+  std::atomic < bool > live;    /* owning thread still running */
+  int tid;
+} TraceRing;
+
+/* HDR style, TRACE_SUB linear buckets per power of two of ns */
+typedef struct {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[TRACE_BUCKETS];
+} TraceHistogram;
+
+typedef struct {
+  int stage;
+  int tid;
+  int64_t start;                /* ns since the library was loaded */
+  uint64_t length;              /* ns */
+} TraceCaptured;
+
+typedef struct {
+  std::mutex mutex;
+  std::vector < TraceRing * >rings;
+  TraceHistogram histograms[TRACE_STAGES];
+  std::vector < TraceCaptured > captured;
+  size_t capture;               /* events to keep for WriteChrome() */
+  uint64_t overruns;
+  double ns_per_tick;
+  int next_tid;
+  bool collector;
+} TraceState;
+
+static const char *names[TRACE_STAGES] = {
+  "tx queue", "tx dirty", "tx packetize", "tx convert", "tx pace", "tx send",
+  "tx frame", "rx socket", "rx depacketize", "rx frame", "rx publish"
+};
+
+/* Never freed, the collector and exiting threads may outlive static destructors */
+static TraceState *State() {
+  static TraceState *state = new TraceState();
+
+  return state;
+}
+
+static uint64_t MonotonicNs() {
+  struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC_RAW
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* A TSC that ticks at a constant rate whatever the core's frequency or C state */
+static bool InvariantTsc() {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax, ebx, ecx, edx;
+
+  if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+    return (edx & (1 << 8)) != 0;
+#endif
+  return false;
+}
+
+static const bool use_tsc = InvariantTsc();
+static const uint64_t base_ticks = RtpTrace::Now();
+static const uint64_t base_ns = MonotonicNs();
+
+uint64_t RtpTrace::Now() {
+#if defined(__x86_64__) || defined(__i386__)
+  if (use_tsc)
+    return __rdtsc();
+#endif
+  return MonotonicNs();
+}
+
+//
+// Scale ticks to ns against CLOCK_MONOTONIC_RAW over everything traced so
+// far, the longer the run the better the estimate.
+//
+static void Calibrate(TraceState * state) {
+  uint64_t ns = MonotonicNs() - base_ns;
+  uint64_t ticks;
+
+  if (!use_tsc) {
+    state->ns_per_tick = 1;
+    return;
+  }
+  ticks = RtpTrace::Now() - base_ticks;
+  if (ticks)
+    state->ns_per_tick = (double) ns / ticks;
+}
+
+static int Bucket(uint64_t ns) {
+  int exp;
+
+  if (ns < TRACE_SUB)
+    return ns;
+  exp = 63 - __builtin_clzll(ns);
+  return (exp - RTP_TRACE_SUB_BITS + 1) * TRACE_SUB +
+    (ns >> (exp - RTP_TRACE_SUB_BITS)) - TRACE_SUB;
+}
+
+/* Middle of a bucket */
+static uint64_t BucketValue(int bucket) {
+  int shift;
+
+  if (bucket < TRACE_SUB)
+    return bucket;
+  shift = bucket / TRACE_SUB - 1;
+  return ((uint64_t) (bucket % TRACE_SUB + TRACE_SUB) << shift) +
+    ((1ULL << shift) >> 1);
+}
+
+static void Add(TraceState * state, int tid, const TraceEvent * event) {
+  TraceHistogram *histogram = &state->histograms[event->stage];
+  uint64_t length;
+  int64_t start;
+
+  if (event->flags & TRACE_FLAG_NS) {
+    length = event->length;
+    start = (int64_t) ((event->start - base_ticks) * state->ns_per_tick) -
+      length;
+  } else {
+    length = event->length * state->ns_per_tick;
+    start = (event->start - base_ticks) * state->ns_per_tick;
+  }
+
+  histogram->count++;
+  histogram->sum += length;
+  if (length > histogram->max)
+    histogram->max = length;
+  histogram->buckets[Bucket(length)]++;
+
+  if (state->captured.size() < state->capture) {
+    TraceCaptured captured = { event->stage, tid, start, length };
+
+    state->captured.push_back(captured);
+  }
+}
+
+//
+// Collect everything written to ring since the last call. An event the
+// owner may have overwritten while it was being copied is thrown away.
+//
+static void Drain(TraceState * state, TraceRing * ring) {
+  uint64_t head = ring->head.load(std::memory_order_acquire);
+  uint64_t tail = ring->tail;
+
+  if (head - tail >= RTP_TRACE_RING) {
+    state->overruns += head - tail - (RTP_TRACE_RING - 1);
+    tail = head - (RTP_TRACE_RING - 1);
+  }
+  for (; tail < head; tail++) {
+    TraceEvent event = ring->events[tail & (RTP_TRACE_RING - 1)];
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (ring->head.load(std::memory_order_relaxed) - tail >= RTP_TRACE_RING) {
+      state->overruns++;
+      continue;
+    }
+    Add(state, ring->tid, &event);
+  }
+  ring->tail = head;
+}
+
+static void Collector() {
+  while (true) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(RTP_TRACE_COLLECT_MS));
+    RtpTrace::Collect();
+  }
+}
+
+//
+// Give the calling thread a ring, reusing one whose thread has exited. The
+// first one starts the collector.
+//
+static TraceRing *Register() {
+  TraceState *state = State();
+  std::lock_guard < std::mutex > lock(state->mutex);
+  TraceRing *ring = 0;
+
+  Calibrate(state);
+  for (size_t c = 0; c < state->rings.size(); c++) {
+    if (!state->rings[c]->live.load(std::memory_order_acquire)) {
+      ring = state->rings[c];
+      Drain(state, ring);
+      break;
+    }
+  }
+  if (!ring) {
+    ring = new TraceRing();
+    ring->head = 0;
+    ring->tail = 0;
+    state->rings.push_back(ring);
+  }
+  ring->tid = ++state->next_tid;
+  ring->live.store(true, std::memory_order_release);
+
+  if (!state->collector) {
+    state->collector = true;
+    std::thread(Collector).detach();
+  }
+  return ring;
+}
+
+/* Hands the ring back when its thread exits */
+class TraceOwner {
+public:
+  ~TraceOwner() {
+    if (ring_)
+      ring_->live.store(false, std::memory_order_release);
+  }
+  TraceRing *ring_;
+};
+
+//
+// The hot path only reads the plain pointer, initial-exec TLS keeps that a
+// single load even from a shared library. The owner is touched once per
+// thread.
+//
+static __thread TraceRing *thread_ring __attribute__ ((tls_model("initial-exec")));
+static thread_local TraceOwner owner;
+
+static inline void Push(TraceStage stage, uint64_t start, uint64_t length,
+                        int flags) {
+  TraceRing *ring = thread_ring;
+  uint64_t head;
+  TraceEvent *event;
+
+  if (__builtin_expect(!ring, 0))
+    ring = thread_ring = owner.ring_ = Register();
+  head = ring->head.load(std::memory_order_relaxed);
+  event = &ring->events[head & (RTP_TRACE_RING - 1)];
+  event->start = start;
+  event->length = length > UINT32_MAX ? UINT32_MAX : length;
+  event->stage = stage;
+  event->flags = flags;
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+/* start and end from Now() */
+void RtpTrace::Record(TraceStage stage, uint64_t start, uint64_t end) {
+  Push(stage, start, end - start, 0);
+}
+
+/* A time measured some other way, ending now */
+void RtpTrace::RecordNs(TraceStage stage, uint64_t ns) {
+  Push(stage, Now(), ns, TRACE_FLAG_NS);
+}
+
+/* Drain every thread's ring into the histograms, the collector does this too */
+void RtpTrace::Collect() {
+  TraceState *state = State();
+  std::lock_guard < std::mutex > lock(state->mutex);
+
+  if (state->rings.empty())
+    return;
+  Calibrate(state);
+  for (size_t c = 0; c < state->rings.size(); c++)
+    Drain(state, state->rings[c]);
+}
+
+/* Keep up to events raw events for WriteChrome(), 0 stops capturing */
+void RtpTrace::Capture(size_t events) {
+  TraceState *state = State();
+  std::lock_guard < std::mutex > lock(state->mutex);
+
+  state->capture = events;
+}
+
+bool RtpTrace::Summary(TraceStage stage, TraceSummary * summary) {
+  TraceState *state = State();
+  const double q[4] = { 0.5, 0.9, 0.99, 0.999 };
+  double *p[4] = { &summary->p50, &summary->p90, &summary->p99,
+    &summary->p999
+  };
+  TraceHistogram *histogram;
+
+  memset(summary, 0, sizeof(*summary));
+  if ((unsigned) stage >= TRACE_STAGES)
+    return false;
+  Collect();
+
+  std::lock_guard < std::mutex > lock(state->mutex);
+  histogram = &state->histograms[stage];
+  if (!histogram->count)
+    return false;
+  summary->count = histogram->count;
+  summary->mean = histogram->sum / 1000.0 / histogram->count;
+  summary->max = histogram->max / 1000.0;
+  for (int c = 0; c < 4; c++) {
+    uint64_t rank = (uint64_t) (q[c] * histogram->count);
+    uint64_t seen = 0;
+    int b = 0;
+
+    while ((b < TRACE_BUCKETS - 1) &&
+           ((seen += histogram->buckets[b]) <= rank))
+      b++;
+    *p[c] = BucketValue(b) / 1000.0;
+    if (*p[c] > summary->max)
+      *p[c] = summary->max;
+  }
+  return true;
+}
+
+void RtpTrace::Report(FILE * out) {
+  if (!Enabled()) {
+    fprintf(out, "Tracing not built in, configure with -DRTP_TRACE=ON\n");
+    return;
+  }
+  fprintf(out, "%-15s %9s %9s %9s %9s %9s %9s %9s\n", "stage (us)", "count",
+          "mean", "p50", "p90", "p99", "p99.9", "max");
+  for (int c = 0; c < TRACE_STAGES; c++) {
+    TraceSummary s;
+
+    if (Summary((TraceStage) c, &s))
+      fprintf(out, "%-15s %9llu %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n",
+              names[c], (unsigned long long) s.count, s.mean, s.p50, s.p90,
+              s.p99, s.p999, s.max);
+  }
+  if (Overruns())
+    fprintf(out, "%llu events lost, collector fell behind\n",
+            (unsigned long long) Overruns());
+}
+
+//
+// The captured events as Chrome trace event JSON, one complete ("X") event
+// per stage. Returns false if the file could not be written.
+//
+bool RtpTrace::WriteChrome(const char *path) {
+  TraceState *state = State();
+  FILE *out;
+
+  Collect();
+  out = fopen(path, "w");
+  if (!out)
+    return false;
+
+  std::lock_guard < std::mutex > lock(state->mutex);
+  fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  for (int c = 1; c <= state->next_tid; c++)
+    fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+            "\"args\":{\"name\":\"rtp %d\"}},\n", c, c);
+  for (size_t c = 0; c < state->captured.size(); c++) {
+    const TraceCaptured *e = &state->captured[c];
+
+    fprintf(out, "{\"name\":\"%s\",\"cat\":\"%.2s\",\"ph\":\"X\",\"pid\":1,"
+            "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f},\n", names[e->stage],
+            names[e->stage], e->tid, e->start / 1000.0, e->length / 1000.0);
+  }
+  fprintf(out, "{\"name\":\"end\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":0,"
+          "\"ts\":%.3f}]}\n", (MonotonicNs() - base_ns) / 1000.0);
+  return fclose(out) == 0;
+}
+
+/* Forget everything collected so far */
+void RtpTrace::Reset() {
+  TraceState *state = State();
+
+  Collect();
+  std::lock_guard < std::mutex > lock(state->mutex);
+  memset(state->histograms, 0, sizeof(state->histograms));
+  state->captured.clear();
+  state->overruns = 0;
+}
+
+uint64_t RtpTrace::Overruns() {
+  TraceState *state = State();
+  std::lock_guard < std::mutex > lock(state->mutex);
+
+  return state->overruns;
+}
+
+const char *RtpTrace::Name(TraceStage stage) {
+  if ((unsigned) stage >= TRACE_STAGES)
+    return "unknown";
+  return names[stage];
+}
@@ -0,0 +1,101 @@
+/*
+ * Pipeline stage tracing. Each stage of the send and receive paths (queue
+ * wait, changed line hashing, packetizing, colour conversion, pacing,
+ * sendmmsg(), socket queueing, depacketizing, frame assembly and publish)
+ * is timestamped into a lock free ring buffer owned by the thread doing the
+ * work. A collector thread drains the rings every RTP_TRACE_COLLECT_MS into
+ * one HDR style log/linear latency histogram per stage, and can keep the
+ * raw events for a Chrome trace (chrome://tracing or Perfetto).
+ *
+ * Timestamps are the TSC where it is invariant, otherwise
+ * CLOCK_MONOTONIC_RAW. Built out unless RTP_TRACE is 1 (cmake -DRTP_TRACE=ON),
+ * the hooks are then empty macros; the RtpTrace calls stay so applications
+ * build either way.
+ *
+ *   RtpTrace::Capture(1000000);        // optional, keep events for Chrome
+ *   ... stream ...
+ *   RtpTrace::Report(stdout);
+ *   RtpTrace::WriteChrome("trace.json");
+ */
+
+#ifndef __RTP_TRACE_H__
+#define __RTP_TRACE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef RTP_TRACE
+#define RTP_TRACE             0         /* 1 to build the stage tracing in */
+#endif
+
+#define RTP_TRACE_RING        (1 << 16) /* events per thread between collections */
+#define RTP_TRACE_COLLECT_MS  100
+#define RTP_TRACE_SUB_BITS    5         /* histogram precision, 1/32 of a power of two */
+
+typedef enum {
+  TRACE_TX_QUEUE,               /* Transmit() call until the sender takes the frame */
+  TRACE_TX_DIRTY,               /* hashing lines and laying out the changed ones */
+  TRACE_TX_PACKETIZE,           /* headers and payload copy/pack of a burst */
+  TRACE_TX_CONVERT,             /* headers and RGB conversion of a burst */
+  TRACE_TX_PACE,                /* waiting for a burst's launch time */
+  TRACE_TX_SEND,                /* sendmmsg() of a burst */
+  TRACE_TX_FRAME,               /* first packet built until the last one sent */
+  TRACE_RX_SOCKET,              /* kernel receive timestamp until recvmmsg() returned */
+  TRACE_RX_DEPACKETIZE,         /* a received batch into frame buffers, publishing included */
+  TRACE_RX_FRAME,               /* first packet of a frame until it is published */
+  TRACE_RX_PUBLISH,             /* handing a frame to the pool (and holding lines) */
+  TRACE_STAGES
+} TraceStage;
+
+typedef struct {
+  uint64_t count;
+  double mean;                  /* all times in microseconds */
+  double p50;
+  double p90;
+  double p99;
+  double p999;
+  double max;
+} TraceSummary;
+
+class RtpTrace {
+public:
+  static bool Enabled() { return RTP_TRACE != 0; }
+  static uint64_t Now();
+  static void Record(TraceStage stage, uint64_t start, uint64_t end);
+  static void RecordNs(TraceStage stage, uint64_t ns);
+  static void Collect();
+  static void Capture(size_t events);
+  static bool Summary(TraceStage stage, TraceSummary * summary);
+  static void Report(FILE * out);
+  static bool WriteChrome(const char *path);
+  static void Reset();
+  static uint64_t Overruns();
+  static const char *Name(TraceStage stage);
+};
+
+#if RTP_TRACE
+/* Times the rest of the enclosing block as stage */
+class RtpTraceScope {
+public:
+  RtpTraceScope(TraceStage stage) {
+    stage_ = stage;
+    start_ = RtpTrace::Now();
+  }
+  ~RtpTraceScope() { RtpTrace::Record(stage_, start_, RtpTrace::Now()); }
+private:
+  TraceStage stage_;
+  uint64_t start_;
+};
+
+#define RTP_TRACE_SCOPE(stage)        RtpTraceScope rtp_trace_scope_(stage)
+#define RTP_TRACE_NOW()               RtpTrace::Now()
+#define RTP_TRACE_SPAN(stage, start)  RtpTrace::Record(stage, start, RtpTrace::Now())
+#define RTP_TRACE_NS(stage, ns)       RtpTrace::RecordNs(stage, ns)
+#else
+#define RTP_TRACE_SCOPE(stage)
+#define RTP_TRACE_NOW()               ((uint64_t) 0)
+#define RTP_TRACE_SPAN(stage, start)  ((void) (start))
+#define RTP_TRACE_NS(stage, ns)       ((void) (ns))
+#endif
+
+#endif
@@ -0,0 +1,289 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#endif
+#include "uring.h"
+
+Uring::Uring() {
+  fd_ = -1;
+  sq_map_ = 0;
+  sq_map_size_ = 0;
+  sqes_ = 0;
+  sqes_size_ = 0;
+  sq_queued_ = 0;
+}
+
+Uring::~Uring() {
+  Close();
+}
+
+#ifdef __linux__
+static int Enter(int fd, unsigned submit, unsigned wait, unsigned flags,
+                 const void *arg, size_t size) {
+  return syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, size);
+}
+
+static int Register(int fd, unsigned opcode, const void *arg, unsigned count) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+//
+// entries submissions and (0 for the kernel's default of twice as many)
+// completions. Returns false if io_uring is not allowed or too old.
+//
+bool Uring::Setup(unsigned entries, unsigned completions) {
+  struct io_uring_params params;
+
+  Close();
+  memset(&params, 0, sizeof(params));
+  if (completions) {
+    params.flags |= IORING_SETUP_CQSIZE;
+    params.cq_entries = completions;
+  }
+  if ((fd_ = syscall(__NR_io_uring_setup, entries, &params)) < 0)
+    return false;
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(params.features & IORING_FEAT_EXT_ARG) ||
+      !(params.features & IORING_FEAT_NODROP)) {
+    Close();
+    return false;
+  }
+
+  /* One mapping for both rings (IORING_FEAT_SINGLE_MMAP), then the entries */
+  sq_map_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  if (params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe) >
+      sq_map_size_)
+    sq_map_size_ = params.cq_off.cqes +
+      params.cq_entries * sizeof(struct io_uring_cqe);
+  sq_map_ = (uint8_t *) mmap(0, sq_map_size_, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  sqes_ = (struct io_uring_sqe *) mmap(0, sqes_size_, PROT_READ | PROT_WRITE,
+                                       MAP_SHARED | MAP_POPULATE, fd_,
+                                       IORING_OFF_SQES);
+  if ((sq_map_ == MAP_FAILED) || (sqes_ == MAP_FAILED)) {
+    if (sq_map_ == MAP_FAILED)
+      sq_map_ = 0;
+    if (sqes_ == MAP_FAILED)
+      sqes_ = 0;
+    Close();
+    return false;
+  }
+
+  sq_head_ = (unsigned *) (sq_map_ + params.sq_off.head);
+  sq_tail_ = (unsigned *) (sq_map_ + params.sq_off.tail);
+  sq_array_ = (unsigned *) (sq_map_ + params.sq_off.array);
+  sq_mask_ = *(unsigned *) (sq_map_ + params.sq_off.ring_mask);
+  sq_entries_ = params.sq_entries;
+  sq_queued_ = *sq_tail_;
+  cq_head_ = (unsigned *) (sq_map_ + params.cq_off.head);
+  cq_tail_ = (unsigned *) (sq_map_ + params.cq_off.tail);
+  cq_mask_ = *(unsigned *) (sq_map_ + params.cq_off.ring_mask);
+  cqes_ = (struct io_uring_cqe *) (sq_map_ + params.cq_off.cqes);
+  return true;
+}
+
+void Uring::Close() {
+  if (sqes_)
+    munmap(sqes_, sqes_size_);
+  if (sq_map_)
+    munmap(sq_map_, sq_map_size_);
+  sqes_ = 0;
+  sq_map_ = 0;
+  if (fd_ >= 0)
+    close(fd_);
+  fd_ = -1;
+}
+
+/* Next free submission entry, cleared, or 0 if the queue is full */
+struct io_uring_sqe *Uring::Sqe() {
+  unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  struct io_uring_sqe *sqe;
+
+  if (sq_queued_ - head >= sq_entries_)
+    return 0;
+  sqe = &sqes_[sq_queued_ & sq_mask_];
+  sq_array_[sq_queued_ & sq_mask_] = sq_queued_ & sq_mask_;
+  sq_queued_++;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+//
+// Submit everything queued since the last call and wait for at least wait
+// completions, or timeout_ns if that is not 0. Returns -1 with errno set,
+// ETIME when the timeout passed.
+//
+int Uring::Submit(unsigned wait, uint64_t timeout_ns) {
+  unsigned submit = sq_queued_ - *sq_tail_;
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+  int ret;
+
+  __atomic_store_n(sq_tail_, sq_queued_, __ATOMIC_RELEASE);
+  memset(&arg, 0, sizeof(arg));
+  if (timeout_ns) {
+    ts.tv_sec = timeout_ns / 1000000000ULL;
+    ts.tv_nsec = timeout_ns % 1000000000ULL;
+    arg.ts = (uint64_t) (uintptr_t) & ts;
+  }
+  flags |= IORING_ENTER_EXT_ARG;
+
+  /* A signal can interrupt the wait, the submissions have gone by then */
+  while (((ret = Enter(fd_, submit, wait, flags, &arg, sizeof(arg))) < 0) &&
+         (errno == EINTR)) {
+    submit = sq_queued_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (!submit && (Ready() >= wait))
+      return 0;
+  }
+  return ret;
+}
+
+unsigned Uring::Ready() {
+  return __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) - *cq_head_;
+}
+
+/* index from the oldest completion not yet consumed */
+struct io_uring_cqe *Uring::Completion(unsigned index) {
+  return &cqes_[(*cq_head_ + index) & cq_mask_];
+}
+
+void Uring::Consume(unsigned count) {
+  __atomic_store_n(cq_head_, *cq_head_ + count, __ATOMIC_RELEASE);
+}
+
+/* An empty table of count fixed files, filled in with SetFile() */
+bool Uring::RegisterFiles(unsigned count) {
+  int *fds = (int *) malloc(count * sizeof(int));
+  bool ok;
+
+  for (unsigned c = 0; c < count; c++)
+    fds[c] = -1;
+  ok = Register(fd_, IORING_REGISTER_FILES, fds, count) == 0;
+  free(fds);
+  return ok;
+}
+
+/* Put fd in a fixed file slot, -1 empties it */
+bool Uring::SetFile(unsigned slot, int fd) {
+  struct io_uring_files_update update;
+
+  memset(&update, 0, sizeof(update));
+  update.offset = slot;
+  update.fds = (uint64_t) (uintptr_t) & fd;
+  return Register(fd_, IORING_REGISTER_FILES_UPDATE, &update, 1) == 1;
+}
+
+//
+// Send ourselves a datagram on loopback and take it in with a multishot
+// recvmsg() into a provided buffer. Older kernels fail the receive with
+// EINVAL, some refuse io_uring altogether.
+//
+static bool Probe() {
+  struct io_uring_sqe *sqe;
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  struct msghdr msg;
+  char buffer[256];
+  Uring uring;
+  bool ok = false;
+  int sockfd;
+
+  if (!uring.Setup(4))
+    return false;
+  if ((sockfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
+    return false;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  memset(&msg, 0, sizeof(msg));
+  if ((bind(sockfd, (struct sockaddr *) &addr, sizeof(addr)) == 0) &&
+      (getsockname(sockfd, (struct sockaddr *) &addr, &len) == 0) &&
+      (sendto(sockfd, "probe", 5, 0, (struct sockaddr *) &addr,
+              sizeof(addr)) == 5)) {
+    sqe = uring.Sqe();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = 1;
+    sqe->addr = (uint64_t) (uintptr_t) buffer;
+    sqe->len = sizeof(buffer);
+    sqe->buf_group = 0;
+    sqe->user_data = 1;
+    sqe = uring.Sqe();
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = sockfd;
+    sqe->addr = (uint64_t) (uintptr_t) & msg;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->buf_group = 0;
+    sqe->user_data = 2;
+    if (uring.Submit(2, 100000000) >= 0) {
+      for (unsigned c = 0; c < uring.Ready(); c++) {
+        struct io_uring_cqe *cqe = uring.Completion(c);
+
+        if ((cqe->user_data == 2) && (cqe->res > 0) &&
+            (cqe->flags & IORING_CQE_F_BUFFER))
+          ok = true;
+      }
+    }
+  }
+  /* Closing the ring cancels the receive before buffer goes out of scope */
+  uring.Close();
+  close(sockfd);
+  return ok;
+}
+
+bool Uring::Available() {
+  static bool available = Probe();
+
+  return available;
+}
+
+#else
+
+bool Uring::Setup(unsigned entries, unsigned completions) {
+  return false;
+}
+
+void Uring::Close() {
+}
+
+struct io_uring_sqe *Uring::Sqe() {
+  return 0;
+}
+
+int Uring::Submit(unsigned wait, uint64_t timeout_ns) {
+  errno = ENOSYS;
+  return -1;
+}
+
+unsigned Uring::Ready() {
+  return 0;
+}
+
+struct io_uring_cqe *Uring::Completion(unsigned index) {
+  return 0;
+}
+
+void Uring::Consume(unsigned count) {
+}
+
+bool Uring::RegisterFiles(unsigned count) {
+  return false;
+}
+
+bool Uring::SetFile(unsigned slot, int fd) {
+  return false;
+}
+
+bool Uring::Available() {
+  return false;
+}
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ * Minimal io_uring on the raw system calls, no liburing. Sets up the rings,
+ * queues submissions, submits and waits in one io_uring_enter(), walks the
+ * completions and registers files. The io_uring send path of RtpStream and
+ * UringReceiver are built on it.
+ *
+ * Uring::Available() checks once that the kernel allows io_uring and that a
+ * multishot recvmsg() into provided buffers works (Linux 6.0), otherwise
+ * streams stay on the socket calls.
+ */
+
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#ifdef __linux__
+#include <linux/io_uring.h>
+#else
+struct io_uring_sqe;
+struct io_uring_cqe;
+#endif
+
+class Uring {
+public:
+  Uring();
+  ~Uring();
+  bool Setup(unsigned entries, unsigned completions = 0);
+  void Close();
+  bool Active() { return fd_ >= 0; }
+  struct io_uring_sqe *Sqe();
+  int Submit(unsigned wait, uint64_t timeout_ns = 0);
+  unsigned Ready();
+  struct io_uring_cqe *Completion(unsigned index);
+  void Consume(unsigned count);
+  bool RegisterFiles(unsigned count);
+  bool SetFile(unsigned slot, int fd);
+  static bool Available();
+private:
+  int fd_;
+  uint8_t *sq_map_;             /* both rings */
+  size_t sq_map_size_;
+  struct io_uring_sqe *sqes_;
+  size_t sqes_size_;
+  unsigned *sq_head_;
+  unsigned *sq_tail_;
+  unsigned *sq_array_;
+  unsigned sq_mask_;
+  unsigned sq_entries_;
+  unsigned sq_queued_;          /* tail including SQEs not yet published */
+  unsigned *cq_head_;
+  unsigned *cq_tail_;
+  unsigned cq_mask_;
+  struct io_uring_cqe *cqes_;
+};
+
+#endif
@@ -0,0 +1,372 @@
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#include "uring_receiver.h"
+using namespace std;
+
+#define URING_RECV            1         /* user_data kinds, slot << 8 | kind */
+#define URING_CANCEL          2
+#define URING_WAKE            3
+#define URING_BUFFERS         4
+#define URING_BUFFER_SIZE     (sizeof(struct io_uring_recvmsg_out) + MAX_UDP_DATA)
+
+/* Lives for the life of the process, like its thread */
+UringReceiver *UringReceiver::Shared() {
+  static UringReceiver *receiver = new UringReceiver();
+
+  return receiver;
+}
+
+UringReceiver::UringReceiver() {
+  memset(slots_, 0, sizeof(slots_));
+  provide_ = 0;
+  wake_ = -1;
+  wake_count_ = 0;
+  wake_armed_ = false;
+  running_ = false;
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_cond_init(&cond_, NULL);
+}
+
+#ifdef __linux__
+/* Set up the ring and start the thread, called with mutex_ held */
+bool UringReceiver::Start() {
+  pthread_attr_t tattr;
+  sched_param param;
+
+  if (running_)
+    return true;
+  if (!Uring::Available() ||
+      !uring_.Setup(RTP_URING_ENTRIES,
+                    RTP_URING_STREAMS * RTP_URING_BUFFERS) ||
+      !uring_.RegisterFiles(RTP_URING_STREAMS))
+    return false;
+  if ((wake_ = eventfd(0, EFD_CLOEXEC)) < 0) {
+    uring_.Close();
+    return false;
+  }
+
+  // Elevated like the receive threads it replaces
+  pthread_attr_init(&tattr);
+  pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
+  pthread_attr_setinheritsched(&tattr, PTHREAD_EXPLICIT_SCHED);
+  pthread_attr_setschedpolicy(&tattr, SCHED_FIFO);
+  param.sched_priority = 99;
+  pthread_attr_setschedparam(&tattr, &param);
+  running_ = true;
+  if (pthread_create(&thread_, &tattr, Thread, this) != 0) {
+    pthread_attr_destroy(&tattr);
+    pthread_attr_init(&tattr);
+    pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread_, &tattr, Thread, this) != 0) {
+      cout << "ERROR starting io_uring receive thread\n";
+      running_ = false;
+      close(wake_);
+      wake_ = -1;
+      uring_.Close();
+    }
+  }
+  pthread_attr_destroy(&tattr);
+  return running_;
+}
+
+void UringReceiver::Wake() {
+  uint64_t one = 1;
+
+  if (write(wake_, &one, sizeof(one)) < 0)
+    cout << "[RTP] io_uring receiver wake failed\n";
+}
+
+//
+// Take in stream's datagrams from its bound sockfd_in_. Returns false if
+// io_uring can not be used, the stream then keeps its own receive thread.
+//
+bool UringReceiver::Attach(RtpStream * stream) {
+  int slot = -1;
+  bool ok;
+
+  pthread_mutex_lock(&mutex_);
+  if (!Start()) {
+    pthread_mutex_unlock(&mutex_);
+    return false;
+  }
+  for (int c = 0; (c < RTP_URING_STREAMS) && (slot < 0); c++) {
+    if (!slots_[c].stream)
+      slot = c;
+  }
+  if (slot < 0) {
+    cout << "[RTP] io_uring receiver is full\n";
+    pthread_mutex_unlock(&mutex_);
+    return false;
+  }
+  slots_[slot].stream = stream;
+  slots_[slot].pending = true;
+  Wake();
+  while (slots_[slot].pending)
+    pthread_cond_wait(&cond_, &mutex_);
+  ok = slots_[slot].state == URING_ARMED;
+  pthread_mutex_unlock(&mutex_);
+  return ok;
+}
+
+/* Stop taking in stream's datagrams, no callback runs for it after this */
+void UringReceiver::Detach(RtpStream * stream) {
+  pthread_mutex_lock(&mutex_);
+  for (int c = 0; c < RTP_URING_STREAMS; c++) {
+    if (slots_[c].stream != stream)
+      continue;
+    slots_[c].detach = true;
+    Wake();
+    while (slots_[c].stream == stream)
+      pthread_cond_wait(&cond_, &mutex_);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+/* Next submission entry, flushing the queue to the kernel if it is full */
+struct io_uring_sqe *UringReceiver::Sqe() {
+  struct io_uring_sqe *sqe = uring_.Sqe();
+
+  if (!sqe) {
+    uring_.Submit(0);
+    provide_ = 0;
+    sqe = uring_.Sqe();
+  }
+  return sqe;
+}
+
+//
+// Hand count buffers from buffer on back to the slot's group. Buffers are
+// mostly used up in order, so a run is one PROVIDE_BUFFERS extended as it
+// grows rather than one per datagram.
+//
+void UringReceiver::Provide(int slot, int buffer, int count) {
+  struct io_uring_sqe *sqe = provide_;
+
+  if (sqe && (sqe->buf_group == slot) &&
+      ((int) (sqe->off + sqe->fd) == buffer)) {
+    sqe->fd += count;
+    return;
+  }
+  sqe = Sqe();
+  sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+  sqe->fd = count;
+  sqe->addr = (uint64_t) (uintptr_t) & slots_[slot].buffers[(size_t) buffer *
+                                                            URING_BUFFER_SIZE];
+  sqe->len = URING_BUFFER_SIZE;
+  sqe->off = buffer;
+  sqe->buf_group = slot;
+  sqe->user_data = ((uint64_t) slot << 8) | URING_BUFFERS;
+  provide_ = sqe;
+}
+
+/* Multishot recvmsg() into the slot's buffer group */
+void UringReceiver::Receive(int slot) {
+  struct io_uring_sqe *sqe = Sqe();
+
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = slot;
+  sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->addr = (uint64_t) (uintptr_t) & slots_[slot].msg;
+  sqe->buf_group = slot;
+  sqe->user_data = ((uint64_t) slot << 8) | URING_RECV;
+}
+
+/* Buffers, the socket and the receive for a newly attached stream */
+bool UringReceiver::Arm(int slot) {
+  UringSlot *s = &slots_[slot];
+
+  s->buffers = (uint8_t *) FrameMemory::Allocate((size_t) RTP_URING_BUFFERS *
+                                                 URING_BUFFER_SIZE,
+                                                 s->stream->HugePages(),
+                                                 s->stream->MemoryNode(true));
+  if (!s->buffers)
+    return false;
+  if (!uring_.SetFile(slot, s->stream->sockfd_in_)) {
+    FrameMemory::Free((char *) s->buffers);
+    s->buffers = 0;
+    return false;
+  }
+  memset(&s->msg, 0, sizeof(s->msg));
+  Provide(slot, 0, RTP_URING_BUFFERS);
+  Receive(slot);
+  return true;
+}
+
+//
+// Nothing is in flight for slot any more, let Detach() return. The group is
+// emptied before anything queued after it can provide to it again.
+//
+void UringReceiver::Teardown(int slot) {
+  UringSlot *s = &slots_[slot];
+  struct io_uring_sqe *sqe = Sqe();
+
+  sqe->opcode = IORING_OP_REMOVE_BUFFERS;
+  sqe->fd = RTP_URING_BUFFERS;
+  sqe->buf_group = slot;
+  sqe->user_data = ((uint64_t) slot << 8) | URING_BUFFERS;
+  provide_ = 0;
+  uring_.SetFile(slot, -1);
+  FrameMemory::Free((char *) s->buffers);
+  s->buffers = 0;
+  pthread_mutex_lock(&mutex_);
+  s->state = URING_FREE;
+  s->detach = false;
+  s->stream = 0;
+  pthread_cond_broadcast(&cond_);
+  pthread_mutex_unlock(&mutex_);
+}
+
+/* Arm newly attached streams and cancel detached ones */
+void UringReceiver::Update() {
+  std::vector < int >teardown;
+
+  pthread_mutex_lock(&mutex_);
+  for (int c = 0; c < RTP_URING_STREAMS; c++) {
+    UringSlot *s = &slots_[c];
+
+    if (s->pending) {
+      s->state = Arm(c) ? URING_ARMED : URING_FREE;
+      if (s->state == URING_FREE)
+        s->stream = 0;
+      s->pending = false;
+      pthread_cond_broadcast(&cond_);
+    }
+    if (s->detach && (s->state == URING_ARMED)) {
+      struct io_uring_sqe *sqe = Sqe();
+
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->addr = ((uint64_t) c << 8) | URING_RECV;
+      sqe->user_data = ((uint64_t) c << 8) | URING_CANCEL;
+      s->state = URING_CANCELLING;
+    } else if (s->detach && (s->state == URING_FAILED))
+      teardown.push_back(c);
+  }
+  pthread_mutex_unlock(&mutex_);
+  for (size_t c = 0; c < teardown.size(); c++)
+    Teardown(teardown[c]);
+
+  if (!wake_armed_) {
+    struct io_uring_sqe *sqe = Sqe();
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wake_;
+    sqe->addr = (uint64_t) (uintptr_t) & wake_count_;
+    sqe->len = sizeof(wake_count_);
+    sqe->user_data = URING_WAKE;
+    wake_armed_ = true;
+  }
+}
+
+//
+// A completion for slot's receive. The datagram is depacketized straight out
+// of the provided buffer, which is then handed back. A multishot receive
+// that ends (out of buffers, cancelled or failed) is rearmed or torn down.
+//
+void UringReceiver::Received(int slot, struct io_uring_cqe *cqe, uint64_t now) {
+  UringSlot *s = &slots_[slot];
+
+  if (cqe->flags & IORING_CQE_F_BUFFER) {
+    int buffer = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)
+      &s->buffers[(size_t) buffer * URING_BUFFER_SIZE];
+
+    if ((cqe->res >= (int) sizeof(*out)) && !(out->flags & MSG_TRUNC) &&
+        (s->state == URING_ARMED)) {
+      s->stream->rx_now_ = now;
+      s->stream->Depacketize((char *) (out + 1), out->payloadlen);
+    }
+    Provide(slot, buffer);
+  }
+  if (cqe->flags & IORING_CQE_F_MORE)
+    return;
+
+  if (s->state == URING_CANCELLING)
+    Teardown(slot);
+  else if ((cqe->res >= 0) || (cqe->res == -ENOBUFS) || (cqe->res == -EINTR))
+    Receive(slot);
+  else {
+    cout << "[RTP] Receive socket failure fd=" << s->stream->sockfd_in_ <<
+      " " << strerror(-cqe->res) << "\n";
+    s->state = URING_FAILED;
+  }
+}
+
+void *UringReceiver::Thread(void *data) {
+  ((UringReceiver *) data)->Run();
+  return 0;
+}
+
+void UringReceiver::Run() {
+  while (true) {
+    uint64_t timeout = 0;
+    uint64_t now;
+    unsigned ready;
+
+    Update();
+
+    /* Wake up in time to expire frames in the jitter buffers */
+    for (int c = 0; c < RTP_URING_STREAMS; c++) {
+      if (slots_[c].state == URING_ARMED) {
+        int window = slots_[c].stream->rx_jitter_buffer_.Window();
+        uint64_t ns = (uint64_t) (window < 1 ? 1 : window) * 1000000;
+
+        if (!timeout || (ns < timeout))
+          timeout = ns;
+      }
+    }
+    provide_ = 0;
+    if ((uring_.Submit(1, timeout) < 0) && (errno != ETIME)) {
+      cout << "[RTP] io_uring receive failure " << strerror(errno) << "\n";
+      usleep(1000);
+    }
+
+    now = RtpPacer::Now();
+    ready = uring_.Ready();
+    {
+      RTP_TRACE_SCOPE(TRACE_RX_DEPACKETIZE);
+
+      for (unsigned c = 0; c < ready; c++) {
+        struct io_uring_cqe *cqe = uring_.Completion(c);
+        int slot = cqe->user_data >> 8;
+
+        switch (cqe->user_data & 0xFF) {
+        case URING_RECV:
+          Received(slot, cqe, now);
+          break;
+        case URING_WAKE:
+          wake_armed_ = false;
+          break;
+        }
+      }
+    }
+    uring_.Consume(ready);
+
+    for (int c = 0; c < RTP_URING_STREAMS; c++) {
+      if (slots_[c].state == URING_ARMED)
+        slots_[c].stream->rx_jitter_buffer_.Expire(now);
+    }
+  }
+}
+
+#else
+
+bool UringReceiver::Start() {
+  return false;
+}
+
+bool UringReceiver::Attach(RtpStream * stream) {
+  return false;
+}
+
+void UringReceiver::Detach(RtpStream * stream) {
+}
+
+#endif
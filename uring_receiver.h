@@ -0,0 +1,71 @@
+/*
+ * One io_uring receive thread for any number of RtpStream inputs. Every
+ * stream's socket has a multishot recvmsg() armed on one shared ring, each
+ * with its own group of provided buffers, so a single thread asleep in one
+ * io_uring_enter() takes in datagrams for all of them with no system call
+ * per packet or per stream. Buffers go back to the kernel, in runs, with
+ * the next submission once the lines are copied out.
+ *
+ * Streams opened with SetIoBackend(IO_URING) attach to the process wide
+ * Shared() receiver when Uring::Available(), their frame callbacks then run
+ * on its thread.
+ */
+
+#ifndef __URING_RECEIVER_H__
+#define __URING_RECEIVER_H__
+
+#include <pthread.h>
+#include "rtp_stream.h"
+#include "uring.h"
+
+#define RTP_URING_STREAMS     64        /* streams per receiver */
+#define RTP_URING_BUFFERS     512       /* provided receive buffers per stream */
+#define RTP_URING_ENTRIES     256
+
+typedef enum {
+  URING_FREE,
+  URING_ARMED,                  /* multishot recvmsg() in flight */
+  URING_CANCELLING,             /* waiting for its last completion */
+  URING_FAILED                  /* socket error, nothing in flight */
+} UringState;
+
+typedef struct {
+  RtpStream *stream;            /* set by Attach(), cleared by the thread */
+  bool pending;                 /* waiting to be armed */
+  bool detach;                  /* waiting to be cancelled */
+  UringState state;             /* only changed by the thread */
+  struct msghdr msg;            /* recvmsg() layout, payload only */
+  uint8_t *buffers;             /* RTP_URING_BUFFERS, the slot's buffer group */
+} UringSlot;
+
+class UringReceiver {
+public:
+  static UringReceiver *Shared();
+  bool Attach(RtpStream * stream);
+  void Detach(RtpStream * stream);
+private:
+  UringReceiver();
+  bool Start();
+  static void *Thread(void *data);
+  void Run();
+  void Update();
+  struct io_uring_sqe *Sqe();
+  void Wake();
+  bool Arm(int slot);
+  void Receive(int slot);
+  void Received(int slot, struct io_uring_cqe *cqe, uint64_t now);
+  void Provide(int slot, int buffer, int count = 1);
+  void Teardown(int slot);
+  Uring uring_;
+  struct io_uring_sqe *provide_;        /* last queued PROVIDE_BUFFERS, to extend */
+  UringSlot slots_[RTP_URING_STREAMS];
+  int wake_;                    /* eventfd, Attach() and Detach() poke the thread */
+  uint64_t wake_count_;
+  bool wake_armed_;
+  bool running_;
+  pthread_t thread_;
+  pthread_mutex_t mutex_;
+  pthread_cond_t cond_;
+};
+
+#endif
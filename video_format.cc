@@ -0,0 +1,290 @@
+#include <string.h>
+#include "video_format.h"
+
+typedef struct {
+  const char *name;
+  int samples;                  /* in the smallest block of whole pixels */
+  int xinc;                     /* width of the block */
+  int yinc;                     /* height of the block */
+} SamplingInfo;
+
+static const SamplingInfo samplings[] = {
+  {"YCbCr-4:2:2", 4, 2, 1},
+  {"YCbCr-4:4:4", 3, 1, 1},
+  {"YCbCr-4:2:0", 6, 2, 2},
+  {"RGB", 3, 1, 1},
+  {"RGBA", 4, 1, 1},
+  {"BGR", 3, 1, 1},
+  {"BGRA", 4, 1, 1},
+};
+
+//
+// Scalar kernels. Wire samples are packed most significant bit first, so a
+// 10 bit run is 4 samples to 5 bytes and a 12 bit run 2 samples to 3 bytes.
+//
+static void Copy8(const uint8_t * src, uint8_t * dst, int samples) {
+  memcpy(dst, src, samples);
+}
+
+static void Pack16(const uint8_t * src, uint8_t * dst, int samples) {
+  for (int x = 0; x < samples; x++) {
+    uint16_t s;
+
+    memcpy(&s, &src[x * 2], sizeof(s));
+    dst[x * 2] = s >> 8;
+    dst[x * 2 + 1] = s & 0xFF;
+  }
+}
+
+static void Unpack16(const uint8_t * src, uint8_t * dst, int samples) {
+  for (int x = 0; x < samples; x++) {
+    uint16_t s = (src[x * 2] << 8) | src[x * 2 + 1];
+
+    memcpy(&dst[x * 2], &s, sizeof(s));
+  }
+}
+
+/* From sample start, shared with the SIMD kernels for their tails */
+static inline void Pack10Scalar(const uint8_t * src, uint8_t * dst,
+                                int start, int samples) {
+  for (int x = start; x < samples; x += 4) {
+    uint16_t s[4];
+    uint64_t bits;
+    uint8_t *out = &dst[x / 4 * 5];
+
+    memcpy(s, &src[x * 2], sizeof(s));
+    bits = ((uint64_t) (s[0] & 0x3FF) << 30) | ((uint64_t) (s[1] & 0x3FF) << 20) |
+      ((s[2] & 0x3FF) << 10) | (s[3] & 0x3FF);
+    for (int c = 0; c < 5; c++)
+      out[c] = bits >> (32 - c * 8);
+  }
+}
+
+static inline void Unpack10Scalar(const uint8_t * src, uint8_t * dst,
+                                  int start, int samples) {
+  for (int x = start; x < samples; x += 4) {
+    const uint8_t *in = &src[x / 4 * 5];
+    uint64_t bits = 0;
+    uint16_t s[4];
+
+    for (int c = 0; c < 5; c++)
+      bits = (bits << 8) | in[c];
+    for (int c = 0; c < 4; c++)
+      s[c] = (bits >> (30 - c * 10)) & 0x3FF;
+    memcpy(&dst[x * 2], s, sizeof(s));
+  }
+}
+
+static void Pack10(const uint8_t * src, uint8_t * dst, int samples) {
+  Pack10Scalar(src, dst, 0, samples);
+}
+
+static void Unpack10(const uint8_t * src, uint8_t * dst, int samples) {
+  Unpack10Scalar(src, dst, 0, samples);
+}
+
+static void Pack12(const uint8_t * src, uint8_t * dst, int samples) {
+  for (int x = 0; x < samples; x += 2) {
+    uint16_t s[2];
+    uint8_t *out = &dst[x / 2 * 3];
+
+    memcpy(s, &src[x * 2], sizeof(s));
+    s[0] &= 0xFFF;
+    s[1] &= 0xFFF;
+    out[0] = s[0] >> 4;
+    out[1] = ((s[0] & 0xF) << 4) | (s[1] >> 8);
+    out[2] = s[1] & 0xFF;
+  }
+}
+
+static void Unpack12(const uint8_t * src, uint8_t * dst, int samples) {
+  for (int x = 0; x < samples; x += 2) {
+    const uint8_t *in = &src[x / 2 * 3];
+    uint16_t s[2];
+
+    s[0] = (in[0] << 4) | (in[1] >> 4);
+    s[1] = ((in[1] & 0xF) << 8) | in[2];
+    memcpy(&dst[x * 2], s, sizeof(s));
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define SSSE3 __attribute__ ((target("ssse3")))
+#define AVX2 __attribute__ ((target("avx2")))
+
+//
+// 10 bit packing, 8 samples per 128 bit lane. Pairs of samples are joined
+// into 20 bits with a multiply-add, pairs of pairs into 40 bits in each 64
+// bit lane, then the 5 low bytes of each are shuffled out big endian. Stores
+// and loads run up to 6 bytes past the 10 packed ones, the loops stop early
+// enough for that to stay inside the run.
+//
+static void SSSE3 Pack10Ssse3(const uint8_t * src, uint8_t * dst, int samples) {
+  const __m128i mask = _mm_set1_epi16(0x3FF);
+  const __m128i join = _mm_set1_epi32(0x00010400);
+  const __m128i low = _mm_set_epi32(0, -1, 0, -1);
+  const __m128i order = _mm_setr_epi8(4, 3, 2, 1, 0, 12, 11, 10, 9, 8,
+                                      -1, -1, -1, -1, -1, -1);
+  int x;
+
+  for (x = 0; x + 16 <= samples; x += 8) {
+    __m128i s = _mm_and_si128(_mm_loadu_si128((const __m128i *) &src[x * 2]),
+                              mask);
+    __m128i p = _mm_madd_epi16(s, join);
+    __m128i q = _mm_or_si128(_mm_slli_epi64(_mm_and_si128(p, low), 20),
+                             _mm_srli_epi64(p, 32));
+
+    _mm_storeu_si128((__m128i *) & dst[x / 4 * 5], _mm_shuffle_epi8(q, order));
+  }
+  Pack10Scalar(src, dst, x, samples);
+}
+
+static void SSSE3 Unpack10Ssse3(const uint8_t * src, uint8_t * dst,
+                                int samples) {
+  const __m128i order = _mm_setr_epi8(4, 3, 2, 1, 0, -1, -1, -1,
+                                      9, 8, 7, 6, 5, -1, -1, -1);
+  const __m128i high = _mm_set_epi32(0xFFFFF, 0, 0xFFFFF, 0);
+  const __m128i mask = _mm_set1_epi32(0x3FF);
+  int x;
+
+  for (x = 0; x + 16 <= samples; x += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *) &src[x / 4 * 5]);
+    __m128i q = _mm_shuffle_epi8(v, order);
+    __m128i p = _mm_or_si128(_mm_srli_epi64(q, 20),
+                             _mm_and_si128(_mm_slli_epi64(q, 32), high));
+    __m128i s = _mm_or_si128(_mm_srli_epi32(p, 10),
+                             _mm_slli_epi32(_mm_and_si128(p, mask), 16));
+
+    _mm_storeu_si128((__m128i *) & dst[x * 2], s);
+  }
+  Unpack10Scalar(src, dst, x, samples);
+}
+
+/* The SSSE3 kernels in both 128 bit lanes, 16 samples per iteration */
+static void AVX2 Pack10Avx2(const uint8_t * src, uint8_t * dst, int samples) {
+  const __m256i mask = _mm256_set1_epi16(0x3FF);
+  const __m256i join = _mm256_set1_epi32(0x00010400);
+  const __m256i low = _mm256_set_epi32(0, -1, 0, -1, 0, -1, 0, -1);
+  const __m256i order = _mm256_setr_epi8(4, 3, 2, 1, 0, 12, 11, 10, 9, 8,
+                                         -1, -1, -1, -1, -1, -1,
+                                         4, 3, 2, 1, 0, 12, 11, 10, 9, 8,
+                                         -1, -1, -1, -1, -1, -1);
+  int x;
+
+  for (x = 0; x + 24 <= samples; x += 16) {
+    __m256i s = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)
+                                                    &src[x * 2]), mask);
+    __m256i p = _mm256_madd_epi16(s, join);
+    __m256i q = _mm256_or_si256(_mm256_slli_epi64(_mm256_and_si256(p, low), 20),
+                                _mm256_srli_epi64(p, 32));
+    __m256i out = _mm256_shuffle_epi8(q, order);
+    uint8_t *d = &dst[x / 4 * 5];
+
+    _mm_storeu_si128((__m128i *) d, _mm256_castsi256_si128(out));
+    _mm_storeu_si128((__m128i *) (d + 10), _mm256_extracti128_si256(out, 1));
+  }
+  Pack10Scalar(src, dst, x, samples);
+}
+
+static void AVX2 Unpack10Avx2(const uint8_t * src, uint8_t * dst, int samples) {
+  const __m256i order = _mm256_setr_epi8(4, 3, 2, 1, 0, -1, -1, -1,
+                                         9, 8, 7, 6, 5, -1, -1, -1,
+                                         4, 3, 2, 1, 0, -1, -1, -1,
+                                         9, 8, 7, 6, 5, -1, -1, -1);
+  const __m256i high = _mm256_set_epi32(0xFFFFF, 0, 0xFFFFF, 0,
+                                        0xFFFFF, 0, 0xFFFFF, 0);
+  const __m256i mask = _mm256_set1_epi32(0x3FF);
+  int x;
+
+  for (x = 0; x + 24 <= samples; x += 16) {
+    const uint8_t *in = &src[x / 4 * 5];
+    __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256
+                                        (_mm_loadu_si128((const __m128i *) in)),
+                                        _mm_loadu_si128((const __m128i *)
+                                                        (in + 10)), 1);
+    __m256i q = _mm256_shuffle_epi8(v, order);
+    __m256i p = _mm256_or_si256(_mm256_srli_epi64(q, 20),
+                                _mm256_and_si256(_mm256_slli_epi64(q, 32),
+                                                 high));
+    __m256i s = _mm256_or_si256(_mm256_srli_epi32(p, 10),
+                                _mm256_slli_epi32(_mm256_and_si256(p, mask),
+                                                  16));
+
+    _mm256_storeu_si256((__m256i *) & dst[x * 2], s);
+  }
+  Unpack10Scalar(src, dst, x, samples);
+}
+
+#endif
+
+//
+// Work out the pgroup for a sampling and depth and pick its kernels, simd
+// false forces the scalar ones. Returns false for a depth RFC 4175 does not
+// define.
+//
+bool VideoFormatInit(VideoFormat * format, Sampling sampling, int depth,
+                     bool simd) {
+  const SamplingInfo *info;
+  int blocks = 1;
+
+  if (((unsigned) sampling >= sizeof(samplings) / sizeof(samplings[0])) ||
+      ((depth != 8) && (depth != 10) && (depth != 12) && (depth != 16)))
+    return false;
+  info = &samplings[sampling];
+
+  /* Smallest number of blocks that ends on a byte */
+  while ((blocks * info->samples * depth) % 8)
+    blocks++;
+
+  format->sampling = sampling;
+  format->depth = depth;
+  format->samples = blocks * info->samples;
+  format->pgroup = format->samples * depth / 8;
+  format->xinc = blocks * info->xinc;
+  format->yinc = info->yinc;
+  format->host = format->samples * (depth == 8 ? 1 : 2);
+  format->name = info->name;
+
+  switch (depth) {
+  case 8:
+    format->kernel = "copy";
+    format->pack = Copy8;
+    format->unpack = Copy8;
+    break;
+  case 10:
+    format->kernel = "scalar";
+    format->pack = Pack10;
+    format->unpack = Unpack10;
+#if defined(__x86_64__) || defined(__i386__)
+    if (simd && __builtin_cpu_supports("avx2")) {
+      format->kernel = "avx2";
+      format->pack = Pack10Avx2;
+      format->unpack = Unpack10Avx2;
+    } else if (simd && __builtin_cpu_supports("ssse3")) {
+      format->kernel = "ssse3";
+      format->pack = Pack10Ssse3;
+      format->unpack = Unpack10Ssse3;
+    }
+#endif
+    break;
+  case 12:
+    format->kernel = "scalar";
+    format->pack = Pack12;
+    format->unpack = Unpack12;
+    break;
+  case 16:
+    format->kernel = "swap";
+    format->pack = Pack16;
+    format->unpack = Unpack16;
+    break;
+  }
+  return true;
+}
+
+/* Whole pgroups across and down, and line offsets that fit in 15 bits */
+bool VideoFormatFits(const VideoFormat * format, int height, int width) {
+  return (width > 0) && (height > 0) && (width % format->xinc == 0) &&
+    (height % format->yinc == 0) && (width <= 0x7FFF) && (height <= 0x7FFF);
+}
@@ -0,0 +1,72 @@
+/*
+ * RFC 4175 sampling and depth. A VideoFormat describes the pixel group
+ * (pgroup), the smallest whole number of bytes on the wire holding whole
+ * pixels, and carries the pack/unpack kernels for its depth.
+ *
+ * Frames in memory are the pgroups in wire order with every sample widened
+ * to one byte (8 bit) or one host order 16 bit word (10, 12 and 16 bit),
+ * low bits used. So an 8 bit frame is exactly the wire data (UYVY for
+ * 4:2:2, R G B for RGB, Cb Y Cr for 4:4:4) and a 10 bit 4:2:2 frame is
+ * 16 bit Cb Y0 Cr Y1. A 4:2:0 pgroup spans two lines, Y00 Y01 Y10 Y11 Cb Cr,
+ * so a 4:2:0 frame is height / 2 rows of line pairs.
+ *
+ * The kernels only see a run of samples, sampling never reaches the inner
+ * loop. 8 bit is a copy, 16 bit a byte swap, 10 and 12 bit are bit packed
+ * big endian; 10 bit has SSSE3 and AVX2 versions picked at run time.
+ */
+
+#ifndef __VIDEO_FORMAT_H__
+#define __VIDEO_FORMAT_H__
+
+#include <stdint.h>
+
+typedef enum {
+  SAMPLING_YCBCR_422,           /* Cb Y0 Cr Y1 */
+  SAMPLING_YCBCR_444,           /* Cb Y Cr */
+  SAMPLING_YCBCR_420,           /* Y00 Y01 Y10 Y11 Cb Cr */
+  SAMPLING_RGB,
+  SAMPLING_RGBA,
+  SAMPLING_BGR,
+  SAMPLING_BGRA
+} Sampling;
+
+/* Pack or unpack a run of samples, a whole number of pgroups */
+typedef void (*SampleKernel) (const uint8_t * src, uint8_t * dst, int samples);
+
+typedef struct {
+  Sampling sampling;
+  int depth;                    /* bits per sample, 8, 10, 12 or 16 */
+  int pgroup;                   /* bytes per pixel group on the wire */
+  int xinc;                     /* pixels per pixel group along the line */
+  int yinc;                     /* lines per pixel group, 2 for 4:2:0 */
+  int samples;                  /* samples per pixel group */
+  int host;                     /* bytes per pixel group in memory */
+  const char *name;             /* SDP sampling= */
+  const char *kernel;           /* name of the kernels in use */
+  SampleKernel pack;            /* memory to wire */
+  SampleKernel unpack;          /* wire to memory */
+} VideoFormat;
+
+bool VideoFormatInit(VideoFormat * format, Sampling sampling, int depth,
+                     bool simd = true);
+bool VideoFormatFits(const VideoFormat * format, int height, int width);
+
+/* Rows are pgroup rows, one line (or a line pair for 4:2:0) */
+static inline int VideoRows(const VideoFormat * format, int height) {
+  return height / format->yinc;
+}
+
+static inline int VideoRowBytes(const VideoFormat * format, int width) {
+  return width / format->xinc * format->pgroup;
+}
+
+static inline int VideoHostRowBytes(const VideoFormat * format, int width) {
+  return width / format->xinc * format->host;
+}
+
+static inline int VideoFrameBytes(const VideoFormat * format, int height,
+                                  int width) {
+  return VideoRows(format, height) * VideoHostRowBytes(format, width);
+}
+
+#endif